@@ -0,0 +1,77 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Thin client of phemiad (`Phemia --daemon <socket>`, see llvm/server.hpp). Takes the same
+ * arguments as Phemia and forwards them, together with the working directory and stdio, to the
+ * daemon listening on $PHEMIAD_SOCKET (default /tmp/phemiad.sock). Exits with the status the
+ * daemon reports.
+ */
+int main(int argc, char **argv) {
+    const char *path = getenv("PHEMIAD_SOCKET");
+    if (!path) path = "/tmp/phemiad.sock";
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "phemiac: cannot connect to %s\n", path);
+        return 1;
+    }
+
+    size_t length = 0;
+    for (int i = 1; i < argc; i++) length += strlen(argv[i]) + 1;
+    char *payload = malloc(length + 1);
+    char *p = payload;
+    for (int i = 1; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], n);
+        p += n;
+    }
+
+    int fds[4] = {open(".", O_RDONLY), 0, 1, 2};
+    uint32_t header = (uint32_t) length;
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&header, sizeof(header)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (fds[0] < 0 || sendmsg(conn, &msg, 0) != sizeof(header) ||
+        write(conn, payload, length) != (ssize_t) length) {
+        fprintf(stderr, "phemiac: cannot send request\n");
+        return 1;
+    }
+
+    int32_t status;
+    char *s = (char *) &status;
+    size_t got = 0;
+    while (got < sizeof(status)) {
+        ssize_t n = read(conn, s + got, sizeof(status) - got);
+        if (n <= 0) {
+            fprintf(stderr, "phemiac: lost connection to daemon\n");
+            return 1;
+        }
+        got += n;
+    }
+    free(payload);
+    close(conn);
+    return status;
+}
@@ -0,0 +1,143 @@
+#ifndef PHEMIA_BACKEND_HPP
+#define PHEMIA_BACKEND_HPP
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
+
+extern char **environ;
+
+/*
+ * Object code straight from the compiler instead of through llc. With more than one job the module
+ * is cut into that many partitions by function (SplitModule, which gives whatever the partitions
+ * share external linkage), each partition is lowered on its own thread in an LLVMContext of its own
+ * (a context is not thread safe, so partitions travel between them as bitcode), and the objects
+ * are combined into one with `ld -r`.
+ */
+class Backend {
+public:
+    unsigned jobs = 1;
+    /* what went wrong when emitObject returns false */
+    std::string error;
+
+    bool emitObject(llvm::Module &module, const std::string &path) {
+        auto machine = targetMachine(llvm::sys::getDefaultTargetTriple(), error);
+        if (!machine) return false;
+        module.setTargetTriple(machine->getTargetTriple().str());
+        module.setDataLayout(machine->createDataLayout());
+        /* module cloning drops ifuncs (see TargetChoice), such a module is lowered whole */
+        if (jobs <= 1 || !module.ifunc_empty()) return lower(module, path, error);
+
+        std::vector<llvm::SmallString<0>> parts;
+        auto keep = [&parts](std::unique_ptr<llvm::Module> part) {
+            parts.emplace_back();
+            llvm::raw_svector_ostream out(parts.back());
+            llvm::WriteBitcodeToFile(*part, out);
+        };
+#if LLVM_VERSION_MAJOR >= 13
+        llvm::SplitModule(module, jobs, keep);
+#else
+        llvm::SplitModule(llvm::CloneModule(module), jobs, keep);
+#endif
+
+        std::vector<std::string> objects(parts.size());
+        std::vector<std::string> errors(parts.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < parts.size(); i++) {
+            objects[i] = path + "." + std::to_string(i) + ".o";
+            workers.emplace_back([&parts, &objects, &errors, i] {
+                llvm::LLVMContext context;
+                llvm::MemoryBufferRef buffer(llvm::StringRef(parts[i].data(), parts[i].size()), "partition");
+                auto part = llvm::parseBitcodeFile(buffer, context);
+                if (!part) {
+                    errors[i] = llvm::toString(part.takeError());
+                    return;
+                }
+                lower(**part, objects[i], errors[i]);
+            });
+        }
+        for (auto &worker: workers) worker.join();
+        bool ok = true;
+        for (auto &message: errors) {
+            if (!message.empty() && ok) {
+                error = message;
+                ok = false;
+            }
+        }
+        ok = ok && link(objects, path);
+        for (auto &object: objects) std::remove(object.c_str());
+        return ok;
+    }
+
+private:
+    /* the machine llc would pick by default, with position independent code so either way of linking works */
+    static std::unique_ptr<llvm::TargetMachine> targetMachine(const std::string &triple, std::string &error) {
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) return nullptr;
+        return std::unique_ptr<llvm::TargetMachine>(
+                target->createTargetMachine(triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+    }
+
+    static bool lower(llvm::Module &module, const std::string &path, std::string &error) {
+        auto machine = targetMachine(module.getTargetTriple(), error);
+        if (!machine) return false;
+        std::error_code ec;
+        llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::OF_None);
+        if (ec) {
+            error = path + ": " + ec.message();
+            return false;
+        }
+        llvm::legacy::PassManager passes;
+        if (machine->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+            error = "no object code for " + module.getTargetTriple();
+            return false;
+        }
+        passes.run(module);
+        return true;
+    }
+
+    /* one relocatable object out of several */
+    bool link(const std::vector<std::string> &objects, const std::string &path) {
+        std::vector<std::string> args{"ld", "-r", "-o", path};
+        args.insert(args.end(), objects.begin(), objects.end());
+        std::vector<char *> argv;
+        for (auto &arg: args) argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        pid_t pid;
+        if (posix_spawnp(&pid, "ld", nullptr, nullptr, argv.data(), environ) != 0) {
+            error = "cannot run ld";
+            return false;
+        }
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            error = "ld -r failed for " + path;
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif //PHEMIA_BACKEND_HPP
@@ -0,0 +1,790 @@
+#ifndef PHEMIA_CHECK_HPP
+#define PHEMIA_CHECK_HPP
+
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "node.h"
+#include "parser.hpp"
+
+/*
+ * Name and type checking over the AST, run on each top-level statement before it is lowered so that
+ * code generation only ever sees well-formed input. Scoping follows ARStack: one scope per function
+ * (blocks do not open one), and function bodies see everything declared before them. A name may be
+ * declared again in another block of the same function, where ARStack reuses the variable, as long
+ * as the type stays the same.
+ *
+ * Types are only inferred where that is cheap (declared variables, literals, calls, arithmetic); an
+ * expression of unknown type is never reported, so anything the checker cannot judge is left to
+ * code generation as before. Everything is kept by value, statements may be freed once checked.
+ */
+class SemanticCheck {
+    struct Type {
+        /* empty when unknown */
+        std::string name;
+        size_t dims = 0;
+        /* a const int, char or boolean with a constant initializer, which may label a case */
+        bool isConstant = false;
+        int64_t value = 0;
+
+        bool known() const { return !name.empty(); }
+    };
+
+    struct Signature {
+        std::string name;
+        Type result;
+        std::vector<Type> params;
+        /* calling it yields a task, `await` on the call yields the result */
+        bool isAsync = false;
+    };
+
+    struct ClassShape {
+        std::map<std::string, Type> fields;
+        std::map<std::string, Signature> methods;
+    };
+
+    std::vector<std::map<std::string, Type>> scopes{{}};
+    /* names declared per block, innermost last */
+    std::vector<std::set<std::string>> blocks{{}};
+    std::map<std::string, Signature> functions;
+    std::map<std::string, ClassShape> classes;
+    /* the function being checked, innermost last */
+    std::vector<Signature> enclosing;
+    int loops = 0;
+    int switches = 0;
+
+public:
+    void analyze(Node *statement) { visit(statement); }
+
+private:
+    static void error(Node *node, const std::string &message) { diagnostics.error(node->line, 0, message); }
+
+    static bool isNumeric(const Type &type) {
+        return !type.dims && (type.name == "int" || type.name == "char" || type.name == "double" ||
+                              type.name == "float" || type.name == "boolean");
+    }
+
+    /* float4, int8 ...: the same shapes ARStack::typeOf accepts */
+    static bool isVector(const std::string &name) {
+        for (auto elem: {"int", "float", "double", "char"}) {
+            std::string prefix(elem);
+            if (name.compare(0, prefix.size(), prefix) != 0 || name.size() == prefix.size()) continue;
+            auto digits = name.substr(prefix.size());
+            if (digits.find_first_not_of("0123456789") != std::string::npos || digits.size() > 2) return false;
+            auto lanes = std::stoul(digits);
+            return lanes >= 2 && lanes <= 64 && !(lanes & (lanes - 1));
+        }
+        return false;
+    }
+
+    /* map[string]int ...: int or string keys, numbers as values, the names ARStack::typeOf accepts */
+    static bool isMap(const std::string &name, std::string *key = nullptr, std::string *value = nullptr) {
+        auto close = name.find(']');
+        if (name.compare(0, 4, "map[") != 0 || close == std::string::npos) return false;
+        auto keyName = name.substr(4, close - 4);
+        auto valueName = name.substr(close + 1);
+        if ((keyName != "int" && keyName != "string") || !isNumeric(Type{valueName})) return false;
+        if (key) *key = keyName;
+        if (value) *value = valueName;
+        return true;
+    }
+
+    bool isTypeName(const std::string &name) const {
+        return name == "int" || name == "char" || name == "double" || name == "float" || name == "boolean" ||
+               name == "string" || name == "task" || classes.count(name) || isVector(name) || isMap(name);
+    }
+
+    static std::string describe(const Type &type) {
+        std::string text;
+        for (size_t k = 0; k < type.dims; k++) text += "[]";
+        return text + type.name;
+    }
+
+    static Type typeOf(const NIdentifier &type) {
+        auto arrDim = const_cast<NIdentifier &>(type).getArrayDim();
+        return Type{type.name, arrDim ? arrDim->size() : 0};
+    }
+
+    static bool assignable(const Type &to, const Type &from) {
+        if (!to.known() || !from.known()) return true;
+        if (isNumeric(to) && isNumeric(from)) return true;
+        /* strings and one-dimensional char arrays are both plain char pointers */
+        auto isText = [](const Type &type) {
+            return (type.name == "string" && !type.dims) || (type.name == "char" && type.dims == 1);
+        };
+        if (isText(to) && isText(from)) return true;
+        return to.name == from.name && to.dims == from.dims;
+    }
+
+    Type *lookup(const std::string &name) {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); it++) {
+            auto found = it->find(name);
+            if (found != it->end()) return &found->second;
+        }
+        return nullptr;
+    }
+
+    Type variable(Node *node, const std::string &name) {
+        auto type = lookup(name);
+        if (type) return *type;
+        error(node, "undeclared value '" + name + "'");
+        return Type();
+    }
+
+    void checkType(Node *node, const NIdentifier &type, bool allowVoid) {
+        if ((allowVoid && type.name == "void") || isTypeName(type.name)) return;
+        error(node, "unknown type '" + type.name + "'");
+    }
+
+    void declare(NVariableDeclaration *decl) {
+        checkType(decl, decl->type, false);
+        auto &scope = scopes.back();
+        auto type = typeOf(decl->type);
+        if (decl->isConst && decl->assignmentExpr && isNumeric(type) && type.name != "double" &&
+            type.name != "float") {
+            type.isConstant = constantValue(decl->assignmentExpr, type.value);
+        }
+        auto previous = scope.find(decl->id.name);
+        if (blocks.back().count(decl->id.name)) {
+            error(decl, "redeclared value '" + decl->id.name + "'");
+        } else if (previous != scope.end() && describe(previous->second) != describe(type)) {
+            error(decl, "'" + decl->id.name + "' redeclared as " + describe(type) + ", was " +
+                        describe(previous->second));
+        }
+        blocks.back().insert(decl->id.name);
+        scope[decl->id.name] = type;
+    }
+
+    /* the value of an integer constant expression, what a case label must be; false when it is not one */
+    bool constantValue(NExpression *expression, int64_t &value) {
+        if (auto integer = dynamic_cast<NInteger *>(expression)) {
+            value = integer->value;
+        } else if (auto ch = dynamic_cast<NChar *>(expression)) {
+            value = ch->value;
+        } else if (auto boolean = dynamic_cast<NBoolean *>(expression)) {
+            value = boolean->value;
+        } else if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            auto type = lookup(id->name);
+            if (!type || !type->isConstant) return false;
+            value = type->value;
+        } else if (auto unary = dynamic_cast<NUnaryOperator *>(expression)) {
+            if ((unary->op != MINUS && unary->op != NOT) || !constantValue(unary->rhs, value)) return false;
+            value = unary->op == MINUS ? -value : ~value;
+        } else if (auto binary = dynamic_cast<NBinaryOperator *>(expression)) {
+            int64_t lhs, rhs;
+            if (!constantValue(binary->lhs, lhs) || !constantValue(binary->rhs, rhs)) return false;
+            switch (binary->op) {
+                case PLUS: value = lhs + rhs; break;
+                case MINUS: value = lhs - rhs; break;
+                case MUL: value = lhs * rhs; break;
+                case DIV: if (!rhs) return false; value = lhs / rhs; break;
+                case MOD: if (!rhs) return false; value = lhs % rhs; break;
+                default: return false;
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void expect(Node *node, const Type &to, const Type &from, const std::string &what) {
+        if (!assignable(to, from)) error(node, "cannot assign " + describe(from) + " to " + what + " of type " +
+                                               describe(to));
+    }
+
+    void checkArguments(Node *node, const Signature &callee, ExpressionList &params) {
+        if (params.size() != callee.params.size()) {
+            error(node, "'" + callee.name + "' takes " + std::to_string(callee.params.size()) + " arguments, " +
+                        std::to_string(params.size()) + " given");
+            for (auto item: params) check(item);
+            return;
+        }
+        for (size_t i = 0; i < params.size(); i++) {
+            auto type = check(params[i]);
+            if (!assignable(callee.params[i], type)) {
+                error(params[i], "argument " + std::to_string(i + 1) + " of '" + callee.name + "' must be " +
+                                 describe(callee.params[i]) + ", not " + describe(type));
+            }
+        }
+    }
+
+    Signature signatureOf(NFunctionDeclaration *function, const std::string &name) {
+        checkType(function, function->type, true);
+        Signature signature{name, typeOf(function->type), {}, function->isAsync};
+        for (auto argument: function->arguments) signature.params.push_back(typeOf(argument->type));
+        return signature;
+    }
+
+    void visitFunction(NFunctionDeclaration *function, const Signature &signature, const std::string &self) {
+        auto savedLoops = loops, savedSwitches = switches;
+        loops = switches = 0;
+        scopes.emplace_back();
+        blocks.emplace_back();
+        if (!self.empty()) scopes.back()["this"] = Type{self, 0};
+        for (auto argument: function->arguments) declare(argument);
+        enclosing.push_back(signature);
+        bool returns = false;
+        visitBlock(&function->block, returns);
+        enclosing.pop_back();
+        blocks.pop_back();
+        scopes.pop_back();
+        loops = savedLoops;
+        switches = savedSwitches;
+        if (signature.result.name != "void" && signature.result.known() && !returns) {
+            error(function, "function '" + signature.name + "' needs a return value");
+        }
+    }
+
+    Type check(NExpression *expression) {
+        if (!expression) return Type();
+        if (dynamic_cast<NInteger *>(expression)) {
+            return Type{"int"};
+        } else if (dynamic_cast<NDouble *>(expression)) {
+            return Type{"double"};
+        } else if (dynamic_cast<NFloat *>(expression)) {
+            return Type{"float"};
+        } else if (dynamic_cast<NChar *>(expression)) {
+            return Type{"char"};
+        } else if (dynamic_cast<NBoolean *>(expression)) {
+            return Type{"boolean"};
+        } else if (dynamic_cast<NString *>(expression)) {
+            return Type{"string"};
+        } else if (auto arr = dynamic_cast<NArray *>(expression)) {
+            if (!isTypeName(arr->type->name)) error(arr, "unknown type '" + arr->type->name + "'");
+            Type element{arr->type->name};
+            if (arr->initList) {
+                for (auto item: *arr->initList) expect(item, element, check(item), "an element");
+            }
+            return Type{arr->type->name, arr->arrDim ? arr->arrDim->size() : 0};
+        } else if (auto binary = dynamic_cast<NBinaryOperator *>(expression)) {
+            return checkBinary(binary);
+        } else if (auto unary = dynamic_cast<NUnaryOperator *>(expression)) {
+            auto type = check(unary->rhs);
+            return unary->op == NOT ? Type{"boolean"} : type;
+        } else if (auto element = dynamic_cast<NArrayAssignment *>(expression)) {
+            auto type = indexed(element, element->lhs.name, element->arrayIndices);
+            expect(element, type, check(&element->rhs), "element of '" + element->lhs.name + "'");
+            return type;
+        } else if (auto field = dynamic_cast<NClassAssignment *>(expression)) {
+            auto type = member(field, field->lhs.name, field->attribute.name, field->arrayIndices);
+            expect(field, type, check(&field->rhs), "field '" + field->attribute.name + "'");
+            return type;
+        } else if (auto assign = dynamic_cast<NAssignment *>(expression)) {
+            auto type = variable(assign, assign->lhs.name);
+            expect(assign, type, check(&assign->rhs), "'" + assign->lhs.name + "'");
+            return type;
+        } else if (auto call = dynamic_cast<NFunctionCall *>(expression)) {
+            return checkCall(call);
+        } else if (auto await = dynamic_cast<NAwait *>(expression)) {
+            return checkAwait(await);
+        } else if (auto method = dynamic_cast<NMethodCall *>(expression)) {
+            auto object = objectType(method, method->object.name, method->arrayIndices);
+            if (!object.known()) {
+                for (auto item: method->call.params) check(item);
+                return Type();
+            }
+            auto &methods = classes[object.name].methods;
+            auto found = methods.find(method->call.id.name);
+            if (found == methods.end()) {
+                error(method, "no method '" + method->call.id.name + "' in class " + object.name);
+                for (auto item: method->call.params) check(item);
+                return Type();
+            }
+            checkArguments(method, found->second, method->call.params);
+            return found->second.result;
+        } else if (auto access = dynamic_cast<NMemberAccess *>(expression)) {
+            return member(access, access->object.name, access->member.name, access->arrayIndices);
+        } else if (auto element = dynamic_cast<NArrayElement *>(expression)) {
+            return indexed(element, element->id.name, element->arrayIndices);
+        } else if (auto object = dynamic_cast<NNewObject *>(expression)) {
+            if (classes.count(object->type.name) || isMap(object->type.name)) return Type{object->type.name};
+            error(object, "unknown class '" + object->type.name + "'");
+            return Type();
+        } else if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            return variable(id, id->name);
+        }
+        return Type();
+    }
+
+    Type checkBinary(NBinaryOperator *binary) {
+        auto lhs = check(binary->lhs);
+        auto rhs = check(binary->rhs);
+        /* boolean arrays are bit sets, combined with &&, || and ^ */
+        bool lhsBits = lhs.name == "boolean" && lhs.dims, rhsBits = rhs.name == "boolean" && rhs.dims;
+        if ((lhsBits || rhsBits) && lhs.known() && rhs.known()) {
+            switch (binary->op) {
+                case AND: case OR: case XOR:
+                    if (lhsBits && rhsBits && lhs.dims == rhs.dims) return lhs;
+                    error(binary, "mismatched array operands " + describe(lhs) + " and " + describe(rhs));
+                    return Type();
+                case GT: case GE: case LT: case LE: case NE: case EQ:
+                    break;
+                default:
+                    error(binary, "boolean arrays combine with &&, || and ^ only");
+                    return Type();
+            }
+        }
+        switch (binary->op) {
+            case AND: case OR: case GT: case GE: case LT: case LE: case NE: case EQ:
+                return Type{"boolean"};
+            default:
+                break;
+        }
+        if (!lhs.known() || !rhs.known()) return Type();
+        /* element-wise array arithmetic, numbers are broadcast */
+        if (lhs.dims || rhs.dims) {
+            auto &arr = lhs.dims ? lhs : rhs;
+            auto &other = lhs.dims ? rhs : lhs;
+            if (other.dims ? other.dims != arr.dims : !isNumeric(other)) {
+                error(binary, "mismatched array operands " + describe(lhs) + " and " + describe(rhs));
+                return Type();
+            }
+            return arr;
+        }
+        if (isVector(lhs.name) || isVector(rhs.name)) {
+            auto &vec = isVector(lhs.name) ? lhs : rhs;
+            auto &other = isVector(lhs.name) ? rhs : lhs;
+            if (other.name != vec.name && !isNumeric(other)) {
+                error(binary, "mismatched vector operands " + describe(lhs) + " and " + describe(rhs));
+                return Type();
+            }
+            return vec;
+        }
+        if (!isNumeric(lhs) || !isNumeric(rhs)) return Type();
+        if (lhs.name == "double" || rhs.name == "double") return Type{"double"};
+        if (lhs.name == "float" || rhs.name == "float") return Type{lhs.name == rhs.name ? "float" : "double"};
+        return Type{"int"};
+    }
+
+    Type checkCall(NFunctionCall *call) {
+        auto &name = call->id.name;
+        if (name == "printf" || name == "scanf" || name == "gets") {
+            for (size_t i = 0; i < call->params.size(); i++) {
+                auto target = dynamic_cast<NIdentifier *>(call->params[i]);
+                bool isTarget = name == "gets" || (name == "scanf" && i > 0);
+                if (isTarget && !target) error(call->params[i], "'" + name + "' needs a variable to read into");
+                check(call->params[i]);
+            }
+            return Type{"int"};
+        }
+        if (isTextFunction(name)) return checkTextCall(call);
+        if (isVector(name)) {
+            auto lanes = name.substr(name.find_first_of("0123456789"));
+            if (call->params.size() != 1 && call->params.size() != std::stoul(lanes)) {
+                error(call, "'" + name + "' takes 1 or " + lanes + " values");
+            }
+            for (auto item: call->params) {
+                auto type = check(item);
+                if (type.known() && !isNumeric(type)) error(item, "'" + name + "' takes numbers, not " + describe(type));
+            }
+            return Type{name};
+        }
+        auto found = functions.find(name);
+        if (found == functions.end() && (name == "has" || name == "remove" || name == "size")) {
+            return checkMapBuiltin(call);
+        }
+        if (found == functions.end() && (name == "sort" || name == "stableSort" || name == "partialSort" ||
+                                         name == "binarySearch")) {
+            return checkSortBuiltin(call);
+        }
+        if (found == functions.end() && (name == "sum" || name == "min" || name == "max" || name == "dot" ||
+                                         name == "scan")) {
+            return checkReduceBuiltin(call);
+        }
+        if (found == functions.end() && (name == "popcount" || name == "firstSet")) {
+            if (call->params.size() != 1) {
+                error(call, "'" + name + "' takes 1 argument, " + std::to_string(call->params.size()) + " given");
+            }
+            for (auto item: call->params) {
+                auto type = check(item);
+                if (!dynamic_cast<NIdentifier *>(item) || (type.known() && (type.name != "boolean" || !type.dims))) {
+                    error(item, "'" + name + "' takes a boolean array, not " + describe(type));
+                }
+            }
+            return Type{"int"};
+        }
+        if (found == functions.end() && name == "mapFile") {
+            error(call, "'mapFile' can only initialize an array declaration");
+            for (auto item: call->params) check(item);
+            return Type();
+        }
+        if (found == functions.end()) {
+            error(call, "no such function '" + name + "'");
+            for (auto item: call->params) check(item);
+            return Type();
+        }
+        checkArguments(call, found->second, call->params);
+        return found->second.isAsync ? Type{"task"} : found->second.result;
+    }
+
+    /* strLength, strCompare, strFind, strCopy and readLine, see createTextFunctions */
+    static bool isTextFunction(const std::string &name) {
+        return name == "strLength" || name == "strCompare" || name == "strFind" || name == "strCopy" ||
+               name == "readLine";
+    }
+
+    Type checkTextCall(NFunctionCall *call) {
+        auto &name = call->id.name;
+        size_t arity = name == "strLength" || name == "readLine" ? 1 : 2;
+        if (call->params.size() != arity) {
+            error(call, "'" + name + "' takes " + std::to_string(arity) + " arguments, " +
+                        std::to_string(call->params.size()) + " given");
+        }
+        for (size_t i = 0; i < call->params.size(); i++) {
+            auto param = call->params[i];
+            auto type = check(param);
+            if (i == 0 && (name == "strCopy" || name == "readLine")) {
+                /* it is told the size of the array, a string may point at a literal */
+                if (!dynamic_cast<NIdentifier *>(param) || (type.known() && (type.name != "char" || type.dims != 1))) {
+                    error(param, "'" + name + "' needs a char array to fill");
+                }
+            } else if (!assignable(Type{"string"}, type)) {
+                error(param, "'" + name + "' takes text, not " + describe(type));
+            }
+        }
+        return Type{"int"};
+    }
+
+    /*
+     * sort(a), stableSort(a), partialSort(a, k) and binarySearch(a, x) on an array of numbers, unless
+     * the program defines a function of that name. A last extra argument limits them to the first
+     * that many elements.
+     */
+    Type checkSortBuiltin(NFunctionCall *call) {
+        auto &name = call->id.name;
+        size_t arity = name == "sort" || name == "stableSort" ? 1 : 2;
+        auto result = Type{name == "binarySearch" ? "int" : "void"};
+        if (call->params.size() != arity && call->params.size() != arity + 1) {
+            error(call, "'" + name + "' takes " + std::to_string(arity) + " or " + std::to_string(arity + 1) +
+                        " arguments, " + std::to_string(call->params.size()) + " given");
+            for (auto item: call->params) check(item);
+            return result;
+        }
+        auto array = check(call->params[0]);
+        auto element = Type{array.name};
+        if (!dynamic_cast<NIdentifier *>(call->params[0]) ||
+            (array.known() && (array.dims != 1 || !isNumeric(element) || element.name == "boolean"))) {
+            error(call->params[0], "'" + name + "' takes an array of numbers, not " + describe(array));
+            element = Type();
+        }
+        if (arity == 2) {
+            auto type = check(call->params[1]);
+            if (name == "binarySearch" ? !assignable(element, type) : type.known() && !isNumeric(type)) {
+                error(call->params[1], "'" + name + "' takes " + (name == "binarySearch" ? describe(element) : "a count") +
+                                       ", not " + describe(type));
+            }
+        }
+        if (call->params.size() > arity) {
+            auto type = check(call->params[arity]);
+            if (type.known() && !isNumeric(type)) {
+                error(call->params[arity], "'" + name + "' takes a count, not " + describe(type));
+            }
+        }
+        return result;
+    }
+
+    /*
+     * sum(a), min(a), max(a), dot(a, b) and scan(a) over the elements of an array of numbers, unless
+     * the program defines a function of that name. Two extra arguments `from, to` limit them to the
+     * elements in [from, to). Sums of chars are ints, scan turns a into its prefix sums in place.
+     */
+    Type checkReduceBuiltin(NFunctionCall *call) {
+        auto &name = call->id.name;
+        size_t arity = name == "dot" ? 2 : 1;
+        if (call->params.size() != arity && call->params.size() != arity + 2) {
+            error(call, "'" + name + "' takes " + std::to_string(arity) + " or " + std::to_string(arity + 2) +
+                        " arguments, " + std::to_string(call->params.size()) + " given");
+            for (auto item: call->params) check(item);
+            return Type();
+        }
+        Type array;
+        for (size_t i = 0; i < arity; i++) {
+            auto type = check(call->params[i]);
+            auto element = Type{type.name};
+            if (!dynamic_cast<NIdentifier *>(call->params[i]) ||
+                (type.known() && (!type.dims || !isNumeric(element) || element.name == "boolean"))) {
+                error(call->params[i], "'" + name + "' takes an array of numbers, not " + describe(type));
+            } else if (i == 0) {
+                array = type;
+            } else if (array.known() && type.known() && type.name != array.name) {
+                error(call->params[i], "'dot' takes two arrays of the same type, not " + describe(array) + " and " +
+                                       describe(type));
+            }
+        }
+        for (size_t i = arity; i < call->params.size(); i++) {
+            auto type = check(call->params[i]);
+            if (type.known() && !isNumeric(type)) {
+                error(call->params[i], "'" + name + "' takes an index, not " + describe(type));
+            }
+        }
+        if (name == "scan") return Type{"void"};
+        if (!array.known()) return Type();
+        if (array.name == "char" && (name == "sum" || name == "dot")) return Type{"int"};
+        return Type{array.name};
+    }
+
+    /*
+     * `[N][M]T a = mapFile(path)`, or mapFile(path, copyOnWrite): the array is the file, see
+     * runtime/mapped.h. Its shape must be fully known, it is what the file's size is checked against.
+     */
+    void checkMapFile(NVariableDeclaration *decl, NFunctionCall *call) {
+        auto arrDim = decl->type.getArrayDim();
+        bool fixed = arrDim != nullptr;
+        for (size_t k = 0; fixed && k < arrDim->size(); k++) fixed = std::strtol((*arrDim)[k]->c_str(), nullptr, 10) > 0;
+        if (!fixed || !isNumeric(Type{decl->type.name})) {
+            error(decl, "'mapFile' needs an array of numbers with every dimension given, not " +
+                        describe(typeOf(decl->type)));
+        }
+        if (call->params.size() != 1 && call->params.size() != 2) {
+            error(call, "'mapFile' takes 1 or 2 arguments, " + std::to_string(call->params.size()) + " given");
+            for (auto item: call->params) check(item);
+            return;
+        }
+        auto path = check(call->params[0]);
+        if (!assignable(Type{"string"}, path)) error(call->params[0], "'mapFile' takes a path, not " + describe(path));
+        if (call->params.size() == 2) {
+            auto copyOnWrite = check(call->params[1]);
+            if (copyOnWrite.known() && (copyOnWrite.name != "boolean" || copyOnWrite.dims)) {
+                error(call->params[1], "'mapFile' takes a boolean, not " + describe(copyOnWrite));
+            }
+        }
+    }
+
+    /* has(m, key), remove(m, key) and size(m), unless the program defines a function of that name */
+    Type checkMapBuiltin(NFunctionCall *call) {
+        auto &name = call->id.name;
+        size_t arity = name == "size" ? 1 : 2;
+        if (call->params.size() != arity) {
+            error(call, "'" + name + "' takes " + std::to_string(arity) + " arguments, " +
+                        std::to_string(call->params.size()) + " given");
+            for (auto item: call->params) check(item);
+            return Type();
+        }
+        auto map = check(call->params[0]);
+        std::string key;
+        if (map.known() && (map.dims || !isMap(map.name, &key))) {
+            error(call->params[0], "'" + name + "' takes a map, not " + describe(map));
+            key.clear();
+        }
+        if (arity == 2) {
+            auto type = check(call->params[1]);
+            if (!key.empty() && !assignable(Type{key}, type)) {
+                error(call->params[1], "key of '" + name + "' must be " + key + ", not " + describe(type));
+            }
+        }
+        return Type{name == "size" ? "int" : "boolean"};
+    }
+
+    /* awaiting a call gives its result, awaiting a task variable only waits for it */
+    Type checkAwait(NAwait *await) {
+        auto call = dynamic_cast<NFunctionCall *>(await->expression);
+        if (call && (call->id.name == "scanf" || call->id.name == "gets")) return checkCall(call);
+        auto found = call ? functions.find(call->id.name) : functions.end();
+        if (found != functions.end() && found->second.isAsync) {
+            checkCall(call);
+            return found->second.result;
+        }
+        auto type = check(await->expression);
+        if (!type.known()) return type;
+        if (type.name != "task" || type.dims) {
+            error(await, "only async calls, tasks, scanf and gets can be awaited, not " + describe(type));
+            return Type();
+        }
+        return Type{"void"};
+    }
+
+    Type indexed(Node *node, const std::string &name, ExpressionList &indices) {
+        auto map = lookup(name);
+        std::string key, value;
+        if (map && !map->dims && isMap(map->name, &key, &value)) {
+            /* m[key]: a missing key reads as 0 */
+            if (indices.size() != 1) error(node, "map '" + name + "' takes one key");
+            for (auto item: indices) {
+                auto type = check(item);
+                if (!assignable(Type{key}, type)) {
+                    error(item, "key of '" + name + "' must be " + key + ", not " + describe(type));
+                }
+            }
+            return Type{value};
+        }
+        for (auto item: indices) {
+            auto type = check(item);
+            if (type.known() && !isNumeric(type)) error(item, "index of '" + name + "' must be a number");
+        }
+        auto type = variable(node, name);
+        if (!type.known()) return type;
+        if (type.dims) return Type{type.name};
+        if (type.name == "string") return Type{"char"};
+        if (isVector(type.name) && indices.size() == 1) return Type{type.name.substr(0, type.name.find_first_of("0123456789"))};
+        error(node, "'" + name + "' of type " + describe(type) + " cannot be indexed");
+        return Type();
+    }
+
+    /* the class of `name` or `name[indices]`, unknown after reporting why it is not an object */
+    Type objectType(Node *node, const std::string &name, ExpressionList *indices) {
+        auto type = indices ? indexed(node, name, *indices) : variable(node, name);
+        if (!type.known()) return type;
+        if (type.dims || !classes.count(type.name)) {
+            error(node, "'" + name + "' of type " + describe(type) + " is not an object");
+            return Type();
+        }
+        return type;
+    }
+
+    Type member(Node *node, const std::string &object, const std::string &field, ExpressionList *indices) {
+        auto type = objectType(node, object, indices);
+        if (!type.known()) return type;
+        auto &fields = classes[type.name].fields;
+        auto found = fields.find(field);
+        if (found != fields.end()) return found->second;
+        error(node, "no field '" + field + "' in class " + type.name);
+        return Type();
+    }
+
+    void visitBlock(NBlock *block, bool &returns) {
+        if (!block) return;
+        blocks.emplace_back();
+        for (auto statement: block->statements) {
+            if (diagnostics.exhausted()) break;
+            visit(statement, returns);
+        }
+        blocks.pop_back();
+    }
+
+    void visit(Node *node) {
+        bool returns = false;
+        visit(node, returns);
+    }
+
+    /* returns: set once a `return <value>` is met */
+    void visit(Node *node, bool &returns) {
+        if (!node) return;
+        if (auto block = dynamic_cast<NBlock *>(node)) {
+            visitBlock(block, returns);
+        } else if (auto statement = dynamic_cast<NExpressionStatement *>(node)) {
+            check(statement->expression);
+        } else if (auto ret = dynamic_cast<NReturnStatement *>(node)) {
+            auto type = check(ret->expression);
+            if (ret->expression) returns = true;
+            if (enclosing.empty()) return;
+            auto &function = enclosing.back();
+            if (function.result.name == "void" && ret->expression) {
+                error(ret, "void function '" + function.name + "' cannot return a value");
+            } else if (function.result.name != "void" && !ret->expression) {
+                error(ret, "function '" + function.name + "' needs a return value");
+            } else if (ret->expression) {
+                expect(ret, function.result, type, "the result of '" + function.name + "'");
+            }
+        } else if (auto decl = dynamic_cast<NVariableDeclaration *>(node)) {
+            declare(decl);
+            auto call = dynamic_cast<NFunctionCall *>(decl->assignmentExpr);
+            if (call && call->id.name == "mapFile" && !functions.count("mapFile")) {
+                checkMapFile(decl, call);
+            } else if (decl->assignmentExpr) {
+                expect(decl, typeOf(decl->type), check(decl->assignmentExpr), "'" + decl->id.name + "'");
+            }
+        } else if (auto function = dynamic_cast<NFunctionDeclaration *>(node)) {
+            auto &name = function->id.name;
+            if (functions.count(name) || name == "printf" || name == "scanf" || name == "gets" || isTextFunction(name)) {
+                error(function, "redeclared function '" + name + "'");
+            }
+            /* registered before the body so recursive calls resolve */
+            functions[name] = signatureOf(function, name);
+            visitFunction(function, functions[name], "");
+        } else if (auto cls = dynamic_cast<NClassDeclaration *>(node)) {
+            visitClass(cls);
+        } else if (auto ifStmt = dynamic_cast<NIfStatement *>(node)) {
+            check(ifStmt->condition);
+            visitBlock(ifStmt->thenBlock, returns);
+            visitBlock(ifStmt->elseBlock, returns);
+        } else if (auto forStmt = dynamic_cast<NForStatement *>(node)) {
+            visit(forStmt->init, returns);
+            check(forStmt->condition);
+            loops++;
+            visitBlock(forStmt->block, returns);
+            loops--;
+            visit(forStmt->inc, returns);
+        } else if (auto whileStmt = dynamic_cast<NWhileStatement *>(node)) {
+            check(whileStmt->condition);
+            loops++;
+            visitBlock(whileStmt->block, returns);
+            loops--;
+        } else if (auto doWhile = dynamic_cast<NDoWhileStatement *>(node)) {
+            loops++;
+            visitBlock(doWhile->block, returns);
+            loops--;
+            check(doWhile->condition);
+        } else if (auto switchStmt = dynamic_cast<NSwitchStatement *>(node)) {
+            auto type = check(switchStmt->condition);
+            if (type.known() && (!isNumeric(type) || type.name == "double" || type.name == "float")) {
+                error(switchStmt, "switch on non-integer value of type " + describe(type));
+            }
+            /* labels compare at the width of the condition, as SwitchInst does */
+            auto narrow = [&type](int64_t value) -> int64_t {
+                if (type.name == "char") return (int8_t) value;
+                if (type.name == "boolean") return value & 1;
+                return (int32_t) value;
+            };
+            std::set<int64_t> labels;
+            bool hasDefault = false;
+            switches++;
+            for (auto item: switchStmt->cases) {
+                int64_t value;
+                if (!item->value) {
+                    if (hasDefault) error(item->block, "multiple default labels in switch");
+                    hasDefault = true;
+                } else if (!check(item->value).known()) {
+                    /* of unknown type, left to code generation */
+                } else if (!constantValue(item->value, value)) {
+                    error(item->value, "case label is not an integer constant");
+                } else if (!labels.insert(narrow(value)).second) {
+                    error(item->value, "duplicate case label " + std::to_string(narrow(value)));
+                }
+                visitBlock(item->block, returns);
+            }
+            switches--;
+        } else if (dynamic_cast<NBreakStatement *>(node)) {
+            if (!loops && !switches) error(node, "break outside a loop or switch");
+        } else if (dynamic_cast<NContinueStatement *>(node)) {
+            if (!loops) error(node, "continue outside a loop");
+        } else if (auto expression = dynamic_cast<NExpression *>(node)) {
+            check(expression);
+        }
+    }
+
+    void visitClass(NClassDeclaration *cls) {
+        auto &name = cls->id->name;
+        if (classes.count(name)) {
+            error(cls, "redeclared class '" + name + "'");
+            return;
+        }
+        /* registered before the fields so they may refer to the class itself */
+        auto &shape = classes[name];
+        for (auto field: cls->fields) {
+            if (field->type.getArrayDim() || !isTypeName(field->type.name)) {
+                error(field, "unsupported type of field " + name + "." + field->id.name);
+            } else if (shape.fields.count(field->id.name)) {
+                error(field, "redeclared field " + name + "." + field->id.name);
+            } else if (cls->structOfArrays && !isNumeric(typeOf(field->type)) && !isVector(field->type.name)) {
+                /* arrays of objects are not traced by the collector */
+                error(field, "soa class " + name + " cannot have the reference field " + field->id.name);
+            }
+            shape.fields[field->id.name] = typeOf(field->type);
+            if (field->assignmentExpr) check(field->assignmentExpr);
+        }
+        /* methods may call each other whatever their order */
+        for (auto method: cls->methods) {
+            shape.methods[method->id.name] = signatureOf(method, name + "." + method->id.name);
+        }
+        for (auto method: cls->methods) {
+            auto signature = shape.methods[method->id.name];
+            visitFunction(method, signature, name);
+        }
+    }
+};
+
+#endif //PHEMIA_CHECK_HPP
@@ -1,6 +1,9 @@
 #ifndef PHEMIA_CODEGEN_HPP
 #define PHEMIA_CODEGEN_HPP
 
+#include <algorithm>
+#include <functional>
+#include <set>
 #include <stack>
 #include <string>
 #include <typeinfo>
@@ -14,16 +17,31 @@
 #include <llvm/IR/CallingConv.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Transforms/Coroutines.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Scalar.h>
 #include <regex>
 
+#include "check.hpp"
+#include "constEval.hpp"
+#include "diagnostics.hpp"
+#include "engine.hpp"
+#include "escape.hpp"
+#include "format.hpp"
+#include "loopNest.hpp"
 #include "node.h"
 #include "parser.hpp"
+#include "stream.hpp"
+#include "target.hpp"
 #include "util.hpp"
 
 #define PRINT(s) std::cout << "\n-------\n";s->print(llvm::outs());std::cout << "\n-------\n";
@@ -35,6 +53,17 @@ public:
     llvm::Value *value;
     llvm::Type *dType;
     std::vector<uint32_t> *size;
+    /* runtime extents of dimensions declared as `[]`, nullptr where size holds the constant */
+    std::vector<llvm::Value *> dims;
+    /* scalars live in SSA registers and are read/written through ARStack::readVariable/writeVariable */
+    bool isSSA = false;
+    /*
+     * shadow stack slot keeping an array/string value visible to the collector; a module global for
+     * top-level arrays and strings that functions refer to, which read it rather than value
+     */
+    llvm::Value *root = nullptr;
+    /* no other variable refers to this array's storage, see EscapeAnalysis::isUnaliased */
+    bool unaliased = false;
 
     VariableRecord(llvm::Value *value, llvm::Type *dType, std::vector<uint32_t> *size) :
             value(value), dType(dType), size(size) {}
@@ -51,12 +80,44 @@ public:
             cond(cond), inc(inc), loop(loop), after(after) {}
 };
 
+/* the async function being emitted: an LLVM coroutine in the switched-resume form */
+class TaskInfo {
+public:
+    llvm::Value *id = nullptr;
+    /* the coroutine's own handle, what an `await` inside it leaves behind to be woken */
+    llvm::Value *handle = nullptr;
+    /* { waiting task, result }: the waiter is resumed once the result is stored */
+    llvm::AllocaInst *promise = nullptr;
+    llvm::StructType *promiseType = nullptr;
+    /* `return` goes to final, the last suspend; suspend leaves the coroutine, cleanup frees it */
+    llvm::BasicBlock *final = nullptr;
+    llvm::BasicBlock *cleanup = nullptr;
+    llvm::BasicBlock *suspend = nullptr;
+};
+
+class ClassInfo {
+public:
+    std::string name;
+    llvm::StructType *type;
+    NClassDeclaration *decl;
+    /* field name -> element index in type */
+    std::map<std::string, unsigned> fields;
+    /* number of leading reference fields, traced by the collector */
+    unsigned refs = 0;
+    /* arrays of it store one column per field instead of whole objects, see ARStack::columnPointers */
+    bool structOfArrays = false;
+
+    ClassInfo(std::string name, llvm::StructType *type, NClassDeclaration *decl) :
+            name(std::move(name)), type(type), decl(decl) {}
+};
+
 class ActiveRecord {
 public:
     llvm::BasicBlock *block = nullptr;
     llvm::Value *retVal = nullptr;
     std::map<std::string, VariableRecord *> localVal;
     LoopInfo *info = nullptr;
+    std::vector<llvm::Value *> gcRoots;
 
     explicit ActiveRecord(llvm::BasicBlock *block, llvm::Value *retVal = nullptr, LoopInfo *info = nullptr) : block(
             block), retVal(retVal), info(info) {}
@@ -74,10 +135,70 @@ public:
     llvm::BasicBlock *curCond = nullptr;
     int inLoop = 0;
 
+    /* on-the-fly SSA construction, see Braun et al. "Simple and Efficient Construction of SSA Form" */
+    std::map<llvm::BasicBlock *, std::map<VariableRecord *, llvm::WeakTrackingVH>> currentDef;
+    std::map<llvm::BasicBlock *, std::map<VariableRecord *, llvm::PHINode *>> incompletePhis;
+    std::set<llvm::BasicBlock *> sealedBlocks;
+    std::set<llvm::PHINode *> pendingPhis;
+
+    /* functions with runtime array dimensions with the scope depth they were declared at, and their per-shape clones */
+    std::map<std::string, std::pair<NFunctionDeclaration *, size_t>> genericFunctions;
+    std::map<std::string, llvm::Function *> specializations;
+
+    std::map<std::string, ClassInfo *> classes;
+
+    SemanticCheck semantics;
+    EscapeAnalysis escapes;
+    /* read-only string literals, one global per distinct text */
+    std::map<std::string, llvm::GlobalVariable *> constantStrings;
+    /* larger non-escaping arrays still go to the heap rather than risk deep recursion overflowing */
+    static const uint64_t maxStackArrayBytes = 512;
+    CacheModel cache;
+
+    ConstEvaluator constEval;
+    /* functions whose calls with constant arguments are folded, see ConstEvaluator */
+    std::set<llvm::Function *> pureFunctions;
+
+    TaskInfo *task = nullptr;
+    /* promise layout of each async function, for awaits reading the result */
+    std::map<llvm::Function *, llvm::StructType *> promises;
+    /* the module needs the coroutine passes and main drains the event loop, see finishMain */
+    bool usesTasks = false;
+
+    const std::regex vectorTypeName{"(int|float|double|char)([0-9]+)"};
+    const std::regex mapTypeName{"map\\[(int|string)\\](int|char|double|float|boolean)"};
+    /* opaque runtime/map.h maps, a struct per spelling so mapTypeOf can read key and value back */
+    std::map<std::string, llvm::StructType *> mapTypes;
+
+    /* --march and --multiversion, recorded in the module by finishMain */
+    TargetChoice target;
+    /* --reassociate: float and double reductions may add in any order, see runtime/reduce.h */
+    bool reassociate = false;
+
+    /* --heap-profile: where the program writes its heap profile, empty when it is not profiled */
+    std::string heapProfile;
+    /* the program's source file, named in the profile */
+    std::string sourceFile;
+    /* source line of the statement being lowered */
+    int line = 0;
+    /* function and line of each allocation site, see runtime/profile.h; site 0 stands for unknown */
+    std::vector<std::pair<std::string, int>> allocationSites{{"<unknown>", 0}};
+    std::map<std::pair<std::string, int>, int32_t> siteIds;
+
     ARStack() : builder(llvmContext) { module = new llvm::Module("main", llvmContext); }
 
     void generateCode(NBlock &root, const std::string &file);
 
+    /* lower statements as the parser produces them, freeing each one once it is done */
+    void generateCode(StatementStream &stream, const std::string &file);
+
+    void beginMain();
+
+    void finishMain(const std::string &file);
+
+    /* main's first act under --heap-profile: hand the runtime the allocation sites */
+    void startHeapProfile();
+
     llvm::GenericValue runCode();
 
     std::map<std::string, VariableRecord *> &locals() { return arStack.back()->localVal; }
@@ -93,6 +214,23 @@ public:
 
     auto *current() { return arStack.back(); }
 
+    /* the clone of generic function `name` for constant shapes, lowered in the scopes its declaration saw */
+    llvm::Function *specialize(const std::string &name, const std::string &key,
+                               const std::vector<std::vector<uint32_t> *> &shapes) {
+        auto generic = genericFunctions[name];
+        auto callerScopes = arStack;
+        arStack.resize(generic.second);
+        auto function = generic.first->emit(*this, key, &shapes);
+        arStack = callerScopes;
+        return function;
+    }
+
+    /* statements of main itself, not of a function or method body */
+    bool atTopLevel() const { return arStack.size() == 1; }
+
+    /* scopes open at this point, main's included */
+    size_t scopeDepth() const { return arStack.size(); }
+
     LoopInfo *currentLoop() {
         for (auto it = arStack.rbegin(); it != arStack.rend(); it++) {
             if ((**it).info) {
@@ -135,20 +273,1191 @@ public:
         } else if (type == "string") {
             return llvm::PointerType::getInt8PtrTy(llvmContext);
 //            return llvm::ArrayType::get(typeOf("char"), 0);
+        } else if (type == "task") {
+            /* coroutine handle of a started async function */
+            return llvm::PointerType::getInt8PtrTy(llvmContext);
+        } else if (classes.find(type) != classes.end()) {
+            return classes[type]->type->getPointerTo();
+        } else if (std::regex_match(type, result, vectorTypeName)) {
+            /* float4, int8, double2 ...: fixed width SIMD values */
+            auto lanes = std::stoul(result[2]);
+            if (lanes < 2 || lanes > 64 || (lanes & (lanes - 1))) return llvm::Type::getVoidTy(llvmContext);
+            return llvm::FixedVectorType::get(typeOf(result[1]), lanes);
+        } else if (std::regex_match(type, mapTypeName)) {
+            auto &mapType = mapTypes[type];
+            if (!mapType) mapType = llvm::StructType::create(llvmContext, type);
+            return mapType->getPointerTo();
         } else return llvm::Type::getVoidTy(llvmContext);
     }
 
+    /* whether type is a map, and if so whether it is keyed by strings and what its values are */
+    bool mapTypeOf(llvm::Type *type, bool &stringKeys, llvm::Type *&valueType) {
+        auto mapType = type->isPointerTy() ? llvm::dyn_cast<llvm::StructType>(type->getPointerElementType()) : nullptr;
+        if (!mapType || !mapType->hasName()) return false;
+        std::smatch result;
+        auto name = mapType->getName().str();
+        if (!std::regex_match(name, result, mapTypeName)) return false;
+        stringKeys = result[1] == "string";
+        valueType = typeOf(result[2]);
+        return true;
+    }
+
+    /* phemia_map_<operation>_int or _str of runtime/map.h on map and key */
+    llvm::Value *mapCall(const std::string &operation, llvm::Type *result, llvm::Value *map, NExpression *key,
+                         bool stringKeys);
+
+    /* has(m, key), remove(m, key) and size(m) when no function of that name is defined */
+    llvm::Value *mapBuiltin(NFunctionCall &call);
+
+    /* sort, stableSort, partialSort and binarySearch on arrays of numbers, see runtime/sort.h */
+    llvm::Value *sortBuiltin(NFunctionCall &call);
+
+    /* sum, min, max, dot and scan on arrays of numbers, see runtime/reduce.h */
+    llvm::Value *reduceBuiltin(NFunctionCall &call);
+
+    /* the file `[N]...T a = mapFile(path[, copyOnWrite])` binds a to, see runtime/mapped.h */
+    llvm::Value *mappedArray(NFunctionCall &call, llvm::ArrayType *arrType);
+
+    /* arrays of objects store the objects themselves, not references to them */
+    llvm::Type *elementTypeOf(const std::string &type) {
+        auto cls = classes.find(type);
+        return cls != classes.end() ? cls->second->type : typeOf(type);
+    }
+
+    ClassInfo *classOf(llvm::Type *type) {
+        for (auto &cls: classes) {
+            if (cls.second->type == type) return cls.second;
+        }
+        return nullptr;
+    }
+
+    llvm::Value *objectPointer(NIdentifier &object, ExpressionList *indices, ClassInfo *&cls);
+
+    llvm::Value *fieldPointer(llvm::Value *object, ClassInfo *cls, const std::string &field);
+
+    /* where object.field, or object[indices].field, lives */
+    llvm::Value *memberPointer(NIdentifier &object, ExpressionList *indices, const std::string &field,
+                               ClassInfo *&cls);
+
+    /* the array of a soa class that object[indices] indexes, nullptr for anything else */
+    ClassInfo *columnClass(const NIdentifier &object, ExpressionList *indices) {
+        auto arr = indices ? get(object.name) : nullptr;
+        auto cls = arr && arr->size ? classOf(arr->dType) : nullptr;
+        return cls && cls->structOfArrays ? cls : nullptr;
+    }
+
+    /* the address of field `index` of element `element` of an array of a soa class */
+    llvm::Value *columnPointer(VariableRecord *arr, ClassInfo *cls, llvm::Value *element, unsigned index);
+
+    /* objects are only 8-byte aligned (runtime/gc.h), so wider fields such as a float4 are accessed unaligned */
+    llvm::MaybeAlign fieldAlign(ClassInfo *cls, unsigned index) {
+        auto type = cls->type->getElementType(index);
+        return llvm::MaybeAlign(std::min<uint64_t>(module->getDataLayout().getABITypeAlignment(type), 8));
+    }
+
     llvm::Value *castToBoolean(llvm::Value *value) {
-        if (value->getType()->isIntegerTy()) {
+        if (value->getType()->isIntegerTy(1)) {
+            return value;
+        } else if (value->getType()->isIntegerTy()) {
             return builder.CreateICmpNE(value, builder.CreateIntCast(
                     builder.getInt1(false), value->getType(), false));
         } else if (value->getType()->isFloatTy() || value->getType()->isDoubleTy()) {
             return builder.CreateFCmpONE(value, llvm::ConstantFP::get(llvmContext, llvm::APFloat(0.0)));
         } else return builder.getInt1(true);
     }
+
+    llvm::Value *castTo(llvm::Value *value, llvm::Type *type) {
+        auto from = value->getType();
+        if (from == type) {
+            return value;
+        } else if (type->isIntegerTy(1)) {
+            return castToBoolean(value);
+        } else if (from->isIntegerTy() && type->isIntegerTy()) {
+            return builder.CreateIntCast(value, type, true);
+        } else if (from->isIntegerTy() && type->isFloatingPointTy()) {
+            return builder.CreateSIToFP(value, type);
+        } else if (from->isFloatingPointTy() && type->isIntegerTy()) {
+            return builder.CreateFPToSI(value, type);
+        } else if (from->isFloatingPointTy() && type->isFloatingPointTy()) {
+            return builder.CreateFPCast(value, type);
+        } else return value;
+    }
+
+    llvm::Value *arrayDim(VariableRecord *arr, size_t k) {
+        if (k < arr->dims.size() && arr->dims[k]) return arr->dims[k];
+        return builder.getInt32((*arr->size)[k]);
+    }
+
+    llvm::Value *elementCount(VariableRecord *arr) {
+        llvm::Value *count = arrayDim(arr, 0);
+        for (size_t k = 1; k < arr->size->size(); k++) {
+            count = builder.CreateNSWMul(count, arrayDim(arr, k), "count");
+        }
+        return count;
+    }
+
+    /* the array variable an operand names, if its elements are plain numbers */
+    VariableRecord *arrayOperand(NExpression *operand) {
+        auto id = dynamic_cast<NIdentifier *>(operand);
+        auto var = id ? get(id->name) : nullptr;
+        if (!var || var->isSSA || !var->size || var->dType->isPointerTy() || var->dType->isStructTy()) return nullptr;
+        return var;
+    }
+
+    /*
+     * boolean arrays are bit sets: 64 elements to an i64 word, element i in bit i % 64 of word i / 64,
+     * bits past the last element zero. Their variables point at the words.
+     */
+    static bool isBitArray(VariableRecord *arr) {
+        return arr->size && !arr->isSSA && arr->dType->isIntegerTy(1);
+    }
+
+    /* what arrays of elemType are stored as */
+    llvm::Type *storageTypeOf(llvm::Type *elemType) {
+        return elemType->isIntegerTy(1) ? builder.getInt64Ty() : elemType;
+    }
+
+    llvm::ArrayType *storageArrayOf(llvm::Type *elemType, uint64_t count) {
+        if (elemType->isIntegerTy(1)) return llvm::ArrayType::get(builder.getInt64Ty(), (count + 63) / 64);
+        return llvm::ArrayType::get(elemType, count);
+    }
+
+    /* words holding count bits */
+    llvm::Value *bitWords(llvm::Value *count) {
+        return builder.CreateLShr(builder.CreateAdd(count, builder.getInt32(63)), 6, "words");
+    }
+
+    /* the word of a bit array holding element idx, and the element's bit in it */
+    llvm::Value *bitAddress(VariableRecord *arr, llvm::Value *idx, llvm::Value *&mask) {
+        auto bit = builder.CreateZExt(builder.CreateAnd(idx, builder.getInt32(63)), builder.getInt64Ty());
+        mask = builder.CreateShl(builder.getInt64(1), bit, "mask");
+        auto word = builder.CreateZExt(builder.CreateLShr(idx, 6), builder.getInt64Ty());
+        return builder.CreateInBoundsGEP(builder.getInt64Ty(), arrayPointer(arr), word, "wordPtr");
+    }
+
+    /* popcount(a) and firstSet(a) on a boolean array when no function of that name is defined */
+    llvm::Value *bitsBuiltin(NFunctionCall &call);
+
+    llvm::Value *binaryOp(int op, llvm::Value *L, llvm::Value *R, bool isFP);
+
+    llvm::Value *elementwise(int op, VariableRecord *lhs, VariableRecord *rhs, NExpression *lhsExpr,
+                             NExpression *rhsExpr);
+
+    /* reordered and tiled code for a nest of counted loops over arrays, false to emit it as written */
+    bool emitLoopNest(NForStatement &loop);
+
+    /* row-major linear index of arr[i0][i1]... */
+    llvm::Value *elementIndex(VariableRecord *arr, ExpressionList &indices) {
+        auto intType = typeOf("int");
+        llvm::Value *idx = castTo(indices[0]->codeGen(*this), intType);
+        for (size_t k = 1; k < indices.size(); k++) {
+            idx = builder.CreateNSWMul(idx, arrayDim(arr, k), "stride");
+            idx = builder.CreateNSWAdd(idx, castTo(indices[k]->codeGen(*this), intType), "idx");
+        }
+        return idx;
+    }
+
+    /* stack slot in the entry block, for values whose address escapes (e.g. scanf targets) */
+    llvm::AllocaInst *createEntryAlloca(llvm::Type *type, const std::string &name) {
+        auto &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+        llvm::IRBuilder<> tmp(&entry, entry.begin());
+        return tmp.CreateAlloca(type, nullptr, name);
+    }
+
+    /* under --heap-profile, tell the runtime the site of the allocations the next call makes */
+    void allocationSite() {
+        if (heapProfile.empty()) return;
+        std::pair<std::string, int> site{builder.GetInsertBlock()->getParent()->getName().str(), line};
+        auto found = siteIds.emplace(site, (int32_t) allocationSites.size());
+        if (found.second) allocationSites.push_back(site);
+        auto current = module->getOrInsertGlobal("phemia_profile_site", builder.getInt32Ty());
+        builder.CreateStore(builder.getInt32(found.first->second), current);
+    }
+
+    /* zeroed storage from the runtime heap, see runtime/gc.c; refs leading pointers are traced */
+    llvm::Value *gcAlloc(llvm::Type *type, unsigned refs = 0) {
+        return gcAlloc(llvm::ConstantExpr::getSizeOf(type), refs);
+    }
+
+    llvm::Value *gcAlloc(llvm::Value *size, unsigned refs = 0) {
+        allocationSite();
+        if (!refs) {
+            auto fType = llvm::FunctionType::get(builder.getInt8PtrTy(), {builder.getInt64Ty()}, false);
+            auto alloc = module->getOrInsertFunction("phemia_gc_alloc", fType);
+            return builder.CreateCall(alloc, {size}, "heap");
+        }
+        auto fType = llvm::FunctionType::get(builder.getInt8PtrTy(), {builder.getInt64Ty(), builder.getInt64Ty()},
+                                             false);
+        auto alloc = module->getOrInsertFunction("phemia_gc_alloc_object", fType);
+        return builder.CreateCall(alloc, {size, builder.getInt64(refs)}, "heap");
+    }
+
+    /* shared read-only copy of text */
+    llvm::Value *constantString(const std::string &text) {
+        auto &global = constantStrings[text];
+        if (!global) global = builder.CreateGlobalString(text, ".str");
+        return builder.CreateBitCast(global, builder.getInt8PtrTy());
+    }
+
+    /* printf/scanf with a literal format as direct calls into runtime/io.h, nullptr to leave it to libc */
+    llvm::Value *emitFormattedIO(const std::string &function, NExpression *format,
+                                 const std::vector<llvm::Value *> &args);
+
+    void addRoot(VariableRecord *var) {
+        if (var->root) return;
+        var->root = createEntryAlloca(builder.getInt8PtrTy(), "root");
+        current()->gcRoots.push_back(var->root);
+    }
+
+    /* main's frame lives as long as the program, so a global slot listed in it is a root throughout */
+    void addGlobalRoot(VariableRecord *var, const std::string &name) {
+        var->root = createGlobal(builder.getInt8PtrTy(), name);
+        current()->gcRoots.push_back(var->root);
+    }
+
+    /*
+     * arrays and strings are rebound like SSA scalars, so a rebind under an `if` or in a loop reaches
+     * the reads after it through phis; value keeps the first binding, whose type the others are cast to
+     */
+    void bindArray(VariableRecord *var, llvm::Value *value) {
+        if (var->value) value = builder.CreatePointerCast(value, var->value->getType());
+        else var->value = value;
+        writeVariable(var, builder.GetInsertBlock(), value);
+        addRoot(var);
+        builder.CreateStore(builder.CreatePointerCast(value, builder.getInt8PtrTy()), var->root);
+    }
+
+    /* the storage an array or string variable is bound to, nullptr before it is bound */
+    llvm::Value *arrayPointer(VariableRecord *var) {
+        if (!var->value) return nullptr;
+        if (!llvm::isa_and_nonnull<llvm::GlobalVariable>(var->root)) return readVariable(var, builder.GetInsertBlock());
+        return builder.CreatePointerCast(builder.CreateLoad(builder.getInt8PtrTy(), var->root, var->root->getName()),
+                                         var->value->getType());
+    }
+
+    /* SSA write that also refreshes the root slot of object variables */
+    void assignVariable(VariableRecord *var, llvm::Value *value) {
+        writeVariable(var, builder.GetInsertBlock(), value);
+        if (var->root) builder.CreateStore(builder.CreatePointerCast(value, builder.getInt8PtrTy()), var->root);
+    }
+
+    /* zero-initialized module global for a top-level variable functions refer to, see EscapeAnalysis::isShared */
+    llvm::GlobalVariable *createGlobal(llvm::Type *type, const std::string &name) {
+        return new llvm::GlobalVariable(*module, type, false, llvm::GlobalValue::InternalLinkage,
+                                        llvm::Constant::getNullValue(type), name);
+    }
+
+    /* scalar variables: SSA values, or memory when they live in a global */
+    llvm::Value *loadVariable(VariableRecord *var) {
+        if (var->isSSA) return readVariable(var, builder.GetInsertBlock());
+        return builder.CreateLoad(var->dType, var->value, "load");
+    }
+
+    llvm::Value *storeVariable(VariableRecord *var, llvm::Value *value) {
+        value = castTo(value, var->dType);
+        if (var->isSSA) assignVariable(var, value);
+        else builder.CreateStore(value, var->value);
+        return value;
+    }
+
+    void emitGCFrame(llvm::Function *function, const std::vector<llvm::Value *> &roots);
+
+    /* { prev, count, slots } on the stack of function with roots stored into it, returned as i8* */
+    llvm::Value *buildGCFrame(llvm::Function *function, llvm::IRBuilder<> &at,
+                              const std::vector<llvm::Value *> &roots);
+
+    llvm::Function *intrinsic(llvm::Intrinsic::ID id, llvm::ArrayRef<llvm::Type *> types = {}) {
+        return llvm::Intrinsic::getDeclaration(module, id, types);
+    }
+
+    /* coroutine frame and promise of an async function, emitted at the top of its body */
+    void beginTask(llvm::Function *function, llvm::Type *resultType);
+
+    /* the final suspend and the ways out of the coroutine; its roots stay pinned while it is suspended */
+    void finishTask(const std::vector<llvm::Value *> &roots);
+
+    /* suspend the current task, it goes on at resume when woken */
+    void suspendTask(llvm::BasicBlock *resume);
+
+    /* outside a task `await` blocks: run the event loop until isDone() holds, then go on at done */
+    void runLoopUntil(const std::function<llvm::Value *()> &isDone, llvm::BasicBlock *done);
+
+    /* wait for a started task and free it; its result, or nullptr without a promiseType or for void */
+    llvm::Value *awaitTask(llvm::Value *handle, llvm::StructType *promiseType);
+
+    /* a task started without being awaited or kept frees itself once it finishes */
+    void detachTask(llvm::Value *handle);
+
+    /* an awaited scanf/gets handed to the I/O thread, nullptr to make the call right here instead */
+    llvm::Value *awaitIO(llvm::Function *function, NExpression *format, const std::vector<llvm::Value *> &args);
+
+    /* branch on a condition, && and || jump straight to the targets instead of building a value */
+    bool emitCondBr(NExpression *condition, llvm::BasicBlock *whenTrue, llvm::BasicBlock *whenFalse);
+
+    llvm::Value *emitLogical(NBinaryOperator *op);
+
+    /* code after break/continue/return goes to an unreachable block instead of behind a terminator */
+    void startDeadBlock() {
+        auto dead = llvm::BasicBlock::Create(llvmContext, "dead", builder.GetInsertBlock()->getParent());
+        builder.SetInsertPoint(dead);
+        sealBlock(dead);
+    }
+
+    void writeVariable(VariableRecord *var, llvm::BasicBlock *block, llvm::Value *value) {
+        currentDef[block][var] = value;
+    }
+
+    llvm::Value *readVariable(VariableRecord *var, llvm::BasicBlock *block) {
+        auto defs = currentDef.find(block);
+        if (defs != currentDef.end()) {
+            auto def = defs->second.find(var);
+            if (def != defs->second.end() && def->second) {
+                return def->second;
+            }
+        }
+        return readVariableRecursive(var, block);
+    }
+
+    void sealBlock(llvm::BasicBlock *block);
+
+private:
+    /* the type of the values tracked for var, see bindArray */
+    static llvm::Type *ssaType(VariableRecord *var) { return var->size ? var->value->getType() : var->dType; }
+
+    llvm::PHINode *createPhi(VariableRecord *var, llvm::BasicBlock *block) {
+        auto first = block->getFirstNonPHI();
+        return first ? llvm::PHINode::Create(ssaType(var), 0, "phi", first)
+                     : llvm::PHINode::Create(ssaType(var), 0, "phi", block);
+    }
+
+    llvm::Value *readVariableRecursive(VariableRecord *var, llvm::BasicBlock *block);
+
+    llvm::Value *addPhiOperands(VariableRecord *var, llvm::PHINode *phi);
+
+    llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *phi);
 };
 
+llvm::Value *ARStack::readVariableRecursive(VariableRecord *var, llvm::BasicBlock *block) {
+    llvm::Value *val;
+    if (sealedBlocks.find(block) == sealedBlocks.end()) {
+        /* not all predecessors are known yet, fill in the operands when the block gets sealed */
+        auto phi = createPhi(var, block);
+        incompletePhis[block][var] = phi;
+        val = phi;
+    } else if (llvm::pred_empty(block)) {
+        val = llvm::UndefValue::get(ssaType(var));
+    } else if (auto pred = block->getSinglePredecessor()) {
+        val = readVariable(var, pred);
+    } else {
+        /* break potential cycles with an operandless phi */
+        auto phi = createPhi(var, block);
+        writeVariable(var, block, phi);
+        val = addPhiOperands(var, phi);
+    }
+    writeVariable(var, block, val);
+    return val;
+}
+
+llvm::Value *ARStack::addPhiOperands(VariableRecord *var, llvm::PHINode *phi) {
+    pendingPhis.insert(phi);
+    for (auto pred: llvm::predecessors(phi->getParent())) {
+        phi->addIncoming(readVariable(var, pred), pred);
+    }
+    pendingPhis.erase(phi);
+    return tryRemoveTrivialPhi(phi);
+}
+
+llvm::Value *ARStack::tryRemoveTrivialPhi(llvm::PHINode *phi) {
+    /* operands still being collected, it is checked again once complete */
+    if (pendingPhis.find(phi) != pendingPhis.end()) return phi;
+    llvm::Value *same = nullptr;
+    bool fromUndef = false;
+    for (auto &op: phi->incoming_values()) {
+        if (op == same || op == phi) continue;
+        if (llvm::isa<llvm::UndefValue>(op)) {
+            fromUndef = true;
+            continue;
+        }
+        if (same) return phi;
+        same = op;
+    }
+    /* undef (e.g. from the dead block after a break) may be any value, so a constant stands for it too;
+     * an instruction might not dominate the phi */
+    if (fromUndef && same && !llvm::isa<llvm::Constant>(same)) return phi;
+    if (!same) same = llvm::UndefValue::get(phi->getType());
+
+    std::vector<llvm::WeakVH> users;
+    for (auto user: phi->users()) {
+        if (user != phi && llvm::isa<llvm::PHINode>(user)) users.emplace_back(user);
+    }
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    /* removing this phi may have made its users trivial, `same` itself included */
+    llvm::WeakTrackingVH result(same);
+    for (auto &user: users) {
+        if (auto userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user)) tryRemoveTrivialPhi(userPhi);
+    }
+    return result;
+}
+
+/* push a PhemiaFrame (runtime/gc.h) listing the root slots on entry, pop it before every return */
+void ARStack::emitGCFrame(llvm::Function *function, const std::vector<llvm::Value *> &roots) {
+    if (roots.empty()) return;
+    auto &entry = function->getEntryBlock();
+    auto it = entry.begin();
+    while (llvm::isa<llvm::AllocaInst>(*it)) it++;
+    llvm::IRBuilder<> tmp(&entry, it);
+
+    auto frameArg = buildGCFrame(function, tmp, roots);
+    auto hookType = llvm::FunctionType::get(tmp.getVoidTy(), {tmp.getInt8PtrTy()}, false);
+    tmp.CreateCall(module->getOrInsertFunction("phemia_gc_push", hookType), {frameArg});
+
+    auto pop = module->getOrInsertFunction("phemia_gc_pop", hookType);
+    for (auto &bb: *function) {
+        if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(bb.getTerminator())) {
+            llvm::IRBuilder<>(ret).CreateCall(pop, {frameArg});
+        }
+    }
+}
+
+llvm::Value *ARStack::buildGCFrame(llvm::Function *function, llvm::IRBuilder<> &at,
+                                   const std::vector<llvm::Value *> &roots) {
+    auto &entry = function->getEntryBlock();
+    llvm::IRBuilder<> top(&entry, entry.begin());
+    auto ptrType = at.getInt8PtrTy();
+    auto slotsType = llvm::ArrayType::get(ptrType->getPointerTo(), roots.size());
+    auto frameType = llvm::StructType::get(llvmContext, {ptrType, at.getInt64Ty(), slotsType});
+    auto frame = top.CreateAlloca(frameType, nullptr, "gcFrame");
+    at.CreateStore(at.getInt64(roots.size()), at.CreateStructGEP(frameType, frame, 1));
+    for (size_t i = 0; i < roots.size(); i++) {
+        at.CreateStore(llvm::ConstantPointerNull::get(ptrType), roots[i]);
+        at.CreateStore(roots[i], at.CreateConstInBoundsGEP2_32(
+                slotsType, at.CreateStructGEP(frameType, frame, 2), 0, i));
+    }
+    return at.CreatePointerCast(frame, ptrType);
+}
+
+void ARStack::beginTask(llvm::Function *function, llvm::Type *resultType) {
+    auto ptrType = builder.getInt8PtrTy();
+    auto null = llvm::ConstantPointerNull::get(ptrType);
+    std::vector<llvm::Type *> fields{ptrType};
+    if (!resultType->isVoidTy()) fields.push_back(resultType);
+    task = new TaskInfo();
+    task->promiseType = llvm::StructType::get(llvmContext, fields);
+    promises[function] = task->promiseType;
+    usesTasks = true;
+    /* what CoroSplit looks for, a frontend's job */
+    function->addFnAttr("coroutine.presplit", "0");
+
+    task->promise = createEntryAlloca(task->promiseType, "promise");
+    task->promise->setAlignment(llvm::Align(8));
+    task->id = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_id), {
+            builder.getInt32(8), builder.CreatePointerCast(task->promise, ptrType), null, null}, "id");
+    auto size = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_size, {builder.getInt64Ty()}), {}, "size");
+    auto malloc = module->getOrInsertFunction("malloc", llvm::FunctionType::get(ptrType, {builder.getInt64Ty()},
+                                                                              false));
+    auto memory = builder.CreateCall(malloc, {size}, "frame");
+    task->handle = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_begin), {task->id, memory}, "task");
+    builder.CreateStore(null, builder.CreateStructGEP(task->promiseType, task->promise, 0));
+
+    task->final = llvm::BasicBlock::Create(llvmContext, "final", function);
+    task->cleanup = llvm::BasicBlock::Create(llvmContext, "cleanup", function);
+    task->suspend = llvm::BasicBlock::Create(llvmContext, "suspend", function);
+}
+
+void ARStack::finishTask(const std::vector<llvm::Value *> &roots) {
+    auto function = task->final->getParent();
+    auto ptrType = builder.getInt8PtrTy();
+    auto hookType = llvm::FunctionType::get(builder.getVoidTy(), {ptrType}, false);
+
+    /* the result is in place: wake the task waiting for it, which reads it and destroys this one */
+    builder.SetInsertPoint(task->final);
+    sealBlock(task->final);
+    auto waiter = builder.CreateLoad(ptrType, builder.CreateStructGEP(task->promiseType, task->promise, 0),
+                                     "waiter");
+    auto wake = llvm::BasicBlock::Create(llvmContext, "wake", function);
+    auto done = llvm::BasicBlock::Create(llvmContext, "done", function);
+    builder.CreateCondBr(builder.CreateIsNotNull(waiter), wake, done);
+    builder.SetInsertPoint(wake);
+    sealBlock(wake);
+    builder.CreateCall(module->getOrInsertFunction("phemia_loop_ready", hookType), {waiter});
+    builder.CreateBr(done);
+    builder.SetInsertPoint(done);
+    sealBlock(done);
+    auto state = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_suspend),
+                                    {llvm::ConstantTokenNone::get(llvmContext), builder.getTrue()}, "state");
+    auto resumed = llvm::BasicBlock::Create(llvmContext, "resumedFinal", function);
+    auto branch = builder.CreateSwitch(state, task->suspend, 2);
+    branch->addCase(builder.getInt8(0), resumed);
+    branch->addCase(builder.getInt8(1), task->cleanup);
+    builder.SetInsertPoint(resumed);
+    sealBlock(resumed);
+    builder.CreateUnreachable();
+
+    builder.SetInsertPoint(task->cleanup);
+    sealBlock(task->cleanup);
+    auto memory = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_free), {task->id, task->handle}, "frame");
+    builder.CreateCall(module->getOrInsertFunction("free", hookType), {memory});
+    builder.CreateBr(task->suspend);
+
+    builder.SetInsertPoint(task->suspend);
+    sealBlock(task->suspend);
+    builder.CreateCall(intrinsic(llvm::Intrinsic::coro_end), {task->handle, builder.getFalse()});
+    builder.CreateRet(task->handle);
+
+    /*
+     * Not on the shadow stack: a suspended task's frame is not below anyone's. Its roots are pinned
+     * from the start until the final suspend instead, live in the coroutine frame like its locals.
+     */
+    if (!roots.empty()) {
+        llvm::IRBuilder<> tmp(llvm::cast<llvm::Instruction>(task->handle)->getNextNode());
+        auto frameArg = buildGCFrame(function, tmp, roots);
+        tmp.CreateCall(module->getOrInsertFunction("phemia_gc_pin", hookType), {frameArg});
+        llvm::IRBuilder<>(state).CreateCall(module->getOrInsertFunction("phemia_gc_unpin", hookType), {frameArg});
+    }
+    delete task;
+    task = nullptr;
+}
+
+void ARStack::suspendTask(llvm::BasicBlock *resume) {
+    auto state = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_suspend),
+                                    {llvm::ConstantTokenNone::get(llvmContext), builder.getFalse()}, "state");
+    auto branch = builder.CreateSwitch(state, task->suspend, 2);
+    branch->addCase(builder.getInt8(0), resume);
+    branch->addCase(builder.getInt8(1), task->cleanup);
+}
+
+void ARStack::runLoopUntil(const std::function<llvm::Value *()> &isDone, llvm::BasicBlock *done) {
+    auto function = builder.GetInsertBlock()->getParent();
+    auto ptrType = builder.getInt8PtrTy();
+    auto check = llvm::BasicBlock::Create(llvmContext, "poll", function);
+    auto step = llvm::BasicBlock::Create(llvmContext, "step", function);
+    builder.CreateBr(check);
+    builder.SetInsertPoint(check);
+    builder.CreateCondBr(isDone(), done, step);
+    builder.SetInsertPoint(step);
+    sealBlock(step);
+
+    /* resume what the loop hands back, or destroy it when the low bit says it is a finished task */
+    auto next = builder.CreateCall(module->getOrInsertFunction("phemia_loop_next", ptrType), {}, "next");
+    auto bits = builder.CreatePtrToInt(next, builder.getInt64Ty());
+    auto some = llvm::BasicBlock::Create(llvmContext, "some", function);
+    auto resume = llvm::BasicBlock::Create(llvmContext, "resume", function);
+    auto destroy = llvm::BasicBlock::Create(llvmContext, "destroy", function);
+    builder.CreateCondBr(builder.CreateIsNull(next), check, some);
+    builder.SetInsertPoint(some);
+    sealBlock(some);
+    builder.CreateCondBr(builder.CreateTrunc(bits, builder.getInt1Ty()), destroy, resume);
+    builder.SetInsertPoint(resume);
+    sealBlock(resume);
+    builder.CreateCall(intrinsic(llvm::Intrinsic::coro_resume), {next});
+    builder.CreateBr(check);
+    builder.SetInsertPoint(destroy);
+    sealBlock(destroy);
+    builder.CreateCall(intrinsic(llvm::Intrinsic::coro_destroy),
+                       {builder.CreateIntToPtr(builder.CreateAnd(bits, ~(uint64_t) 1), ptrType)});
+    builder.CreateBr(check);
+    sealBlock(check);
+}
+
+llvm::Value *ARStack::awaitTask(llvm::Value *handle, llvm::StructType *promiseType) {
+    usesTasks = true;
+    auto function = builder.GetInsertBlock()->getParent();
+    auto ptrType = builder.getInt8PtrTy();
+    auto ready = llvm::BasicBlock::Create(llvmContext, "ready", function);
+    auto promise = [&]() {
+        return builder.CreateCall(intrinsic(llvm::Intrinsic::coro_promise),
+                                  {handle, builder.getInt32(8), builder.getFalse()}, "promise");
+    };
+    if (task) {
+        auto wait = llvm::BasicBlock::Create(llvmContext, "wait", function);
+        builder.CreateCondBr(builder.CreateCall(intrinsic(llvm::Intrinsic::coro_done), {handle}), ready, wait);
+        builder.SetInsertPoint(wait);
+        sealBlock(wait);
+        /* every promise starts with the waiter */
+        builder.CreateStore(task->handle, builder.CreatePointerCast(promise(), ptrType->getPointerTo()));
+        suspendTask(ready);
+    } else {
+        runLoopUntil([&]() { return builder.CreateCall(intrinsic(llvm::Intrinsic::coro_done), {handle}); }, ready);
+    }
+    builder.SetInsertPoint(ready);
+    sealBlock(ready);
+    llvm::Value *result = nullptr;
+    if (promiseType && promiseType->getNumElements() > 1) {
+        auto fields = builder.CreatePointerCast(promise(), promiseType->getPointerTo());
+        result = builder.CreateLoad(promiseType->getElementType(1), builder.CreateStructGEP(promiseType, fields, 1),
+                                    "result");
+    }
+    builder.CreateCall(intrinsic(llvm::Intrinsic::coro_destroy), {handle});
+    return result;
+}
+
+void ARStack::detachTask(llvm::Value *handle) {
+    auto function = builder.GetInsertBlock()->getParent();
+    auto ptrType = builder.getInt8PtrTy();
+    auto finished = llvm::BasicBlock::Create(llvmContext, "finished", function);
+    auto running = llvm::BasicBlock::Create(llvmContext, "running", function);
+    auto after = llvm::BasicBlock::Create(llvmContext, "detached", function);
+    builder.CreateCondBr(builder.CreateCall(intrinsic(llvm::Intrinsic::coro_done), {handle}), finished, running);
+    builder.SetInsertPoint(finished);
+    sealBlock(finished);
+    builder.CreateCall(intrinsic(llvm::Intrinsic::coro_destroy), {handle});
+    builder.CreateBr(after);
+    /* its own handle, tagged, as its waiter: the event loop destroys it when it is done */
+    builder.SetInsertPoint(running);
+    sealBlock(running);
+    auto promise = builder.CreateCall(intrinsic(llvm::Intrinsic::coro_promise),
+                                      {handle, builder.getInt32(8), builder.getFalse()}, "promise");
+    auto tagged = builder.CreateIntToPtr(builder.CreateOr(builder.CreatePtrToInt(handle, builder.getInt64Ty()), 1),
+                                         ptrType);
+    builder.CreateStore(tagged, builder.CreatePointerCast(promise, ptrType->getPointerTo()));
+    builder.CreateBr(after);
+    builder.SetInsertPoint(after);
+    sealBlock(after);
+}
+
+llvm::Value *ARStack::awaitIO(llvm::Function *function, NExpression *format, const std::vector<llvm::Value *> &args) {
+    for (auto arg: args) {
+        if (!arg->getType()->isPointerTy()) return nullptr;
+    }
+    usesTasks = true;
+    auto ptrType = builder.getInt8PtrTy();
+    auto intType = typeOf("int");
+
+    /* the call itself, outlined into `int op(i8** args)` for the I/O thread */
+    auto opType = llvm::FunctionType::get(intType, {ptrType->getPointerTo()}, false);
+    auto op = llvm::Function::Create(opType, llvm::GlobalValue::InternalLinkage, function->getName() + ".io",
+                                     module);
+    auto caller = builder.GetInsertBlock();
+    builder.SetInsertPoint(llvm::BasicBlock::Create(llvmContext, "entry", op));
+    std::vector<llvm::Value *> values;
+    for (size_t i = 0; i < args.size(); i++) {
+        auto slot = builder.CreateConstInBoundsGEP1_32(ptrType, op->getArg(0), i);
+        values.push_back(builder.CreatePointerCast(builder.CreateLoad(ptrType, slot), args[i]->getType()));
+    }
+    llvm::Value *result = nullptr;
+    if (function->getName() == "scanf" && format) result = emitFormattedIO("scanf", format, values);
+    if (!result) result = builder.CreateCall(function, values, "call");
+    builder.CreateRet(castTo(result, intType));
+    builder.SetInsertPoint(caller);
+
+    auto argsType = llvm::ArrayType::get(ptrType, args.size());
+    auto argv = createEntryAlloca(argsType, "ioArgs");
+    for (size_t i = 0; i < args.size(); i++) {
+        builder.CreateStore(builder.CreatePointerCast(args[i], ptrType),
+                            builder.CreateConstInBoundsGEP2_32(argsType, argv, 0, i));
+    }
+    auto slot = createEntryAlloca(intType, "ioResult");
+    auto submitType = llvm::FunctionType::get(builder.getInt64Ty(), {
+            opType->getPointerTo(), ptrType->getPointerTo(), intType->getPointerTo(), ptrType}, false);
+    auto submit = module->getOrInsertFunction("phemia_io_submit", submitType);
+    auto argsPtr = builder.CreateConstInBoundsGEP2_32(argsType, argv, 0, 0);
+    auto read = llvm::BasicBlock::Create(llvmContext, "read", caller->getParent());
+    if (task) {
+        builder.CreateCall(submit, {op, argsPtr, slot, task->handle});
+        suspendTask(read);
+    } else {
+        auto ticket = builder.CreateCall(submit, {op, argsPtr, slot, llvm::ConstantPointerNull::get(ptrType)},
+                                         "ticket");
+        auto isDone = module->getOrInsertFunction("phemia_io_done",
+                                                  llvm::FunctionType::get(intType, {builder.getInt64Ty()}, false));
+        runLoopUntil([&]() { return builder.CreateIsNotNull(builder.CreateCall(isDone, {ticket})); }, read);
+    }
+    builder.SetInsertPoint(read);
+    sealBlock(read);
+    return builder.CreateLoad(intType, slot, "result");
+}
+
+llvm::Value *ARStack::emitFormattedIO(const std::string &function, NExpression *format,
+                                      const std::vector<llvm::Value *> &args) {
+    auto literal = dynamic_cast<NString *>(format);
+    bool isScan = function == "scanf";
+    FormatString spec;
+    if (!literal || !spec.parse(literal->value, isScan) || spec.conversions() + 1 != args.size()) return nullptr;
+
+    /* every argument must have the type its conversion reads, anything else is left to libc as written */
+    size_t next = 1;
+    for (auto &piece: spec.pieces) {
+        if (!piece.conversion) continue;
+        auto type = args[next++]->getType();
+        bool fits;
+        switch (piece.conversion) {
+            case 'd':
+                fits = isScan ? type == typeOf("int")->getPointerTo() : type->isIntegerTy();
+                break;
+            case 'c':
+                fits = isScan ? type == typeOf("char")->getPointerTo() : type->isIntegerTy();
+                break;
+            case 's':
+                fits = type == builder.getInt8PtrTy();
+                break;
+            default:
+                fits = isScan ? type == typeOf(piece.isLong ? "double" : "float")->getPointerTo()
+                              : type->isFloatingPointTy();
+        }
+        if (!fits) return nullptr;
+    }
+
+    auto runtime = [this](const char *name, std::vector<llvm::Value *> callArgs) -> llvm::Value * {
+        std::vector<llvm::Type *> types;
+        for (auto arg: callArgs) types.push_back(arg->getType());
+        auto fType = llvm::FunctionType::get(builder.getInt32Ty(), types, false);
+        return builder.CreateCall(module->getOrInsertFunction(name, fType), callArgs);
+    };
+    /* printf: characters written so far; scanf: the reader state, see runtime/io.h */
+    llvm::Value *result = builder.getInt32(0);
+    next = 1;
+    for (auto &piece: spec.pieces) {
+        if (!piece.conversion) {
+            auto text = constantString(piece.text);
+            if (isScan) {
+                result = runtime("phemia_read_literal", {text, result});
+            } else {
+                auto written = runtime("phemia_write", {text, builder.getInt64(piece.text.size())});
+                result = builder.CreateAdd(result, written);
+            }
+            continue;
+        }
+        auto arg = args[next++];
+        if (isScan) {
+            auto reader = piece.conversion == 'd' ? "phemia_read_int" : piece.conversion == 'c' ? "phemia_read_char"
+                          : piece.isLong ? "phemia_read_double" : "phemia_read_float";
+            result = runtime(reader, {arg, result});
+            continue;
+        }
+        auto width = builder.getInt32(piece.width);
+        auto flags = builder.getInt32(piece.flags);
+        llvm::Value *written;
+        if (piece.conversion == 'f') {
+            auto value = builder.CreateFPExt(arg, builder.getDoubleTy());
+            written = runtime("phemia_write_double", {value, builder.getInt32(piece.precision), width, flags});
+        } else if (piece.conversion == 's') {
+            written = runtime("phemia_write_str", {arg, width, flags});
+        } else {
+            /* C's promotion to int, except that booleans print as 0 and 1 */
+            auto value = builder.CreateIntCast(arg, builder.getInt32Ty(), !arg->getType()->isIntegerTy(1));
+            written = runtime(piece.conversion == 'd' ? "phemia_write_int" : "phemia_write_char", {value, width, flags});
+        }
+        result = builder.CreateAdd(result, written);
+    }
+    return isScan ? runtime("phemia_scan_result", {result}) : result;
+}
+
+llvm::Value *ARStack::mapCall(const std::string &operation, llvm::Type *result, llvm::Value *map, NExpression *key,
+                              bool stringKeys) {
+    auto keyVal = key->codeGen(*this);
+    if (!keyVal) return nullptr;
+    /* a string key is the char array or literal it is read from, the runtime copies it when inserting */
+    keyVal = stringKeys ? builder.CreatePointerCast(keyVal, builder.getInt8PtrTy()) : castTo(keyVal, builder.getInt64Ty());
+    auto fType = llvm::FunctionType::get(result, {builder.getInt8PtrTy(), keyVal->getType()}, false);
+    auto function = module->getOrInsertFunction("phemia_map_" + operation + (stringKeys ? "_str" : "_int"), fType);
+    if (operation == "insert") allocationSite();
+    return builder.CreateCall(function, {builder.CreatePointerCast(map, builder.getInt8PtrTy()), keyVal});
+}
+
+llvm::Value *ARStack::mapBuiltin(NFunctionCall &call) {
+    auto &name = call.id.name;
+    if (call.params.size() != (name == "size" ? 1u : 2u)) {
+        std::cerr << "Wrong number of arguments to " << name << std::endl;
+        return nullptr;
+    }
+    auto map = call.params[0]->codeGen(*this);
+    bool stringKeys;
+    llvm::Type *valueType;
+    if (!map || !mapTypeOf(map->getType(), stringKeys, valueType)) {
+        std::cerr << name << " takes a map" << std::endl;
+        return nullptr;
+    }
+    if (name == "size") {
+        auto fType = llvm::FunctionType::get(builder.getInt32Ty(), {builder.getInt8PtrTy()}, false);
+        auto size = module->getOrInsertFunction("phemia_map_size", fType);
+        return builder.CreateCall(size, {builder.CreatePointerCast(map, builder.getInt8PtrTy())}, "size");
+    }
+    auto found = mapCall(name == "has" ? "contains" : "erase", builder.getInt32Ty(), map, call.params[1], stringKeys);
+    return found ? builder.CreateICmpNE(found, builder.getInt32(0), name) : nullptr;
+}
+
+llvm::Value *ARStack::objectPointer(NIdentifier &object, ExpressionList *indices, ClassInfo *&cls) {
+    auto var = get(object.name);
+    if (!var) {
+        std::cerr << "Undeclared value: " << object.name << std::endl;
+        return nullptr;
+    }
+    if (indices) {
+        cls = var->size ? classOf(var->dType) : nullptr;
+        if (!cls) {
+            std::cerr << "Not an array of objects: " << object.name << std::endl;
+            return nullptr;
+        }
+        return builder.CreateInBoundsGEP(var->dType, arrayPointer(var), elementIndex(var, *indices), "objectPtr");
+    }
+    auto self = object.codeGen(*this);
+    cls = self && self->getType()->isPointerTy() ? classOf(self->getType()->getPointerElementType()) : nullptr;
+    if (!cls) {
+        std::cerr << "Not an object: " << object.name << std::endl;
+        return nullptr;
+    }
+    return self;
+}
+
+/*
+ * An array of a soa class holds its fields column after column, each column as long as the array.
+ * The fields go by decreasing alignment, so every column stays aligned for its elements. The columns
+ * together take no more than the array of whole objects the storage is allocated as.
+ */
+llvm::Value *ARStack::columnPointer(VariableRecord *arr, ClassInfo *cls, llvm::Value *element, unsigned index) {
+    auto &layout = module->getDataLayout();
+    uint64_t before = 0;
+    for (unsigned k = 0; k < index; k++) before += layout.getTypeAllocSize(cls->type->getElementType(k)).getFixedSize();
+    auto count = builder.CreateZExt(elementCount(arr), builder.getInt64Ty(), "count");
+    auto base = builder.CreateBitCast(arrayPointer(arr), builder.getInt8PtrTy());
+    auto column = builder.CreateInBoundsGEP(builder.getInt8Ty(), base,
+                                            builder.CreateNUWMul(count, builder.getInt64(before)), "column");
+    auto fieldType = cls->type->getElementType(index);
+    return builder.CreateInBoundsGEP(fieldType, builder.CreateBitCast(column, fieldType->getPointerTo()), element,
+                                     "fieldPtr");
+}
+
+llvm::Value *ARStack::memberPointer(NIdentifier &object, ExpressionList *indices, const std::string &field,
+                                    ClassInfo *&cls) {
+    cls = columnClass(object, indices);
+    if (!cls) {
+        auto self = objectPointer(object, indices, cls);
+        return self ? fieldPointer(self, cls, field) : nullptr;
+    }
+    auto it = cls->fields.find(field);
+    if (it == cls->fields.end()) {
+        std::cerr << "No field " << field << " in class " << cls->name << std::endl;
+        return nullptr;
+    }
+    auto arr = get(object.name);
+    return columnPointer(arr, cls, elementIndex(arr, *indices), it->second);
+}
+
+llvm::Value *ARStack::fieldPointer(llvm::Value *object, ClassInfo *cls, const std::string &field) {
+    auto it = cls->fields.find(field);
+    if (it == cls->fields.end()) {
+        std::cerr << "No field " << field << " in class " << cls->name << std::endl;
+        return nullptr;
+    }
+    return builder.CreateStructGEP(cls->type, object, it->second, field);
+}
+
+bool ARStack::emitCondBr(NExpression *condition, llvm::BasicBlock *whenTrue, llvm::BasicBlock *whenFalse) {
+    auto logical = dynamic_cast<NBinaryOperator *>(condition);
+    if (logical && (logical->op == AND || logical->op == OR)) {
+        auto rhsBB = llvm::BasicBlock::Create(llvmContext, logical->op == AND ? "andRhs" : "orRhs",
+                                              builder.GetInsertBlock()->getParent());
+        bool ok = logical->op == AND ? emitCondBr(logical->lhs, rhsBB, whenFalse)
+                                     : emitCondBr(logical->lhs, whenTrue, rhsBB);
+        if (!ok) return false;
+        sealBlock(rhsBB);
+        builder.SetInsertPoint(rhsBB);
+        return emitCondBr(logical->rhs, whenTrue, whenFalse);
+    }
+    auto value = condition->codeGen(*this);
+    if (!value) return false;
+    builder.CreateCondBr(castToBoolean(value), whenTrue, whenFalse);
+    return true;
+}
+
+llvm::Value *ARStack::emitLogical(NBinaryOperator *op) {
+    auto function = builder.GetInsertBlock()->getParent();
+    auto trueBB = llvm::BasicBlock::Create(llvmContext, "logicTrue", function);
+    auto falseBB = llvm::BasicBlock::Create(llvmContext, "logicFalse", function);
+    auto merge = llvm::BasicBlock::Create(llvmContext, "logicEnd", function);
+    if (!emitCondBr(op, trueBB, falseBB)) return nullptr;
+    sealBlock(trueBB);
+    sealBlock(falseBB);
+    builder.SetInsertPoint(trueBB);
+    builder.CreateBr(merge);
+    builder.SetInsertPoint(falseBB);
+    builder.CreateBr(merge);
+    sealBlock(merge);
+    builder.SetInsertPoint(merge);
+    auto phi = builder.CreatePHI(builder.getInt1Ty(), 2, op->op == AND ? "AND" : "OR");
+    phi->addIncoming(builder.getInt1(true), trueBB);
+    phi->addIncoming(builder.getInt1(false), falseBB);
+    return phi;
+}
+
+llvm::Value *ARStack::binaryOp(int op, llvm::Value *L, llvm::Value *R, bool isFP) {
+    switch (op) {
+        case PLUS:
+            return isFP ? builder.CreateFAdd(L, R, "FPLUS") : builder.CreateAdd(L, R, "PLUS");
+        case MINUS:
+            return isFP ? builder.CreateFSub(L, R, "FMINUS") : builder.CreateSub(L, R, "MINUS");
+        case MUL:
+            return isFP ? builder.CreateFMul(L, R, "FMUL") : builder.CreateMul(L, R, "MUL");
+        case DIV:
+            return isFP ? builder.CreateFDiv(L, R, "FDIV") : builder.CreateSDiv(L, R, "DIV");
+        case MOD:
+            return isFP ? builder.CreateFRem(L, R, "FMOD") : builder.CreateSRem(L, R, "MOD");
+        case XOR:
+            if (isFP) std::cerr << "Compute XOR on FP!\n";
+            return isFP ? nullptr : builder.CreateXor(L, R, "XOR");
+        case AND:
+            return isFP ? nullptr : builder.CreateAnd(L, R, "AND");
+        case OR:
+            return isFP ? nullptr : builder.CreateOr(L, R, "OR");
+        case LT:
+            return isFP ? builder.CreateFCmpULT(L, R, "FLT") : builder.CreateICmpSLT(L, R, "LT");
+        case LE:
+            return isFP ? builder.CreateFCmpULE(L, R, "FLE") : builder.CreateICmpSLE(L, R, "LE");
+        case GT:
+            return isFP ? builder.CreateFCmpUGT(L, R, "FGT") : builder.CreateICmpSGT(L, R, "GT");
+        case GE:
+            return isFP ? builder.CreateFCmpUGE(L, R, "FGE") : builder.CreateICmpSGE(L, R, "GE");
+        case EQ:
+            return isFP ? builder.CreateFCmpUEQ(L, R, "FEQ") : builder.CreateICmpEQ(L, R, "EQ");
+        case NE:
+            return isFP ? builder.CreateFCmpUNE(L, R, "FEQ") : builder.CreateICmpNE(L, R, "NE");
+        default:
+            return nullptr;
+    }
+}
+
+/*
+ * a + b, a * 2 ... on whole arrays: the result is a fresh array, filled by a loop over 256 bit
+ * vectors followed by a scalar loop for the remainder. Boolean arrays take &&, || and ^ instead,
+ * applied to their words.
+ */
+llvm::Value *ARStack::elementwise(int op, VariableRecord *lhs, VariableRecord *rhs, NExpression *lhsExpr,
+                                  NExpression *rhsExpr) {
+    auto shape = lhs ? lhs : rhs;
+    bool bits = isBitArray(shape);
+    if (bits ? op != AND && op != OR && op != XOR : op != PLUS && op != MINUS && op != MUL && op != DIV) {
+        std::cerr << "Unsupported element-wise operator!\n";
+        return nullptr;
+    }
+    auto elemType = storageTypeOf(shape->dType);
+    if (lhs && rhs) {
+        if (lhs->dType != rhs->dType || lhs->size->size() != rhs->size->size()) {
+            std::cerr << "Mismatched array operands!\n";
+            return nullptr;
+        }
+        for (size_t k = 0; k < lhs->size->size(); k++) {
+            if ((*lhs->size)[k] && (*rhs->size)[k] && (*lhs->size)[k] != (*rhs->size)[k]) {
+                std::cerr << "Mismatched array operands!\n";
+                return nullptr;
+            }
+        }
+    }
+    if (bits && (!lhs || !rhs)) {
+        std::cerr << "Boolean arrays combine with boolean arrays only!\n";
+        return nullptr;
+    }
+
+    /* the scalar side of `array op scalar` is broadcast */
+    llvm::Value *scalar = nullptr;
+    if (!lhs || !rhs) {
+        scalar = (lhs ? rhsExpr : lhsExpr)->codeGen(*this);
+        if (!scalar || !(scalar->getType()->isIntegerTy() || scalar->getType()->isFloatingPointTy())) {
+            std::cerr << "Element-wise operands must be array variables or numbers!\n";
+            return nullptr;
+        }
+        scalar = castTo(scalar, elemType);
+    }
+
+    bool isFP = elemType->isFloatingPointTy();
+    auto &layout = module->getDataLayout();
+    auto elemSize = layout.getTypeAllocSize(elemType).getFixedSize();
+    auto align = llvm::MaybeAlign(layout.getABITypeAlignment(elemType));
+    auto lanes = std::max<unsigned>(2, 32 / elemSize);
+    auto vecType = llvm::FixedVectorType::get(elemType, lanes);
+
+    auto count = bits ? bitWords(elementCount(shape)) : elementCount(shape);
+    auto bytes = builder.CreateMul(builder.CreateZExt(count, builder.getInt64Ty()), builder.getInt64(elemSize));
+    auto result = builder.CreateBitCast(gcAlloc(bytes), elemType->getPointerTo(), "elementwise");
+    auto lhsData = lhs ? arrayPointer(lhs) : nullptr;
+    auto rhsData = rhs ? arrayPointer(rhs) : nullptr;
+    auto vecEnd = builder.CreateAnd(count, builder.getInt32(~(lanes - 1)), "vecEnd");
+
+    auto function = builder.GetInsertBlock()->getParent();
+    auto preheader = builder.GetInsertBlock();
+    auto vecCond = llvm::BasicBlock::Create(llvmContext, "vecCond", function);
+    auto vecBody = llvm::BasicBlock::Create(llvmContext, "vecBody", function);
+    auto remCond = llvm::BasicBlock::Create(llvmContext, "remCond", function);
+    auto remBody = llvm::BasicBlock::Create(llvmContext, "remBody", function);
+    auto done = llvm::BasicBlock::Create(llvmContext, "afterElementwise", function);
+
+    auto operand = [&](llvm::Value *data, llvm::Value *idx, llvm::Type *type) -> llvm::Value * {
+        if (!data) return type->isVectorTy() ? builder.CreateVectorSplat(lanes, scalar) : scalar;
+        auto ptr = builder.CreateInBoundsGEP(elemType, data, idx);
+        return builder.CreateAlignedLoad(type, builder.CreateBitCast(ptr, type->getPointerTo()), align);
+    };
+
+    builder.CreateBr(vecCond);
+    builder.SetInsertPoint(vecCond);
+    auto i = builder.CreatePHI(builder.getInt32Ty(), 2, "i");
+    i->addIncoming(builder.getInt32(0), preheader);
+    builder.CreateCondBr(builder.CreateICmpSLT(i, vecEnd), vecBody, remCond);
+
+    builder.SetInsertPoint(vecBody);
+    auto vec = binaryOp(op, operand(lhsData, i, vecType), operand(rhsData, i, vecType), isFP);
+    builder.CreateAlignedStore(vec, builder.CreateBitCast(builder.CreateInBoundsGEP(elemType, result, i),
+                                                          vecType->getPointerTo()), align);
+    i->addIncoming(builder.CreateAdd(i, builder.getInt32(lanes)), vecBody);
+    builder.CreateBr(vecCond);
+
+    builder.SetInsertPoint(remCond);
+    auto j = builder.CreatePHI(builder.getInt32Ty(), 2, "j");
+    j->addIncoming(i, vecCond);
+    builder.CreateCondBr(builder.CreateICmpSLT(j, count), remBody, done);
+
+    builder.SetInsertPoint(remBody);
+    auto val = binaryOp(op, operand(lhsData, j, elemType), operand(rhsData, j, elemType), isFP);
+    builder.CreateAlignedStore(val, builder.CreateInBoundsGEP(elemType, result, j), align);
+    j->addIncoming(builder.CreateAdd(j, builder.getInt32(1)), remBody);
+    builder.CreateBr(remCond);
+
+    for (auto bb: {vecCond, vecBody, remCond, remBody, done}) sealBlock(bb);
+    builder.SetInsertPoint(done);
+    return result;
+}
+
+bool ARStack::emitLoopNest(NForStatement &loop) {
+    LoopNest nest;
+    if (!nest.match(loop)) return false;
+    auto intType = typeOf("int");
+    std::vector<VariableRecord *> vars;
+    for (auto &level: nest.levels) {
+        auto var = get(level.var);
+        if (!var || !var->isSSA || var->dType != intType) return false;
+        vars.push_back(var);
+    }
+    for (auto &name: nest.scalars) {
+        auto var = get(name);
+        if (!var || !var->isSSA || !(var->dType->isIntegerTy() || var->dType->isFloatingPointTy())) return false;
+        if (nest.boundScalars.count(name) && !var->dType->isIntegerTy()) return false;
+    }
+    std::map<std::string, LoopNest::ArrayShape> shapes;
+    auto &layout = module->getDataLayout();
+    for (auto &ref: nest.refs) {
+        auto arr = get(ref.array);
+        if (!arr || arr->isSSA || !arr->size || !arr->value || arr->dType->isPointerTy() || arr->dType->isStructTy() ||
+            arr->size->size() != ref.indices.size()) {
+            return false;
+        }
+        for (size_t k = 0; k < arr->size->size(); k++) {
+            if ((*arr->size)[k] == 0 || (k < arr->dims.size() && arr->dims[k])) return false;
+        }
+        shapes[ref.array] = {*arr->size, layout.getTypeAllocSize(arr->dType).getFixedSize(), arr->unaliased};
+    }
+    LoopNest::Plan plan;
+    if (!nest.plan(shapes, cache, plan)) return false;
+
+    /* the bounds are invariant, so they are evaluated once up front; `<=` loops run to upper + 1 */
+    size_t depth = nest.levels.size();
+    std::vector<llvm::Value *> lower(depth), upper(depth), before(depth);
+    for (size_t l = 0; l < depth; l++) {
+        auto &level = nest.levels[l];
+        lower[l] = castTo(level.lower->codeGen(*this), intType);
+        upper[l] = castTo(level.upper->codeGen(*this), intType);
+        if (level.inclusive) upper[l] = builder.CreateNSWAdd(upper[l], builder.getInt32(1));
+        before[l] = readVariable(vars[l], builder.GetInsertBlock());
+    }
+
+    /* tile loops outermost, then the element loops, both in the planned order */
+    std::vector<std::pair<size_t, bool>> schedule;
+    std::vector<VariableRecord *> tiles(depth, nullptr);
+    for (auto l: plan.order) {
+        if (!plan.tiled[l]) continue;
+        tiles[l] = new VariableRecord(nullptr, intType, nullptr);
+        tiles[l]->isSSA = true;
+        schedule.emplace_back(l, true);
+    }
+    for (auto l: plan.order) schedule.emplace_back(l, false);
+
+    auto function = builder.GetInsertBlock()->getParent();
+    std::function<void(size_t)> emitLevel = [&](size_t s) {
+        if (s == schedule.size()) {
+            for (auto store: nest.body) store->codeGen(*this);
+            return;
+        }
+        auto l = schedule[s].first;
+        bool isTile = schedule[s].second;
+        auto var = isTile ? tiles[l] : vars[l];
+        auto step = isTile ? plan.tile : 1;
+        llvm::Value *start = lower[l], *end = upper[l];
+        if (!isTile && tiles[l]) {
+            start = readVariable(tiles[l], builder.GetInsertBlock());
+            auto full = builder.CreateICmpSLT(start, builder.CreateSub(upper[l], builder.getInt32(plan.tile)));
+            end = builder.CreateSelect(full, builder.CreateAdd(start, builder.getInt32(plan.tile)), upper[l], "tileEnd");
+        }
+
+        auto cond = llvm::BasicBlock::Create(llvmContext, isTile ? "tileCon" : "nestCon", function);
+        auto body = llvm::BasicBlock::Create(llvmContext, isTile ? "tileLoop" : "nestLoop", function);
+        auto after = llvm::BasicBlock::Create(llvmContext, isTile ? "afterTile" : "afterNest", function);
+        writeVariable(var, builder.GetInsertBlock(), start);
+        builder.CreateBr(cond);
+
+        builder.SetInsertPoint(cond);
+        builder.CreateCondBr(builder.CreateICmpSLT(readVariable(var, cond), end), body, after);
+        builder.SetInsertPoint(body);
+        sealBlock(body);
+        emitLevel(s + 1);
+        auto next = builder.CreateNSWAdd(readVariable(var, builder.GetInsertBlock()), builder.getInt32(step));
+        writeVariable(var, builder.GetInsertBlock(), next);
+        builder.CreateBr(cond);
+        sealBlock(cond);
+
+        builder.SetInsertPoint(after);
+        sealBlock(after);
+    };
+    emitLevel(0);
+
+    /* leave the loop variables as the loops written would have: an inner one only moves if its outer ones ran */
+    llvm::Value *entered = builder.getInt1(true);
+    for (size_t l = 0; l < depth; l++) {
+        auto runs = builder.CreateICmpSLT(lower[l], upper[l]);
+        auto last = builder.CreateSelect(runs, upper[l], lower[l]);
+        writeVariable(vars[l], builder.GetInsertBlock(), builder.CreateSelect(entered, last, before[l]));
+        entered = builder.CreateAnd(entered, runs);
+    }
+    return true;
+}
+
+void ARStack::sealBlock(llvm::BasicBlock *block) {
+    auto phis = incompletePhis.find(block);
+    if (phis != incompletePhis.end()) {
+        for (auto &entry: phis->second) {
+            addPhiOperands(entry.first, entry.second);
+        }
+        incompletePhis.erase(phis);
+    }
+    sealedBlocks.insert(block);
+}
+
 void ARStack::generateCode(NBlock &root, const std::string &file) {
+    semantics.analyze(&root);
+    /* nothing is lowered once an error is known, see Diagnostics */
+    if (!diagnostics.empty()) return;
+    escapes.analyze(&root);
+    beginMain();
+    root.codeGen(*this); /* emit bytecode for the toplevel block */
+    finishMain(file);
+}
+
+void ARStack::generateCode(StatementStream &stream, const std::string &file) {
+    beginMain();
+    escapes.openTopLevel = true;
+    while (auto statement = stream.pop()) {
+        /* after an error the rest is still checked, but no longer lowered */
+        semantics.analyze(statement);
+        if (diagnostics.empty()) {
+            escapes.analyze(statement);
+            line = statement->line;
+            statement->codeGen(*this);
+            escapes.forgetLiterals();
+        }
+        if (!isRetained(statement)) delete statement;
+    }
+    if (diagnostics.empty()) finishMain(file);
+}
+
+void ARStack::beginMain() {
     /* Create the top level interpreter function to call as entry */
     std::vector<llvm::Type *> argTypes;
     llvm::FunctionType *fType = llvm::FunctionType::get(llvm::Type::getInt32Ty(llvmContext),
@@ -156,11 +1465,49 @@ void ARStack::generateCode(NBlock &root, const std::string &file) {
     main = llvm::Function::Create(fType, llvm::GlobalValue::ExternalLinkage, "main", module);
     llvm::BasicBlock *bBlock = llvm::BasicBlock::Create(llvmContext, "entry", main, nullptr);
     builder.SetInsertPoint(bBlock);
+    sealBlock(bBlock);
     /* Push a new variable/block context */
     push(bBlock);
-    root.codeGen(*this); /* emit bytecode for the toplevel block */
+}
+
+void ARStack::finishMain(const std::string &file) {
+    /* tasks nobody awaited still run to the end before the program exits */
+    if (usesTasks) {
+        auto exit = llvm::BasicBlock::Create(llvmContext, "exit", main);
+        auto pending = module->getOrInsertFunction("phemia_loop_pending", llvm::FunctionType::get(typeOf("int"), false));
+        runLoopUntil([&]() { return builder.CreateIsNull(builder.CreateCall(pending, {})); }, exit);
+        builder.SetInsertPoint(exit);
+        sealBlock(exit);
+    }
     builder.CreateRet(llvm::ConstantInt::get(typeOf("int"), 0, true));
+    emitGCFrame(main, current()->gcRoots);
     pop();
+    if (!heapProfile.empty()) startHeapProfile();
+
+    /* stack arrays indexed by constants become plain registers */
+    llvm::legacy::FunctionPassManager fpm(module);
+    fpm.add(llvm::createSROAPass());
+    fpm.doInitialization();
+    for (auto &function: *module) fpm.run(function);
+    fpm.doFinalization();
+
+    /* async functions are split into a ramp plus resume and destroy functions, nothing else understands coro.* */
+    if (usesTasks) {
+        llvm::PassManagerBuilder pmb;
+        pmb.OptLevel = 0;
+        llvm::addCoroutinePassesToExtensionPoints(pmb);
+        llvm::legacy::FunctionPassManager early(module);
+        llvm::legacy::PassManager coroutines;
+        pmb.populateFunctionPassManager(early);
+        pmb.populateModulePassManager(coroutines);
+        early.doInitialization();
+        for (auto &function: *module) early.run(function);
+        early.doFinalization();
+        coroutines.run(*module);
+    }
+
+    /* last, the clones multiversioning makes must not be transformed any further */
+    target.apply(*module);
 
     /* Print the bytecode in a human-readable format to see if our program compiled properly */
 //    llvm::legacy::PassManager pm;
@@ -177,12 +1524,35 @@ void ARStack::generateCode(NBlock &root, const std::string &file) {
     module->print(out, nullptr);
 }
 
+void ARStack::startHeapProfile() {
+    auto &entry = main->getEntryBlock();
+    llvm::IRBuilder<> at(&entry, entry.begin());
+    auto string = [&](const std::string &text) {
+        return llvm::ConstantExpr::getBitCast(at.CreateGlobalString(text, ".str"), at.getInt8PtrTy());
+    };
+    /* one table of function names and one of lines, indexed by site */
+    std::vector<llvm::Constant *> functions, lines;
+    for (auto &site: allocationSites) {
+        functions.push_back(string(site.first));
+        lines.push_back(at.getInt32(site.second));
+    }
+    auto table = [&](llvm::Type *type, const std::vector<llvm::Constant *> &items, const std::string &name) {
+        auto arrType = llvm::ArrayType::get(type, items.size());
+        auto global = new llvm::GlobalVariable(*module, arrType, true, llvm::GlobalValue::PrivateLinkage,
+                                               llvm::ConstantArray::get(arrType, items), name);
+        return llvm::ConstantExpr::getBitCast(global, type->getPointerTo());
+    };
+    auto fType = llvm::FunctionType::get(at.getVoidTy(), {at.getInt8PtrTy(), at.getInt8PtrTy(),
+                                                          at.getInt8PtrTy()->getPointerTo(),
+                                                          at.getInt32Ty()->getPointerTo(), at.getInt32Ty()}, false);
+    at.CreateCall(module->getOrInsertFunction("phemia_profile_start", fType),
+                  {string(heapProfile), string(sourceFile), table(at.getInt8PtrTy(), functions, "phemia.siteFunctions"),
+                   table(at.getInt32Ty(), lines, "phemia.siteLines"), at.getInt32(allocationSites.size())});
+}
+
 llvm::GenericValue ARStack::runCode() {
-    llvm::ExecutionEngine *ee = llvm::EngineBuilder(std::unique_ptr<llvm::Module>(module)).create();
-    ee->finalizeObject();
-    std::vector<llvm::GenericValue> noArgs;
-    llvm::GenericValue v = ee->runFunction(main, noArgs);
-    return v;
+    TieredEngine engine;
+    return engine.run(module, "main");
 }
 
 int NExpression::getDType() {
@@ -232,6 +1602,10 @@ int NChar::getDType() {
 llvm::Value *NString::codeGen(ARStack &context) {
     static int i = 0;
     auto charType = context.typeOf("char");
+    bool isConstant = context.escapes.isConstant(this);
+    if (isConstant && context.constantStrings.count(value)) {
+        return context.builder.CreateBitCast(context.constantStrings[value], charType->getPointerTo());
+    }
 
     std::vector<llvm::Constant *> str;
     for (auto ch: value) {
@@ -244,9 +1618,10 @@ llvm::Value *NString::codeGen(ARStack &context) {
     auto globalDeclaration = (llvm::GlobalVariable *) context.module->getOrInsertGlobal(".str" + std::to_string(i++),
                                                                                         stringType);
     globalDeclaration->setInitializer(llvm::ConstantArray::get(stringType, str));
-    globalDeclaration->setConstant(false);
+    globalDeclaration->setConstant(isConstant);
     globalDeclaration->setLinkage(llvm::GlobalValue::LinkageTypes::PrivateLinkage);
     globalDeclaration->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    if (isConstant) context.constantStrings[value] = globalDeclaration;
 
     return context.builder.CreateBitCast(globalDeclaration, charType->getPointerTo());
 }
@@ -257,7 +1632,7 @@ llvm::Value *NVoid::codeGen(ARStack &context) {
 
 llvm::Value *NArray::codeGen(ARStack &context) {
     static int i = 0;
-    auto dType = context.typeOf(type->name);
+    auto dType = context.elementTypeOf(type->name);
     if (initList) {
         std::vector<llvm::Constant *> arr;
         switch ((*initList->begin())->getDType()) {
@@ -298,32 +1673,73 @@ llvm::Value *NArray::codeGen(ARStack &context) {
             std::cerr << "Unsupported array initialization!\n";
             return nullptr;
         } else {
-            auto arrType = llvm::ArrayType::get(dType, arr.size());
+            if (dType->isIntegerTy(1)) {
+                /* packed like every boolean array, see ARStack::isBitArray */
+                std::vector<llvm::Constant *> words((arr.size() + 63) / 64);
+                for (size_t k = 0; k < words.size(); k++) {
+                    uint64_t word = 0;
+                    for (size_t b = 0; b < 64 && k * 64 + b < arr.size(); b++) {
+                        word |= (uint64_t) arr[k * 64 + b]->isOneValue() << b;
+                    }
+                    words[k] = context.builder.getInt64(word);
+                }
+                arr = words;
+            }
+            auto storage = context.storageTypeOf(dType);
+            auto arrType = llvm::ArrayType::get(storage, arr.size());
 
             auto globalDeclaration = (llvm::GlobalVariable *) context.module->getOrInsertGlobal(
                     ".arr" + std::to_string(i++), arrType);
             globalDeclaration->setInitializer(llvm::ConstantArray::get(arrType, arr));
-            globalDeclaration->setConstant(false);
+            globalDeclaration->setConstant(context.escapes.isConstant(this));
             globalDeclaration->setLinkage(llvm::GlobalValue::LinkageTypes::PrivateLinkage);
             globalDeclaration->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
-            return context.builder.CreateBitCast(globalDeclaration, dType->getPointerTo());
+            return context.builder.CreateBitCast(globalDeclaration, storage->getPointerTo());
         }
     } else {
         auto *arrSize = new std::vector<uint32_t>();
         uint64_t size = util::calArrayDim(arrDim, arrSize);
-        auto arrType = llvm::ArrayType::get(dType, size);
-        auto *val = new llvm::GlobalVariable(*context.module, arrType, false, llvm::GlobalValue::CommonLinkage, 0,
-                                             "arr");
-        auto *constArr = llvm::ConstantAggregateZero::get(arrType);
-        val->setInitializer(constArr);
-        return context.builder.CreateBitCast(val, dType->getPointerTo());
+        auto cls = context.classOf(dType);
+        if (cls && cls->refs) {
+            /* the collector only traces a reference prefix, which an array of such objects lacks */
+            std::cerr << "Arrays of " << cls->name << " cannot hold its object fields" << std::endl;
+            return nullptr;
+        }
+        auto arrType = context.storageArrayOf(dType, size);
+        return context.builder.CreateBitCast(context.gcAlloc(arrType), arrType->getElementType()->getPointerTo());
     }
 }
 
 llvm::Value *NBinaryOperator::codeGen(ARStack &context) {
+    auto lhsArr = context.arrayOperand(lhs);
+    auto rhsArr = context.arrayOperand(rhs);
+    /* && and || evaluate their right operand only when it decides the result, unless they combine bit sets */
+    bool bitSets = lhsArr && rhsArr && ARStack::isBitArray(lhsArr) && ARStack::isBitArray(rhsArr);
+    if ((op == AND || op == OR) && !bitSets) return context.emitLogical(this);
+
+    if (lhsArr || rhsArr) return context.elementwise(op, lhsArr, rhsArr, lhs, rhs);
+
     auto L = lhs->codeGen(context);
     auto R = rhs->codeGen(context);
     bool isFP = false;
+    if (!L || !R) {
+        return nullptr;
+    }
+
+    if (L->getType()->isVectorTy() || R->getType()->isVectorTy()) {
+        /* scalar operands of vector arithmetic are broadcast to every lane */
+        auto vecType = llvm::cast<llvm::FixedVectorType>(L->getType()->isVectorTy() ? L->getType() : R->getType());
+        auto elemType = vecType->getElementType();
+        if (!L->getType()->isVectorTy())
+            L = context.builder.CreateVectorSplat(vecType->getNumElements(), context.castTo(L, elemType));
+        if (!R->getType()->isVectorTy())
+            R = context.builder.CreateVectorSplat(vecType->getNumElements(), context.castTo(R, elemType));
+        if (L->getType() != R->getType()) {
+            std::cerr << "Mismatched vector operands!\n";
+            return nullptr;
+        }
+        return context.binaryOp(op, L, R, elemType->isFloatingPointTy());
+    }
 
     // type upgrade
     if ((!L->getType()->isIntegerTy()) ||
@@ -344,45 +1760,7 @@ llvm::Value *NBinaryOperator::codeGen(ARStack &context) {
         }
     }
 
-    if (!L || !R) {
-        return nullptr;
-    }
-
-    switch (op) {
-        case PLUS:
-            return isFP ? context.builder.CreateFAdd(L, R, "FPLUS") : context.builder.CreateAdd(L, R, "PLUS");
-        case MINUS:
-            return isFP ? context.builder.CreateFSub(L, R, "FMINUS") : context.builder.CreateSub(L, R, "MINUS");
-        case MUL:
-            return isFP ? context.builder.CreateFMul(L, R, "FMUL") : context.builder.CreateMul(L, R, "MUL");
-        case DIV:
-            return isFP ? context.builder.CreateFDiv(L, R, "FDIV") : context.builder.CreateSDiv(L, R, "DIV");
-        case MOD:
-            return isFP ? context.builder.CreateFRem(L, R, "FMOD") : context.builder.CreateSRem(L, R, "MOD");
-        case AND:
-            if (isFP) std::cerr << "Compute AND on FP!\n";
-            return isFP ? nullptr : context.builder.CreateAnd(L, R, "AND");
-        case OR:
-            if (isFP) std::cerr << "Compute OR on FP!\n";
-            return isFP ? nullptr : context.builder.CreateOr(L, R, "OR");
-        case XOR:
-            if (isFP) std::cerr << "Compute XOR on FP!\n";
-            return isFP ? nullptr : context.builder.CreateXor(L, R, "XOR");
-        case LT:
-            return isFP ? context.builder.CreateFCmpULT(L, R, "FLT") : context.builder.CreateICmpSLT(L, R, "LT");
-        case LE:
-            return isFP ? context.builder.CreateFCmpULE(L, R, "FLE") : context.builder.CreateICmpSLE(L, R, "LE");
-        case GT:
-            return isFP ? context.builder.CreateFCmpUGT(L, R, "FGT") : context.builder.CreateICmpSGT(L, R, "GT");
-        case GE:
-            return isFP ? context.builder.CreateFCmpUGE(L, R, "FGE") : context.builder.CreateICmpSGE(L, R, "GE");
-        case EQ:
-            return isFP ? context.builder.CreateFCmpUEQ(L, R, "FEQ") : context.builder.CreateICmpEQ(L, R, "EQ");
-        case NE:
-            return isFP ? context.builder.CreateFCmpUNE(L, R, "FEQ") : context.builder.CreateICmpNE(L, R, "NE");
-        default:
-            return nullptr;
-    }
+    return context.binaryOp(op, L, R, isFP);
 }
 
 llvm::Value *NUnaryOperator::codeGen(ARStack &context) {
@@ -401,14 +1779,12 @@ llvm::Value *NUnaryOperator::codeGen(ARStack &context) {
 
 llvm::Value *NIdentifier::codeGen(ARStack &context) {
     auto id = context.get(name);
-    if (!id || !id->value) {
+    if (!id || (!id->isSSA && !id->value)) {
         std::cerr << "Undeclared value: " << name << std::endl;
         return nullptr;
     }
 
-    if (id->size) {
-        return id->value;
-    } else return context.builder.CreateLoad(id->value, false, "load");
+    return id->size ? context.arrayPointer(id) : context.loadVariable(id);
 }
 
 llvm::Value *NAssignment::codeGen(ARStack &context) {
@@ -423,14 +1799,20 @@ llvm::Value *NAssignment::codeGen(ARStack &context) {
     if (type->isArrayTy() || (type->isPointerTy() && type->getPointerElementType()->isArrayTy())) {
         val->setName(lhs.name);
         res = val;
-        if (id && !id->value) id->value = val;
+        if (id && !id->value) context.bindArray(id, val);
         if (id && id->size && *id->size->begin() == 0) {
             (*(id->size))[0] = val->getType()->getArrayNumElements();
         }
     } else {
         if (id) {
-            if (id->value) { context.builder.CreateStore(val, id->value); }
-            else {
+            if (!id->size) return context.storeVariable(id, val);
+            /* a new array (e.g. the result of a + b) rebinds the variable rather than being stored into it */
+            if (id->size && val->getType()->isPointerTy()) {
+                context.bindArray(id, val);
+            } else if (id->value) { context.builder.CreateStore(val, context.arrayPointer(id)); }
+            else if (id->size) {
+                context.bindArray(id, val);
+            } else {
                 id->value = val;
             }
             res = id->value;
@@ -447,39 +1829,77 @@ llvm::Value *NArrayAssignment::codeGen(ARStack &context) {
         std::cerr << "Undeclared value: " << lhs.name << std::endl;
         return nullptr;
     }
+    if (!id->size && id->dType->isVectorTy() && arrayIndices.size() == 1) {
+        auto vecType = llvm::cast<llvm::VectorType>(id->dType);
+        auto val = context.castTo(rhs.codeGen(context), vecType->getElementType());
+        auto lane = context.castTo(arrayIndices[0]->codeGen(context), context.typeOf("int"));
+        auto vec = context.loadVariable(id);
+        context.storeVariable(id, context.builder.CreateInsertElement(vec, val, lane));
+        return val;
+    }
+    bool stringKeys;
+    llvm::Type *valueType;
+    if (!id->size && context.mapTypeOf(id->dType, stringKeys, valueType) && arrayIndices.size() == 1) {
+        /* the value first: whatever it calls may insert into the map and move the slot */
+        auto val = rhs.codeGen(context);
+        if (!val) return nullptr;
+        val = context.castTo(val, valueType);
+        auto map = context.loadVariable(id);
+        auto slot = context.mapCall("insert", context.builder.getInt8PtrTy(), map, arrayIndices[0], stringKeys);
+        if (!slot) return nullptr;
+        context.builder.CreateStore(val, context.builder.CreateBitCast(slot, valueType->getPointerTo()));
+        return val;
+    }
     if (!id->size) {
         std::cerr << "Unindexable value: " << lhs.name << std::endl;
         return nullptr;
     }
     auto val = rhs.codeGen(context);
-    if (id->dType->getTypeID() != val->getType()->getTypeID()) {
-        std::cerr << "Cannot assign ";
-        val->getType()->print(llvm::errs());
-        std::cerr << " to ";
-        id->dType->print(llvm::errs());
-        std::cerr << std::endl;
+    if (!val) return nullptr;
+    /* numbers convert as they do for variables and fields, SemanticCheck has ruled out anything else */
+    auto isNumber = [](llvm::Type *type) { return type->isIntegerTy() || type->isFloatingPointTy(); };
+    if (isNumber(id->dType) && isNumber(val->getType())) {
+        val = context.castTo(val, id->dType);
+    } else if (id->dType->getTypeID() != val->getType()->getTypeID()) {
+        diagnostics.error(line, 0, "cannot assign to an element of '" + lhs.name + "'");
         return nullptr;
     }
 
     assert(arrayIndices.size() == id->size->size());
-    auto arrDim = *(id->size);
-    auto exp = *(arrayIndices.rbegin());
-    for (unsigned i = arrayIndices.size() - 1; i >= 1; i--) {
-        auto tmp = new NBinaryOperator(new NInteger(std::to_string(arrDim[i])), MUL, arrayIndices[i - 1]);
-        exp = new NBinaryOperator(exp, PLUS, tmp);
+    auto idx = context.elementIndex(id, arrayIndices);
+    if (auto cls = context.columnClass(lhs, &arrayIndices)) {
+        /* scattered over the columns */
+        for (unsigned k = 0; k < cls->type->getNumElements(); k++) {
+            context.builder.CreateAlignedStore(context.builder.CreateExtractValue(val, k),
+                                               context.columnPointer(id, cls, idx, k), context.fieldAlign(cls, k));
+        }
+        return val;
+    }
+    if (ARStack::isBitArray(id)) {
+        llvm::Value *mask;
+        auto ptr = context.bitAddress(id, idx, mask);
+        auto word = context.builder.CreateAlignedLoad(context.builder.getInt64Ty(), ptr, llvm::MaybeAlign(8));
+        auto set = context.builder.CreateSelect(context.castTo(val, id->dType), context.builder.CreateOr(word, mask),
+                                                context.builder.CreateAnd(word, context.builder.CreateNot(mask)));
+        return context.builder.CreateAlignedStore(set, ptr, llvm::MaybeAlign(8));
     }
-    auto idx = exp->codeGen(context);
+    auto data = context.arrayPointer(id);
     std::vector<llvm::Value *> arrV;
-    if (!id->value->getType()->isPointerTy())
+    if (!data->getType()->isPointerTy())
         arrV.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(context.llvmContext), 0));
     arrV.push_back(idx);
-    auto ptr = context.builder.CreateInBoundsGEP(id->value, llvm::makeArrayRef(arrV), "elementPtr");
+    auto ptr = context.builder.CreateInBoundsGEP(data, llvm::makeArrayRef(arrV), "elementPtr");
     return context.builder.CreateAlignedStore(val, ptr, llvm::MaybeAlign(4));
 }
 
 llvm::Value *NClassAssignment::codeGen(ARStack &context) {
-    // TODO: class
-    return nullptr;
+    ClassInfo *cls;
+    auto ptr = context.memberPointer(lhs, arrayIndices, attribute.name, cls);
+    if (!ptr) return nullptr;
+    auto index = cls->fields[attribute.name];
+    auto val = context.castTo(rhs.codeGen(context), cls->type->getElementType(index));
+    context.builder.CreateAlignedStore(val, ptr, context.fieldAlign(cls, index));
+    return val;
 }
 
 llvm::Value *NBlock::codeGen(ARStack &context) {
@@ -487,23 +1907,44 @@ llvm::Value *NBlock::codeGen(ARStack &context) {
     llvm::Value *last = nullptr;
     for (it = statements.begin(); it != statements.end(); it++) {
         auto &statement = **it;
+        context.line = statement.line;
         last = (statement).codeGen(context);
     }
     return last;
 }
 
 llvm::Value *NExpressionStatement::codeGen(ARStack &context) {
-    return expression->codeGen(context);
+    auto value = expression->codeGen(context);
+    auto call = llvm::dyn_cast_or_null<llvm::CallInst>(value);
+    if (call && context.promises.count(call->getCalledFunction())) context.detachTask(call);
+    return value;
 }
 
 llvm::Value *NReturnStatement::codeGen(ARStack &context) {
+    if (context.task) {
+        /* the result goes to the promise, the awaiting task picks it up from there */
+        llvm::Value *retVal = nullptr;
+        if (expression) {
+            retVal = expression->codeGen(context);
+            context.setCurrentReturnValue(retVal);
+            auto type = context.task->promiseType;
+            context.builder.CreateStore(context.castTo(retVal, type->getElementType(1)),
+                                        context.builder.CreateStructGEP(type, context.task->promise, 1));
+        }
+        auto br = context.builder.CreateBr(context.task->final);
+        context.startDeadBlock();
+        return retVal ? retVal : br;
+    }
     if (expression) {
         llvm::Value *retVal = expression->codeGen(context);
         context.setCurrentReturnValue(retVal);
         context.builder.CreateRet(context.getCurrentReturnValue());
+        context.startDeadBlock();
         return retVal;
     } else {
-        return context.builder.CreateRetVoid();
+        auto ret = context.builder.CreateRetVoid();
+        context.startDeadBlock();
+        return ret;
     }
 
 }
@@ -514,96 +1955,707 @@ llvm::Value *NVariableDeclaration::codeGen(ARStack &context) {
         return nullptr;
     }
     llvm::Value *alloc = nullptr;
-    auto dType = context.typeOf(type.name);
     auto arrDim = type.getArrayDim();
-
-    if (!arrDim && type.name != "string") {
-        alloc = context.builder.CreateAlloca(dType, nullptr, id.name);
-        context.locals()[id.name] = new VariableRecord(alloc, dType, nullptr);
+    auto dType = arrDim ? context.elementTypeOf(type.name) : context.typeOf(type.name);
+
+    if (!arrDim && type.name != "string" && context.atTopLevel() && context.escapes.isShared(this)) {
+        /* a register of main is out of reach of the functions using it */
+        auto global = context.createGlobal(dType, id.name);
+        context.locals()[id.name] = new VariableRecord(global, dType, nullptr);
+        if (dType->isPointerTy()) {
+            context.current()->gcRoots.push_back(
+                    llvm::ConstantExpr::getPointerCast(global, context.builder.getInt8PtrTy()->getPointerTo()));
+        }
+        if (assignmentExpr != nullptr) {
+            (new NAssignment(id, *assignmentExpr))->codeGen(context);
+        }
+    } else if (!arrDim && type.name != "string") {
+        auto var = new VariableRecord(nullptr, dType, nullptr);
+        var->isSSA = true;
+        context.locals()[id.name] = var;
+        if (dType->isPointerTy()) {
+            context.writeVariable(var, context.builder.GetInsertBlock(),
+                                  llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(dType)));
+            /* `this` may point into an object array, which the caller keeps alive */
+            if (id.name != "this") context.addRoot(var);
+        } else {
+            context.writeVariable(var, context.builder.GetInsertBlock(), llvm::UndefValue::get(dType));
+        }
         if (assignmentExpr != nullptr) {
             (new NAssignment(id, *assignmentExpr))->codeGen(context);
         }
     } else if (arrDim) {
         auto *arrSize = new std::vector<uint32_t>();
         uint64_t size = util::calArrayDim(arrDim, arrSize);
-        if (assignmentExpr) {
+        auto var = new VariableRecord(nullptr, dType, arrSize);
+        var->unaliased = context.escapes.isUnaliased(this);
+        bool shared = context.atTopLevel() && context.escapes.isShared(this);
+        if (shared) context.addGlobalRoot(var, id.name);
+        auto arrType = context.storageArrayOf(dType, size);
+        auto bytes = context.module->getDataLayout().getTypeAllocSize(arrType).getFixedSize();
+        auto call = dynamic_cast<NFunctionCall *>(assignmentExpr);
+        if (call && call->id.name == "mapFile" && !context.module->getFunction("mapFile")) {
+            alloc = context.mappedArray(*call, arrType);
+            if (alloc) context.bindArray(var, alloc);
+        } else if (!shared && context.escapes.isLocalArray(this) && !dType->isPointerTy() && !dType->isStructTy() &&
+            bytes <= ARStack::maxStackArrayBytes) {
+            /* the array never outlives this call: zeroed stack storage instead of a collected heap block */
+            auto slot = context.createEntryAlloca(arrType, id.name);
+            context.builder.CreateMemSet(slot, context.builder.getInt8(0), bytes, slot->getAlign());
+            alloc = context.builder.CreateBitCast(slot, arrType->getElementType()->getPointerTo());
+            var->value = alloc;
+            context.writeVariable(var, context.builder.GetInsertBlock(), alloc);
+        } else if (assignmentExpr) {
             alloc = (new NAssignment(id, *assignmentExpr, true))->codeGen(context);
-            context.locals()[id.name] = new VariableRecord(alloc, dType, arrSize);
-        } else {
-            context.locals()[id.name] = new VariableRecord(nullptr, dType, arrSize);
+            if (alloc) context.bindArray(var, alloc);
         }
+        context.locals()[id.name] = var;
     } else {
         uint32_t size = 0;
         if (assignmentExpr) {
             alloc = (new NAssignment(id, *assignmentExpr, true))->codeGen(context);
         }
         auto sizeV = new std::vector<uint32_t>{size};
-        context.locals()[id.name] = new VariableRecord(alloc, dType, sizeV);
+        auto var = new VariableRecord(nullptr, dType, sizeV);
+        context.locals()[id.name] = var;
+        if (context.atTopLevel() && context.escapes.isShared(this)) context.addGlobalRoot(var, id.name);
+        if (alloc) context.bindArray(var, alloc);
     }
     return alloc;
 }
 
-llvm::Value *NFunctionDeclaration::codeGen(ARStack &context) {
+bool NFunctionDeclaration::isGeneric() const {
+    for (auto item: arguments) {
+        auto arrDim = item->type.getArrayDim();
+        if (!arrDim) continue;
+        for (auto dim: *arrDim) {
+            if (*dim == "0") return true;
+        }
+    }
+    return false;
+}
+
+llvm::FunctionType *NFunctionDeclaration::functionType(ARStack &context, bool withDims) {
     std::vector<llvm::Type *> argTypes;
     for (auto item: arguments) {
         auto arrDim = item->type.getArrayDim();
         if (arrDim) {
-            argTypes.push_back(context.typeOf(item->type.name)->getPointerTo());
+            argTypes.push_back(context.storageTypeOf(context.elementTypeOf(item->type.name))->getPointerTo());
+            /* the generic version receives every runtime dimension as a trailing int */
+            if (withDims) {
+                for (auto dim: *arrDim) {
+                    if (*dim == "0") argTypes.push_back(context.typeOf("int"));
+                }
+            }
         } else argTypes.push_back(context.typeOf(item->type.name));
     }
+    /* an async function returns the handle of the task it started */
+    auto result = isAsync ? context.typeOf("task") : context.typeOf(type.name);
+    return llvm::FunctionType::get(result, llvm::makeArrayRef(argTypes), false);
+}
+
+llvm::Function *NFunctionDeclaration::emit(ARStack &context, const std::string &name,
+                                           const std::vector<std::vector<uint32_t> *> *shapes) {
+    /* methods are declared up front so they can call each other */
+    llvm::Function *function = context.module->getFunction(name);
+    if (!function || !function->empty()) {
+        function = llvm::Function::Create(functionType(context, !shapes), llvm::GlobalValue::InternalLinkage, name,
+                                          context.module);
+    }
+    /* registered before the body so recursive calls resolve to this version */
+    if (shapes) {
+        context.specializations[name] = function;
+    } else if (isGeneric()) {
+        context.genericFunctions[name] = {this, context.scopeDepth()};
+    }
 
-    llvm::FunctionType *fType = llvm::FunctionType::get(context.typeOf(type.name), llvm::makeArrayRef(argTypes), false);
-    llvm::Function *function = llvm::Function::Create(fType, llvm::GlobalValue::InternalLinkage, id.name,
-                                                      context.module);
-    llvm::BasicBlock *bBlock = llvm::BasicBlock::Create(context.llvmContext, id.name + "_entry", function, nullptr);
+    llvm::BasicBlock *bBlock = llvm::BasicBlock::Create(context.llvmContext, name + "_entry", function, nullptr);
+    auto prevBlock = context.builder.GetInsertBlock();
+    auto prevLoop = context.inLoop;
+    auto prevMerge = context.curMerge;
+    auto prevCond = context.curCond;
+    auto prevTask = context.task;
+    context.inLoop = 0;
+    context.curMerge = nullptr;
+    context.curCond = nullptr;
+    context.task = nullptr;
     context.push(bBlock);
     context.builder.SetInsertPoint(bBlock);
+    context.sealBlock(bBlock);
+    if (isAsync) context.beginTask(function, context.typeOf(type.name));
 
     llvm::Function::arg_iterator argsValues = function->arg_begin();
     llvm::Value *argumentValue;
 
-    for (auto item: arguments) {
-        auto alloc = item->codeGen(context);
+    for (size_t i = 0; i < arguments.size(); i++) {
+        auto item = arguments[i];
+        item->codeGen(context);
         argumentValue = &*argsValues++;
         argumentValue->setName(item->id.name);
 
-        if (alloc) {
-            context.builder.CreateStore(argumentValue, alloc, false);
+        auto var = context.current()->localVal[item->id.name];
+        if (var->isSSA) {
+            context.assignVariable(var, argumentValue);
+            continue;
+        }
+        if (var->size) {
+            context.bindArray(var, argumentValue);
+        } else {
+            var->value = argumentValue;
+        }
+        if (!item->type.getArrayDim()) continue;
+        if (shapes) {
+            var->size = new std::vector<uint32_t>(*(*shapes)[i]);
         } else {
-            context.current()->localVal[item->id.name]->value = argumentValue;
+            var->dims.resize(var->size->size(), nullptr);
+            for (size_t k = 0; k < var->size->size(); k++) {
+                if ((*var->size)[k] != 0) continue;
+                var->dims[k] = &*argsValues++;
+                var->dims[k]->setName(item->id.name + ".dim" + std::to_string(k));
+            }
         }
     }
 
     block.codeGen(context);
+    bool missingReturn = false;
     if (type.name == "void") {
-        context.builder.CreateRetVoid();
+        if (context.task) context.builder.CreateBr(context.task->final);
+        else context.builder.CreateRetVoid();
     } else {
-        if (context.getCurrentReturnValue() == nullptr) {
-            std::cerr << "function needs return value!\n";
-            return nullptr;
-        }
+        /* falling off the end of a non-void function */
+        if (!context.builder.GetInsertBlock()->getTerminator()) context.builder.CreateUnreachable();
+        missingReturn = context.getCurrentReturnValue() == nullptr;
     }
+    if (context.task) context.finishTask(context.current()->gcRoots);
+    else context.emitGCFrame(function, context.current()->gcRoots);
     context.pop();
-    context.builder.SetInsertPoint(context.current()->block);
-    context.locals()[id.name] = new VariableRecord(function, fType, nullptr);
+    context.builder.SetInsertPoint(prevBlock);
+    context.inLoop = prevLoop;
+    context.curMerge = prevMerge;
+    context.curCond = prevCond;
+    context.task = prevTask;
+    if (missingReturn) {
+        std::cerr << "function needs return value!\n";
+        return nullptr;
+    }
+    return function;
+}
+
+llvm::Value *NFunctionDeclaration::codeGen(ARStack &context) {
+    auto function = emit(context, id.name, nullptr);
+    if (!function) return nullptr;
+    context.locals()[id.name] = new VariableRecord(function, function->getFunctionType(), nullptr);
+    bool pure = !isAsync && context.constEval.isPure(*this, [&context](const std::string &name) {
+        auto callee = context.module->getFunction(name);
+        return (callee && context.pureFunctions.count(callee)) || context.typeOf(name)->isVectorTy();
+    });
+    if (pure) context.pureFunctions.insert(function);
     return function;
 }
 
+llvm::Value *NClassDeclaration::codeGen(ARStack &context) {
+    if (context.classes.find(id->name) != context.classes.end()) {
+        std::cerr << "Redeclared class: " << id->name << std::endl;
+        return nullptr;
+    }
+    /* registered before the fields are laid out so they may refer to the class itself */
+    auto structType = llvm::StructType::create(context.llvmContext, "class." + id->name);
+    auto cls = new ClassInfo(id->name, structType, this);
+    cls->structOfArrays = structOfArrays;
+    context.classes[id->name] = cls;
+
+    for (auto field: fields) {
+        if (field->type.getArrayDim() || context.typeOf(field->type.name)->isVoidTy()) {
+            std::cerr << "Unsupported type of field " << id->name << "." << field->id.name << std::endl;
+            return nullptr;
+        }
+    }
+
+    /*
+     * References go first so the collector traces a prefix of the object, the rest by decreasing
+     * alignment, which leaves the struct no padding but what a vector field after the references needs.
+     */
+    auto &layout = context.module->getDataLayout();
+    std::vector<NVariableDeclaration *> order(fields.begin(), fields.end());
+    std::stable_sort(order.begin(), order.end(), [&](NVariableDeclaration *a, NVariableDeclaration *b) {
+        auto typeA = context.typeOf(a->type.name);
+        auto typeB = context.typeOf(b->type.name);
+        if (typeA->isPointerTy() != typeB->isPointerTy()) return typeA->isPointerTy();
+        return layout.getABITypeAlignment(typeA) > layout.getABITypeAlignment(typeB);
+    });
+
+    std::vector<llvm::Type *> body;
+    for (auto field: order) {
+        if (cls->fields.find(field->id.name) != cls->fields.end()) {
+            std::cerr << "Redeclared field: " << id->name << "." << field->id.name << std::endl;
+            return nullptr;
+        }
+        auto fieldType = context.typeOf(field->type.name);
+        cls->fields[field->id.name] = body.size();
+        body.push_back(fieldType);
+        if (fieldType->isPointerTy()) cls->refs++;
+    }
+    structType->setBody(body);
+
+    /* no inheritance, so every method call binds statically to `Class.method(this, ...)` */
+    for (auto method: methods) {
+        method->arguments.insert(method->arguments.begin(),
+                                 new NVariableDeclaration(false, *new NIdentifier(id->name), *new NIdentifier("this")));
+        if (method->isGeneric()) {
+            std::cerr << "Method " << id->name << "." << method->id.name
+                      << " cannot take arrays with runtime dimensions" << std::endl;
+            return nullptr;
+        }
+        llvm::Function::Create(method->functionType(context, false), llvm::GlobalValue::InternalLinkage,
+                               id->name + "." + method->id.name, context.module);
+    }
+    for (auto method: methods) {
+        method->emit(context, id->name + "." + method->id.name, nullptr);
+    }
+    return nullptr;
+}
+
+llvm::Value *ARStack::sortBuiltin(NFunctionCall &call) {
+    auto &name = call.id.name;
+    auto arr = call.params.empty() ? nullptr : arrayOperand(call.params[0]);
+    if (!arr || !arr->value) {
+        std::cerr << name << " takes an array of numbers" << std::endl;
+        return nullptr;
+    }
+    if (isBitArray(arr)) {
+        std::cerr << name << " cannot reorder the bits of a boolean array" << std::endl;
+        return nullptr;
+    }
+    size_t arity = name == "sort" || name == "stableSort" ? 1 : 2;
+    if (call.params.size() != arity && call.params.size() != arity + 1) {
+        std::cerr << "Wrong number of arguments to " << name << std::endl;
+        return nullptr;
+    }
+    std::vector<llvm::Value *> values;
+    for (size_t i = 1; i < call.params.size(); i++) {
+        values.push_back(call.params[i]->codeGen(*this));
+        if (!values.back()) return nullptr;
+    }
+    auto data = builder.CreatePointerCast(arrayPointer(arr), builder.getInt8PtrTy());
+    llvm::Value *count = builder.CreateSExt(elementCount(arr), builder.getInt64Ty());
+    if (call.params.size() > arity) {
+        /* only the first n elements, never more than there are */
+        auto limit = castTo(values.back(), builder.getInt64Ty());
+        count = builder.CreateSelect(builder.CreateICmpSLT(limit, count), limit, count, "count");
+    }
+    auto elemType = arr->dType;
+    auto isByte = elemType->isIntegerTy(8);
+    if (name == "binarySearch") {
+        auto key = castTo(values[0], elemType);
+        auto suffix = isByte ? "char" : elemType->isIntegerTy() ? "int" : elemType->isFloatTy() ? "float" : "double";
+        auto fType = llvm::FunctionType::get(builder.getInt32Ty(), {builder.getInt8PtrTy(), builder.getInt64Ty(),
+                                                                    key->getType()}, false);
+        auto search = module->getOrInsertFunction(std::string("phemia_search_") + suffix, fType);
+        return builder.CreateCall(search, {data, count, key}, "found");
+    }
+    auto kind = builder.getInt32(isByte ? PHEMIA_SORT_CHAR : elemType->isIntegerTy() ? PHEMIA_SORT_INT
+                                 : elemType->isFloatTy() ? PHEMIA_SORT_FLOAT : PHEMIA_SORT_DOUBLE);
+    auto front = name == "partialSort" ? castTo(values[0], builder.getInt64Ty()) : count;
+    auto fType = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt8PtrTy(), builder.getInt64Ty(),
+                                                               builder.getInt64Ty(), builder.getInt32Ty()}, false);
+    auto sort = module->getOrInsertFunction("phemia_partial_sort", fType);
+    return builder.CreateCall(sort, {data, count, front, kind});
+}
+
+llvm::Value *ARStack::reduceBuiltin(NFunctionCall &call) {
+    auto &name = call.id.name;
+    size_t arity = name == "dot" ? 2 : 1;
+    if (call.params.size() != arity && call.params.size() != arity + 2) {
+        std::cerr << "Wrong number of arguments to " << name << std::endl;
+        return nullptr;
+    }
+    std::vector<VariableRecord *> arrays;
+    for (size_t i = 0; i < arity; i++) {
+        auto arr = arrayOperand(call.params[i]);
+        if (!arr || !arr->value || isBitArray(arr) || (i && arr->dType != arrays[0]->dType)) {
+            std::cerr << name << " takes " << (arity == 2 ? "two arrays" : "an array") << " of numbers" << std::endl;
+            return nullptr;
+        }
+        arrays.push_back(arr);
+    }
+    llvm::Value *count = elementCount(arrays[0]);
+    if (name == "dot") {
+        auto other = elementCount(arrays[1]);
+        count = builder.CreateSelect(builder.CreateICmpSLT(other, count), other, count, "count");
+    }
+    llvm::Value *from = builder.getInt32(0);
+    if (call.params.size() > arity) {
+        /* [from, to) clamped to the elements there are, empty when to is not past from */
+        auto bound = [&](NExpression *param, llvm::Value *low) -> llvm::Value * {
+            auto val = param->codeGen(*this);
+            if (!val) return nullptr;
+            val = castTo(val, builder.getInt32Ty());
+            val = builder.CreateSelect(builder.CreateICmpSLT(val, count), val, count);
+            return builder.CreateSelect(builder.CreateICmpSLT(val, low), low, val);
+        };
+        from = bound(call.params[arity], builder.getInt32(0));
+        auto to = from ? bound(call.params[arity + 1], from) : nullptr;
+        if (!to) return nullptr;
+        count = builder.CreateSub(to, from, "count");
+    }
+
+    auto elemType = arrays[0]->dType;
+    auto suffix = elemType->isIntegerTy(8) ? "char" : elemType->isIntegerTy() ? "int"
+                  : elemType->isFloatTy() ? "float" : "double";
+    std::vector<llvm::Value *> args;
+    for (auto arr: arrays) args.push_back(builder.CreateInBoundsGEP(elemType, arrayPointer(arr), from));
+    args.push_back(builder.CreateSExt(count, builder.getInt64Ty()));
+    if (name == "sum" || name == "min" || name == "max") {
+        args.push_back(builder.getInt32(name == "sum" ? PHEMIA_SUM : name == "min" ? PHEMIA_MIN : PHEMIA_MAX));
+    }
+    args.push_back(builder.getInt32(reassociate));
+    std::vector<llvm::Type *> params;
+    for (auto arg: args) params.push_back(arg->getType());
+    /* chars are summed and returned as ints */
+    auto result = name == "scan" ? builder.getVoidTy() : elemType->isIntegerTy() ? builder.getInt32Ty() : elemType;
+    std::string routine = name == "dot" ? "phemia_dot_" : name == "scan" ? "phemia_scan_" : "phemia_reduce_";
+    auto callee = module->getOrInsertFunction(routine + suffix, llvm::FunctionType::get(result, params, false));
+    if (name == "scan") return builder.CreateCall(callee, args);
+    auto value = builder.CreateCall(callee, args, name);
+    if (elemType->isIntegerTy(8) && (name == "min" || name == "max")) return builder.CreateTrunc(value, elemType);
+    return value;
+}
+
+/*
+ * popcount over 256 bit vectors of words, firstSet skipping four zero words at a time. Bits past the
+ * last element are masked off, a mapped file may have set them.
+ */
+llvm::Value *ARStack::bitsBuiltin(NFunctionCall &call) {
+    auto &name = call.id.name;
+    auto arr = call.params.size() == 1 ? arrayOperand(call.params[0]) : nullptr;
+    if (!arr || !arr->value || !isBitArray(arr)) {
+        std::cerr << name << " takes a boolean array" << std::endl;
+        return nullptr;
+    }
+    auto wordType = builder.getInt64Ty();
+    auto align = llvm::MaybeAlign(8);
+    const unsigned lanes = 4;
+    auto vecType = llvm::FixedVectorType::get(wordType, lanes);
+    auto count = elementCount(arr);
+    auto words = bitWords(count);
+    auto data = arrayPointer(arr);
+    auto wordAt = [&](llvm::Value *i, llvm::Type *type) {
+        auto ptr = builder.CreateInBoundsGEP(wordType, data, i);
+        return builder.CreateAlignedLoad(type, builder.CreateBitCast(ptr, type->getPointerTo()), align);
+    };
+    /* the last word with bits past the end cleared */
+    auto lastWord = [&]() {
+        auto last = wordAt(builder.CreateSub(words, builder.getInt32(1)), wordType);
+        auto tail = builder.CreateZExt(builder.CreateAnd(count, builder.getInt32(63)), wordType);
+        auto keep = builder.CreateSelect(builder.CreateICmpEQ(tail, builder.getInt64(0)), builder.getInt64(~0ull),
+                                         builder.CreateSub(builder.CreateShl(builder.getInt64(1), tail),
+                                                           builder.getInt64(1)));
+        return builder.CreateAnd(last, keep, "lastWord");
+    };
+
+    auto function = builder.GetInsertBlock()->getParent();
+    auto preheader = builder.GetInsertBlock();
+    auto vecCond = llvm::BasicBlock::Create(llvmContext, "vecCond", function);
+    auto vecBody = llvm::BasicBlock::Create(llvmContext, "vecBody", function);
+    auto remCond = llvm::BasicBlock::Create(llvmContext, "remCond", function);
+    auto remBody = llvm::BasicBlock::Create(llvmContext, "remBody", function);
+    auto done = llvm::BasicBlock::Create(llvmContext, "afterBits", function);
+    std::vector<llvm::BasicBlock *> blocks{vecCond, vecBody, remCond, remBody, done};
+    /* popcount takes whole words in its loops and the last one masked after them */
+    auto full = builder.CreateLShr(count, 6, "fullWords");
+    auto vecEnd = builder.CreateAnd(name == "popcount" ? full : words, builder.getInt32(~(lanes - 1)), "vecEnd");
+
+    builder.CreateBr(vecCond);
+    builder.SetInsertPoint(vecCond);
+    auto i = builder.CreatePHI(builder.getInt32Ty(), 2, "i");
+    i->addIncoming(builder.getInt32(0), preheader);
+    llvm::Value *result;
+    if (name == "popcount") {
+        auto sums = builder.CreatePHI(vecType, 2, "sums");
+        sums->addIncoming(llvm::Constant::getNullValue(vecType), preheader);
+        auto vecDone = llvm::BasicBlock::Create(llvmContext, "vecDone", function);
+        blocks.push_back(vecDone);
+        builder.CreateCondBr(builder.CreateICmpSLT(i, vecEnd), vecBody, vecDone);
+
+        builder.SetInsertPoint(vecBody);
+        auto bits = builder.CreateCall(intrinsic(llvm::Intrinsic::ctpop, {vecType}), {wordAt(i, vecType)});
+        sums->addIncoming(builder.CreateAdd(sums, bits), vecBody);
+        i->addIncoming(builder.CreateAdd(i, builder.getInt32(lanes)), vecBody);
+        builder.CreateBr(vecCond);
+
+        builder.SetInsertPoint(vecDone);
+        auto vecTotal = builder.CreateAddReduce(sums);
+        builder.CreateBr(remCond);
+
+        builder.SetInsertPoint(remCond);
+        auto j = builder.CreatePHI(builder.getInt32Ty(), 2, "j");
+        j->addIncoming(i, vecDone);
+        auto total = builder.CreatePHI(wordType, 2, "total");
+        total->addIncoming(vecTotal, vecDone);
+        builder.CreateCondBr(builder.CreateICmpSLT(j, full), remBody, done);
+
+        builder.SetInsertPoint(remBody);
+        auto ctpop = intrinsic(llvm::Intrinsic::ctpop, {wordType});
+        total->addIncoming(builder.CreateAdd(total, builder.CreateCall(ctpop, {wordAt(j, wordType)})), remBody);
+        j->addIncoming(builder.CreateAdd(j, builder.getInt32(1)), remBody);
+        builder.CreateBr(remCond);
+
+        builder.SetInsertPoint(done);
+        auto partial = llvm::BasicBlock::Create(llvmContext, "partialWord", function);
+        auto counted = llvm::BasicBlock::Create(llvmContext, "counted", function);
+        blocks.push_back(partial);
+        blocks.push_back(counted);
+        builder.CreateCondBr(builder.CreateICmpULT(full, words), partial, counted);
+        builder.SetInsertPoint(partial);
+        auto withLast = builder.CreateAdd(total, builder.CreateCall(ctpop, {lastWord()}));
+        builder.CreateBr(counted);
+        builder.SetInsertPoint(counted);
+        auto sum = builder.CreatePHI(wordType, 2, "popcount");
+        sum->addIncoming(total, done);
+        sum->addIncoming(withLast, partial);
+        result = builder.CreateTrunc(sum, builder.getInt32Ty());
+    } else {
+        /* four words at a time until one of them is not zero, then word by word from there */
+        builder.CreateCondBr(builder.CreateICmpSLT(i, vecEnd), vecBody, remCond);
+
+        builder.SetInsertPoint(vecBody);
+        auto any = builder.CreateICmpNE(builder.CreateOrReduce(wordAt(i, vecType)), builder.getInt64(0));
+        auto next = builder.CreateAdd(i, builder.getInt32(lanes));
+        i->addIncoming(next, vecBody);
+        builder.CreateCondBr(any, remCond, vecCond);
+
+        builder.SetInsertPoint(remCond);
+        auto j = builder.CreatePHI(builder.getInt32Ty(), 3, "j");
+        j->addIncoming(i, vecCond);
+        j->addIncoming(i, vecBody);
+        auto found = llvm::BasicBlock::Create(llvmContext, "foundWord", function);
+        blocks.push_back(found);
+        builder.CreateCondBr(builder.CreateICmpSLT(j, words), remBody, done);
+
+        builder.SetInsertPoint(remBody);
+        auto isLast = builder.CreateICmpEQ(j, builder.CreateSub(words, builder.getInt32(1)));
+        auto word = builder.CreateSelect(isLast, lastWord(), wordAt(j, wordType), "word");
+        j->addIncoming(builder.CreateAdd(j, builder.getInt32(1)), remBody);
+        builder.CreateCondBr(builder.CreateICmpNE(word, builder.getInt64(0)), found, remCond);
+
+        builder.SetInsertPoint(found);
+        auto cttz = intrinsic(llvm::Intrinsic::cttz, {wordType});
+        auto bit = builder.CreateTrunc(builder.CreateCall(cttz, {word, builder.getTrue()}), builder.getInt32Ty());
+        auto index = builder.CreateAdd(builder.CreateShl(j, 6), bit);
+        builder.CreateBr(done);
+
+        builder.SetInsertPoint(done);
+        auto first = builder.CreatePHI(builder.getInt32Ty(), 2, "firstSet");
+        first->addIncoming(builder.getInt32(-1), remCond);
+        first->addIncoming(index, found);
+        result = first;
+    }
+    for (auto bb: blocks) sealBlock(bb);
+    return result;
+}
+
+llvm::Value *ARStack::mappedArray(NFunctionCall &call, llvm::ArrayType *arrType) {
+    if (call.params.empty() || call.params.size() > 2) {
+        std::cerr << "Wrong number of arguments to mapFile" << std::endl;
+        return nullptr;
+    }
+    auto path = call.params[0]->codeGen(*this);
+    if (!path) return nullptr;
+    llvm::Value *copyOnWrite = builder.getInt32(0);
+    if (call.params.size() == 2) {
+        auto flag = call.params[1]->codeGen(*this);
+        if (!flag) return nullptr;
+        copyOnWrite = builder.CreateZExt(castTo(flag, builder.getInt1Ty()), builder.getInt32Ty());
+    }
+    auto bytes = module->getDataLayout().getTypeAllocSize(arrType).getFixedSize();
+    auto fType = llvm::FunctionType::get(builder.getInt8PtrTy(), {builder.getInt8PtrTy(), builder.getInt64Ty(),
+                                                                  builder.getInt32Ty()}, false);
+    auto map = module->getOrInsertFunction("phemia_mapped_file", fType);
+    auto data = builder.CreateCall(map, {builder.CreatePointerCast(path, builder.getInt8PtrTy()),
+                                         builder.getInt64(bytes), copyOnWrite}, "mapped");
+    return builder.CreateBitCast(data, arrType->getElementType()->getPointerTo());
+}
+
+llvm::Value *NNewObject::codeGen(ARStack &context) {
+    std::smatch result;
+    if (std::regex_match(type.name, result, context.mapTypeName)) {
+        auto fType = llvm::FunctionType::get(context.builder.getInt8PtrTy(), {context.builder.getInt32Ty()}, false);
+        auto create = context.module->getOrInsertFunction("phemia_map_new", fType);
+        context.allocationSite();
+        auto map = context.builder.CreateCall(create, {context.builder.getInt32(result[1] == "string")}, "map");
+        return context.builder.CreateBitCast(map, context.typeOf(type.name), type.name);
+    }
+    auto it = context.classes.find(type.name);
+    if (it == context.classes.end()) {
+        std::cerr << "Unknown class: " << type.name << std::endl;
+        return nullptr;
+    }
+    auto cls = it->second;
+    auto object = context.builder.CreateBitCast(context.gcAlloc(cls->type, cls->refs), cls->type->getPointerTo(),
+                                                type.name);
+    bool initialized = std::any_of(cls->decl->fields.begin(), cls->decl->fields.end(),
+                                   [](NVariableDeclaration *field) { return field->assignmentExpr != nullptr; });
+    if (!initialized) return object;
+    /* an initializer may allocate and collect, nothing else refers to the object until it returns */
+    auto ptrType = context.builder.getInt8PtrTy();
+    auto root = context.createEntryAlloca(ptrType, "newRoot");
+    context.current()->gcRoots.push_back(root);
+    context.builder.CreateStore(context.builder.CreatePointerCast(object, ptrType), root);
+    for (auto field: cls->decl->fields) {
+        if (!field->assignmentExpr) continue;
+        auto index = cls->fields[field->id.name];
+        auto val = context.castTo(field->assignmentExpr->codeGen(context), cls->type->getElementType(index));
+        context.builder.CreateAlignedStore(val, context.builder.CreateStructGEP(cls->type, object, index),
+                                           context.fieldAlign(cls, index));
+    }
+    context.builder.CreateStore(llvm::ConstantPointerNull::get(ptrType), root);
+    return object;
+}
+
+llvm::Value *NMemberAccess::codeGen(ARStack &context) {
+    ClassInfo *cls;
+    auto ptr = context.memberPointer(object, arrayIndices, member.name, cls);
+    if (!ptr) return nullptr;
+    auto index = cls->fields[member.name];
+    return context.builder.CreateAlignedLoad(cls->type->getElementType(index), ptr, context.fieldAlign(cls, index),
+                                             member.name);
+}
+
+llvm::Value *NMethodCall::codeGen(ARStack &context) {
+    auto cls = context.columnClass(object, arrayIndices);
+    VariableRecord *arr = nullptr;
+    llvm::Value *element = nullptr;
+    llvm::Value *self;
+    if (cls) {
+        /* an element of a soa array is no object of its own: the method gets a copy, written back after the call */
+        arr = context.get(object.name);
+        element = context.elementIndex(arr, *arrayIndices);
+        self = context.createEntryAlloca(cls->type, "element");
+    } else {
+        self = context.objectPointer(object, arrayIndices, cls);
+        if (!self) return nullptr;
+    }
+    auto function = context.module->getFunction(cls->name + "." + call.id.name);
+    if (!function) {
+        std::cerr << "No method " << call.id.name << " in class " << cls->name << std::endl;
+        return nullptr;
+    }
+    if (function->arg_size() != call.params.size() + 1) {
+        std::cerr << "Wrong number of arguments to " << cls->name << "." << call.id.name << std::endl;
+        return nullptr;
+    }
+    std::vector<llvm::Value *> args{self};
+    for (auto item: call.params) {
+        auto val = item->codeGen(context);
+        if (!val) return nullptr;
+        args.push_back(context.castTo(val, function->getArg(args.size())->getType()));
+    }
+    auto copy = [&](bool toObject) {
+        for (unsigned k = 0; arr && k < cls->type->getNumElements(); k++) {
+            auto column = context.columnPointer(arr, cls, element, k);
+            auto field = context.builder.CreateStructGEP(cls->type, self, k);
+            auto from = toObject ? column : field;
+            auto value = context.builder.CreateAlignedLoad(cls->type->getElementType(k), from,
+                                                           context.fieldAlign(cls, k));
+            context.builder.CreateAlignedStore(value, toObject ? field : column, context.fieldAlign(cls, k));
+        }
+    };
+    copy(true);
+    auto result = context.builder.CreateCall(function, args,
+                                             function->getFunctionType()->getReturnType()->isVoidTy() ? "" : "call");
+    copy(false);
+    return result;
+}
+
 llvm::Value *NFunctionCall::codeGen(ARStack &context) {
+    /* float4(x) broadcasts x, float4(a, b, c, d) sets each lane */
+    if (auto vecType = llvm::dyn_cast<llvm::FixedVectorType>(context.typeOf(id.name))) {
+        auto lanes = vecType->getNumElements();
+        auto elemType = vecType->getElementType();
+        if (params.size() != 1 && params.size() != lanes) {
+            std::cerr << id.name << " takes 1 or " << lanes << " values" << std::endl;
+            return nullptr;
+        }
+        std::vector<llvm::Value *> values;
+        for (auto item: params) {
+            auto val = item->codeGen(context);
+            if (!val) return nullptr;
+            values.push_back(context.castTo(val, elemType));
+        }
+        if (values.size() == 1) return context.builder.CreateVectorSplat(lanes, values[0], id.name);
+        llvm::Value *vec = llvm::UndefValue::get(vecType);
+        for (unsigned i = 0; i < lanes; i++) {
+            vec = context.builder.CreateInsertElement(vec, values[i], i);
+        }
+        return vec;
+    }
+
     llvm::Function *function = context.module->getFunction(id.name);
+    if (function == nullptr && (id.name == "has" || id.name == "remove" || id.name == "size")) {
+        return context.mapBuiltin(*this);
+    }
+    if (function == nullptr && (id.name == "sort" || id.name == "stableSort" || id.name == "partialSort" ||
+                                id.name == "binarySearch")) {
+        return context.sortBuiltin(*this);
+    }
+    if (function == nullptr && (id.name == "sum" || id.name == "min" || id.name == "max" || id.name == "dot" ||
+                                id.name == "scan")) {
+        return context.reduceBuiltin(*this);
+    }
+    if (function == nullptr && (id.name == "popcount" || id.name == "firstSet")) return context.bitsBuiltin(*this);
     if (function == nullptr) {
         std::cerr << "no such function " << id.name << std::endl;
     }
     std::vector<llvm::Value *> args;
 
-    auto *tmp = new std::vector<uint32_t>();
-    bool flag = false;
-    for (auto item: params) {
+    /* calls with constant array shapes go to a clone specialized on them, others pass the extents */
+    NFunctionDeclaration *generic = nullptr;
+    auto genericIt = context.genericFunctions.find(id.name);
+    if (genericIt != context.genericFunctions.end() && genericIt->second.first->arguments.size() == params.size()) {
+        generic = genericIt->second.first;
+        std::vector<std::vector<uint32_t> *> shapes;
+        std::string key = id.name;
+        bool isStatic = true;
+        for (size_t i = 0; i < params.size(); i++) {
+            if (!generic->arguments[i]->type.getArrayDim()) {
+                shapes.push_back(nullptr);
+                continue;
+            }
+            auto argId = dynamic_cast<NIdentifier *>(params[i]);
+            auto arr = argId ? context.get(argId->name) : nullptr;
+            if (!arr || !arr->size) {
+                std::cerr << "Array expected as argument " << i << " of " << id.name << std::endl;
+                return nullptr;
+            }
+            key += i == 0 ? "." : "_";
+            for (size_t k = 0; k < arr->size->size(); k++) {
+                if ((*arr->size)[k] == 0 || (k < arr->dims.size() && arr->dims[k])) isStatic = false;
+                key += (k == 0 ? "" : "x") + std::to_string((*arr->size)[k]);
+            }
+            shapes.push_back(arr->size);
+        }
+        if (isStatic) {
+            auto spec = context.specializations.find(key);
+            function = spec != context.specializations.end() ? spec->second : context.specialize(id.name, key, shapes);
+            generic = nullptr;
+        }
+    }
+
+    /* scanf writes through its arguments: SSA scalars are spilled to a slot around the call, globals go as they are */
+    std::vector<std::pair<VariableRecord *, llvm::Value *>> spilled;
+    for (size_t i = 0; i < params.size(); i++) {
+        auto item = params[i];
         if (id.name == "scanf" && item != params[0]) {
             auto target = context.get(dynamic_cast<NIdentifier *>(item)->name);
-            if (!target->size) {
-                context.get(dynamic_cast<NIdentifier *>(item)->name)->size = tmp;
-                flag = true;
+            if (target->isSSA) {
+                auto slot = context.createEntryAlloca(target->dType, dynamic_cast<NIdentifier *>(item)->name);
+                context.builder.CreateStore(context.readVariable(target, context.builder.GetInsertBlock()), slot);
+                spilled.emplace_back(target, slot);
+                args.push_back(slot);
+                continue;
+            } else if (!target->size) {
+                args.push_back(target->value);
+                continue;
             }
         }
         auto val = item->codeGen(context);
@@ -614,15 +2666,65 @@ llvm::Value *NFunctionCall::codeGen(ARStack &context) {
                     val, val->getType()->getPointerElementType()->getArrayElementType()->getPointerTo());
         }
         args.push_back(val);
-        if (id.name == "scanf" && item != params[0] && flag) {
-            flag = false;
-            context.get(dynamic_cast<NIdentifier *>(item)->name)->size = nullptr;
+        if (generic && generic->arguments[i]->type.getArrayDim()) {
+            auto arr = context.get(dynamic_cast<NIdentifier *>(item)->name);
+            auto arrDim = generic->arguments[i]->type.getArrayDim();
+            for (size_t k = 0; k < arrDim->size(); k++) {
+                if (*(*arrDim)[k] == "0") args.push_back(context.arrayDim(arr, k));
+            }
+        }
+    }
+
+    /* strCopy and readLine are told the size of the char array they fill */
+    if ((id.name == "strCopy" || id.name == "readLine") && !params.empty()) {
+        auto target = context.get(dynamic_cast<NIdentifier *>(params[0])->name);
+        args.push_back(target && target->size ? context.elementCount(target) : context.builder.getInt32(0));
+    }
+
+    /* a pure function called with constants runs now, its result is baked into the module */
+    if (context.pureFunctions.count(function)) {
+        std::vector<llvm::Constant *> constants;
+        for (auto arg: args) {
+            if (llvm::isa<llvm::ConstantInt>(arg) || llvm::isa<llvm::ConstantFP>(arg)) {
+                constants.push_back(llvm::cast<llvm::Constant>(arg));
+            }
         }
+        if (constants.size() == args.size()) {
+            if (auto folded = context.constEval.evaluate(function, constants)) return folded;
+        }
+    }
+
+    /* a literal format is split at compile time rather than interpreted by libc on every call */
+    llvm::Value *call = nullptr;
+    if (awaited && (id.name == "scanf" || id.name == "gets")) {
+        call = context.awaitIO(function, params.empty() ? nullptr : params[0], args);
+    }
+    if (!call && (id.name == "printf" || id.name == "scanf") && !params.empty()) {
+        call = context.emitFormattedIO(id.name, params[0], args);
     }
-    delete tmp;
+    if (!call) {
+        call = context.builder.CreateCall(function, args,
+                                          function->getFunctionType()->getReturnType()->isVoidTy() ? "" : "call");
+    }
+    for (auto &entry: spilled) {
+        context.writeVariable(entry.first, context.builder.GetInsertBlock(),
+                              context.builder.CreateLoad(entry.first->dType, entry.second, "reload"));
+    }
+    return call;
+}
 
-    return context.builder.CreateCall(function, args,
-                                      function->getFunctionType()->getReturnType()->isVoidTy() ? "" : "call");
+llvm::Value *NAwait::codeGen(ARStack &context) {
+    auto call = dynamic_cast<NFunctionCall *>(expression);
+    if (call && (call->id.name == "scanf" || call->id.name == "gets")) {
+        call->awaited = true;
+        return call->codeGen(context);
+    }
+    auto handle = expression->codeGen(context);
+    if (!handle) return nullptr;
+    /* a task variable only knows it is a task, a call also says where its result is */
+    auto started = llvm::dyn_cast<llvm::CallInst>(handle);
+    auto promise = started ? context.promises.find(started->getCalledFunction()) : context.promises.end();
+    return context.awaitTask(handle, promise != context.promises.end() ? promise->second : nullptr);
 }
 
 llvm::Value *NArrayElement::codeGen(ARStack &context) {
@@ -631,34 +2733,53 @@ llvm::Value *NArrayElement::codeGen(ARStack &context) {
         std::cerr << "Undeclared value: " << id.name << std::endl;
         return nullptr;
     }
+    if (!arr->size && arr->dType->isVectorTy() && arrayIndices.size() == 1) {
+        auto lane = context.castTo(arrayIndices[0]->codeGen(context), context.typeOf("int"));
+        return context.builder.CreateExtractElement(context.loadVariable(arr), lane);
+    }
+    bool stringKeys;
+    llvm::Type *valueType;
+    if (!arr->size && context.mapTypeOf(arr->dType, stringKeys, valueType) && arrayIndices.size() == 1) {
+        auto map = context.loadVariable(arr);
+        auto slot = context.mapCall("find", context.builder.getInt8PtrTy(), map, arrayIndices[0], stringKeys);
+        if (!slot) return nullptr;
+        return context.builder.CreateLoad(valueType, context.builder.CreateBitCast(slot, valueType->getPointerTo()),
+                                          id.name);
+    }
     if (!arr->size) {
         std::cerr << "Unindexable value: " << id.name << std::endl;
         return nullptr;
     }
 
 //    assert(arrayIndices.size() == arr->size->size());
-    auto arrDim = *(arr->size);
-    auto exp = *(arrayIndices.rbegin());
-    for (unsigned i = arrayIndices.size() - 1; i >= 1; i--) {
-        auto tmp = new NBinaryOperator(new NInteger(std::to_string(arrDim[i])), MUL, arrayIndices[i - 1]);
-        exp = new NBinaryOperator(exp, PLUS, tmp);
+    auto idx = context.elementIndex(arr, arrayIndices);
+    if (auto cls = context.columnClass(id, &arrayIndices)) {
+        /* the object gathered from its columns */
+        llvm::Value *object = llvm::UndefValue::get(cls->type);
+        for (unsigned k = 0; k < cls->type->getNumElements(); k++) {
+            auto field = context.builder.CreateAlignedLoad(cls->type->getElementType(k),
+                                                           context.columnPointer(arr, cls, idx, k),
+                                                           context.fieldAlign(cls, k));
+            object = context.builder.CreateInsertValue(object, field, k);
+        }
+        return object;
+    }
+    if (ARStack::isBitArray(arr)) {
+        llvm::Value *mask;
+        auto ptr = context.bitAddress(arr, idx, mask);
+        auto word = context.builder.CreateAlignedLoad(context.builder.getInt64Ty(), ptr, llvm::MaybeAlign(8));
+        return context.builder.CreateICmpNE(context.builder.CreateAnd(word, mask), context.builder.getInt64(0), id.name);
     }
-    auto idx = exp->codeGen(context);
+    auto data = context.arrayPointer(arr);
     std::vector<llvm::Value *> arrV;
-    if (!arr->value->getType()->isPointerTy())
+    if (!data->getType()->isPointerTy())
         arrV.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(context.llvmContext), 0));
     arrV.push_back(idx);
-    auto ptr = context.builder.CreateInBoundsGEP(arr->value, llvm::makeArrayRef(arrV), "elementPtr");
+    auto ptr = context.builder.CreateInBoundsGEP(data, llvm::makeArrayRef(arrV), "elementPtr");
     return context.builder.CreateAlignedLoad(ptr, llvm::MaybeAlign(4));
 }
 
 llvm::Value *NIfStatement::codeGen(ARStack &context) {
-    llvm::Value *condValue = condition->codeGen(context);
-    if (!condValue)
-        return nullptr;
-
-    condValue = context.castToBoolean(condValue);
-
     llvm::Function *function = context.builder.GetInsertBlock()->getParent(); // the function where if statement is in
 
     llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(context.llvmContext, "then", function);
@@ -667,11 +2788,10 @@ llvm::Value *NIfStatement::codeGen(ARStack &context) {
         elseBB = llvm::BasicBlock::Create(context.llvmContext, "else", function);
     llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(context.llvmContext, "afterIf", function);
 
-    if (elseBlock) {
-        context.builder.CreateCondBr(condValue, thenBB, elseBB);
-    } else {
-        context.builder.CreateCondBr(condValue, thenBB, afterBB);
-    }
+    if (!context.emitCondBr(condition, thenBB, elseBlock ? elseBB : afterBB))
+        return nullptr;
+    if (elseBlock) context.sealBlock(elseBB);
+    context.sealBlock(thenBB);
 
     context.builder.SetInsertPoint(thenBB);
     this->thenBlock->codeGen(context);
@@ -684,11 +2804,88 @@ llvm::Value *NIfStatement::codeGen(ARStack &context) {
         context.builder.CreateBr(afterBB);
     }
 
+    context.sealBlock(afterBB);
     context.builder.SetInsertPoint(afterBB);
     return nullptr;
 }
 
+llvm::Value *NSwitchStatement::codeGen(ARStack &context) {
+    llvm::Value *condValue = condition->codeGen(context);
+    if (!condValue)
+        return nullptr;
+    if (!condValue->getType()->isIntegerTy()) {
+        diagnostics.error(line, 0, "switch on non-integer value");
+        return nullptr;
+    }
+
+    /* every label is checked before any block exists, so a bad switch leaves nothing half built */
+    std::vector<llvm::ConstantInt *> labels;
+    std::set<int64_t> seen;
+    bool hasDefault = false;
+    bool valid = true;
+    for (auto item: cases) {
+        if (!item->value) {
+            labels.push_back(nullptr);
+            if (hasDefault) {
+                diagnostics.error(item->block->line, 0, "multiple default labels in switch");
+                valid = false;
+            }
+            hasDefault = true;
+            continue;
+        }
+        auto label = llvm::dyn_cast_or_null<llvm::ConstantInt>(item->value->codeGen(context));
+        if (!label) {
+            diagnostics.error(item->value->line, 0, "case label is not an integer constant");
+            valid = false;
+            labels.push_back(nullptr);
+            continue;
+        }
+        label = llvm::cast<llvm::ConstantInt>(llvm::ConstantExpr::getIntegerCast(label, condValue->getType(), true));
+        if (!seen.insert(label->getSExtValue()).second) {
+            diagnostics.error(item->value->line, 0, "duplicate case label " + std::to_string(label->getSExtValue()));
+            valid = false;
+        }
+        labels.push_back(label);
+    }
+    if (!valid) return nullptr;
+
+    llvm::Function *function = context.builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *after = llvm::BasicBlock::Create(context.llvmContext, "afterSwitch", function);
+    llvm::BasicBlock *defaultBB = after;
+    std::vector<llvm::BasicBlock *> blocks;
+    for (auto item: cases) {
+        blocks.push_back(llvm::BasicBlock::Create(context.llvmContext, item->value ? "case" : "default", function));
+        if (!item->value) defaultBB = blocks.back();
+    }
+
+    /* the backend turns dense labels into a jump table and sparse ones into a balanced compare tree */
+    auto inst = context.builder.CreateSwitch(condValue, defaultBB, cases.size());
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (labels[i]) inst->addCase(labels[i], blocks[i]);
+    }
+
+    /* break leaves the switch, continue still belongs to the enclosing loop */
+    context.inLoop++;
+    auto prevMerge = context.curMerge;
+    context.curMerge = after;
+
+    /* cases fall through to the next one in source order */
+    for (size_t i = 0; i < cases.size(); i++) {
+        context.sealBlock(blocks[i]);
+        context.builder.SetInsertPoint(blocks[i]);
+        cases[i]->block->codeGen(context);
+        context.builder.CreateBr(i + 1 < cases.size() ? blocks[i + 1] : after);
+    }
+    context.sealBlock(after);
+    context.builder.SetInsertPoint(after);
+
+    context.curMerge = prevMerge;
+    context.inLoop--;
+    return nullptr;
+}
+
 llvm::Value *NForStatement::codeGen(ARStack &context) {
+    if (context.emitLoopNest(*this)) return nullptr;
     llvm::Function *function = context.builder.GetInsertBlock()->getParent();
 
     llvm::BasicBlock *forLoop = llvm::BasicBlock::Create(context.llvmContext, "forLoop", function);
@@ -708,10 +2905,12 @@ llvm::Value *NForStatement::codeGen(ARStack &context) {
     block->codeGen(context);
     if (inc) inc->codeGen(context);
     context.builder.CreateBr(forCond);
+    context.sealBlock(forCond);
 
     context.builder.SetInsertPoint(forCond);
-    auto condVal = context.castToBoolean(condition->codeGen(context));
-    context.builder.CreateCondBr(condVal, forLoop, after);
+    context.emitCondBr(condition, forLoop, after);
+    context.sealBlock(forLoop);
+    context.sealBlock(after);
 
     context.builder.SetInsertPoint(after);
 
@@ -738,10 +2937,12 @@ llvm::Value *NWhileStatement::codeGen(ARStack &context) {
     context.builder.SetInsertPoint(whileLoop);
     block->codeGen(context);
     context.builder.CreateBr(whileCond);
+    context.sealBlock(whileCond);
 
     context.builder.SetInsertPoint(whileCond);
-    auto condVal = context.castToBoolean(condition->codeGen(context));
-    context.builder.CreateCondBr(condVal, whileLoop, after);
+    context.emitCondBr(condition, whileLoop, after);
+    context.sealBlock(whileLoop);
+    context.sealBlock(after);
 
     context.builder.SetInsertPoint(after);
 
@@ -768,10 +2969,12 @@ llvm::Value *NDoWhileStatement::codeGen(ARStack &context) {
     context.builder.SetInsertPoint(whileLoop);
     block->codeGen(context);
     context.builder.CreateBr(whileCond);
+    context.sealBlock(whileCond);
 
     context.builder.SetInsertPoint(whileCond);
-    auto condVal = context.castToBoolean(condition->codeGen(context));
-    context.builder.CreateCondBr(condVal, whileLoop, after);
+    context.emitCondBr(condition, whileLoop, after);
+    context.sealBlock(whileLoop);
+    context.sealBlock(after);
 
     context.builder.SetInsertPoint(after);
 
@@ -784,6 +2987,7 @@ llvm::Value *NDoWhileStatement::codeGen(ARStack &context) {
 llvm::Value *NBreakStatement::codeGen(ARStack &context) {
     if (context.inLoop) {
         context.builder.CreateBr(context.curMerge);
+        context.startDeadBlock();
     } else {
         std::cerr << "Use break outsize loop!\n";
     }
@@ -791,8 +2995,9 @@ llvm::Value *NBreakStatement::codeGen(ARStack &context) {
 }
 
 llvm::Value *NContinueStatement::codeGen(ARStack &context) {
-    if (context.inLoop) {
+    if (context.inLoop && context.curCond) {
         context.builder.CreateBr(context.curCond);
+        context.startDeadBlock();
     } else {
         std::cerr << "Use continue outsize loop!\n";
     }
@@ -801,26 +3006,26 @@ llvm::Value *NContinueStatement::codeGen(ARStack &context) {
 
 llvm::Value *NIncOperator::codeGen(ARStack &context) {
     auto R = rhs->codeGen(context);
-    auto ptr = context.get(dynamic_cast<NIdentifier *>(rhs)->name)->value;
+    auto var = context.get(dynamic_cast<NIdentifier *>(rhs)->name);
     auto type = R->getType();
     assert(type->isIntegerTy() || type->isDoubleTy() || type->isFloatTy());
     bool isFP = !type->isIntegerTy();
     auto L = isFP ? llvm::ConstantFP::get(type, 1.0) : llvm::ConstantInt::get(type, 1);
     auto res = isFP ? context.builder.CreateFAdd(L, R, "FINC") : context.builder.CreateAdd(L, R, "INC");
 
-    context.builder.CreateStore(res, ptr);
+    context.storeVariable(var, res);
     return isPrefix ? res : R;
 }
 
 llvm::Value *NDecOperator::codeGen(ARStack &context) {
     auto R = rhs->codeGen(context);
-    auto ptr = context.get(dynamic_cast<NIdentifier *>(rhs)->name)->value;
+    auto var = context.get(dynamic_cast<NIdentifier *>(rhs)->name);
     auto type = R->getType();
     assert(type->isIntegerTy() || type->isDoubleTy() || type->isFloatTy());
     bool isFP = !type->isIntegerTy();
     auto L = isFP ? llvm::ConstantFP::get(type, 1.0) : llvm::ConstantInt::get(type, 1);
     auto res = isFP ? context.builder.CreateFSub(R, L, "FDEC") : context.builder.CreateSub(R, L, "DEC");
-    context.builder.CreateStore(res, ptr);
+    context.storeVariable(var, res);
     return isPrefix ? res : R;
 }
 
@@ -0,0 +1,316 @@
+#ifndef PHEMIA_CONSTEVAL_HPP
+#define PHEMIA_CONSTEVAL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "engine.hpp"
+#include "node.h"
+
+/*
+ * Compile-time evaluation of calls to pure functions with constant arguments.
+ *
+ * A function is pure when its result only depends on its scalar arguments: it reads and writes
+ * nothing but its own parameters and locals, and only calls pure functions (no printf/scanf/gets).
+ * Such a call is JIT compiled on its own and run in a forked child, so a trap or an endless loop
+ * costs the compiler at most `budgetMs` and leaves the call to run at runtime instead. Each
+ * (callee, arguments) pair is tried once, a callee that failed is not tried again, and all
+ * evaluations of a compilation share `totalBudgetMs`. Nothing is evaluated while other threads
+ * run, since the child would only get a copy of this one.
+ */
+class ConstEvaluator {
+    struct Scope {
+        std::set<std::string> names;
+    };
+
+    std::vector<Scope> scopes;
+    std::function<bool(const std::string &)> isPureCallee;
+    /* earlier results, nullptr where evaluation failed */
+    std::map<std::pair<llvm::Function *, std::vector<llvm::Constant *>>, llvm::Constant *> memo;
+    /* callees that trapped, ran out of time or could not be compiled on their own */
+    std::set<llvm::Function *> failed;
+    std::chrono::milliseconds spent{0};
+
+public:
+    int budgetMs = 1000;
+    int totalBudgetMs = 3000;
+    /* set where other threads may run without /proc telling so: --stream, the daemon */
+    bool threaded = false;
+
+    /* isPureCallee: whether a call by that name (other than a recursive one) is allowed */
+    bool isPure(NFunctionDeclaration &function, std::function<bool(const std::string &)> isPureCallee) {
+        if (!isScalar(function.type.name) || dynamic_cast<const NArrayType *>(&function.type)) return false;
+        for (auto argument: function.arguments) {
+            if (argument->type.getArrayDim() || !isScalar(argument->type.name)) return false;
+        }
+        this->isPureCallee = [&function, isPureCallee](const std::string &name) {
+            return name == function.id.name || isPureCallee(name);
+        };
+        scopes.assign(1, Scope());
+        for (auto argument: function.arguments) scopes.back().names.insert(argument->id.name);
+        bool pure = visit(&function.block);
+        scopes.clear();
+        return pure;
+    }
+
+    /* callee(args) computed now, or nullptr when that is not possible */
+    llvm::Constant *evaluate(llvm::Function *callee, const std::vector<llvm::Constant *> &args) {
+        auto key = std::make_pair(callee, args);
+        auto known = memo.find(key);
+        if (known != memo.end()) return known->second;
+        if (failed.count(callee) || spent.count() >= totalBudgetMs || otherThreads()) return nullptr;
+        auto start = std::chrono::steady_clock::now();
+        auto result = memo[key] = compute(callee, args);
+        spent += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        return result;
+    }
+
+private:
+    llvm::Constant *compute(llvm::Function *callee, const std::vector<llvm::Constant *> &args) {
+        auto &module = *callee->getParent();
+        auto retType = callee->getReturnType();
+        if (args.size() != callee->arg_size()) return nullptr;
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i]->getType() != callee->getArg(i)->getType()) return nullptr;
+        }
+
+        /* everything the call may reach must be completely emitted; only that is cloned */
+        std::set<const llvm::GlobalValue *> reachable;
+        std::vector<llvm::Function *> work{callee};
+        std::vector<const llvm::Constant *> constants;
+        auto reach = [&](const llvm::Value *operand) {
+            if (auto function = llvm::dyn_cast<llvm::Function>(operand)) {
+                work.push_back(const_cast<llvm::Function *>(function));
+            } else if (auto constant = llvm::dyn_cast<llvm::Constant>(operand)) {
+                constants.push_back(constant);
+            }
+        };
+        while (!work.empty() || !constants.empty()) {
+            if (!constants.empty()) {
+                auto constant = constants.back();
+                constants.pop_back();
+                auto global = llvm::dyn_cast<llvm::GlobalVariable>(constant);
+                if (global && !reachable.insert(global).second) continue;
+                if (global && global->hasInitializer()) reach(global->getInitializer());
+                if (!global && !llvm::isa<llvm::GlobalValue>(constant)) {
+                    for (auto &operand: constant->operands()) reach(operand);
+                }
+                continue;
+            }
+            auto function = work.back();
+            work.pop_back();
+            if (!reachable.insert(function).second) continue;
+            if (function->isDeclaration()) {
+                if (!function->isIntrinsic() && !function->getName().startswith("phemia_gc_") &&
+                    !function->getName().startswith("phemia_map_")) {
+                    return nullptr;
+                }
+                continue;
+            }
+            for (auto &bb: *function) {
+                if (!bb.getTerminator()) return nullptr;
+                for (auto &inst: bb) {
+                    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                    if (call && !call->getCalledFunction()) return nullptr;
+                    for (auto &operand: inst.operands()) reach(operand);
+                }
+            }
+        }
+
+        llvm::ValueToValueMapTy vMap;
+        auto clone = llvm::CloneModule(module, vMap, [&reachable](const llvm::GlobalValue *gv) {
+            return reachable.count(gv) != 0;
+        });
+        auto result = new llvm::GlobalVariable(*clone, retType, false, llvm::GlobalValue::ExternalLinkage,
+                                               llvm::Constant::getNullValue(retType), "phemia.result");
+        auto entry = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(module.getContext()), false),
+                                            llvm::GlobalValue::ExternalLinkage, "phemia.eval", clone.get());
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(module.getContext(), "entry", entry));
+        std::vector<llvm::Value *> callArgs(args.begin(), args.end());
+        builder.CreateStore(builder.CreateCall(llvm::cast<llvm::Function>(vMap[callee]), callArgs), result);
+        builder.CreateRetVoid();
+
+        TieredEngine::registerRuntime();
+        std::string err;
+        std::unique_ptr<llvm::ExecutionEngine> engine(llvm::EngineBuilder(std::move(clone))
+                                                              .setErrorStr(&err)
+                                                              .setOptLevel(llvm::CodeGenOpt::None)
+                                                              .create());
+        void (*run)() = nullptr;
+        const char *resultAddr = nullptr;
+        if (engine) {
+            engine->finalizeObject();
+            run = (void (*)()) engine->getFunctionAddress("phemia.eval");
+            resultAddr = (const char *) engine->getGlobalValueAddress("phemia.result");
+        }
+        auto size = module.getDataLayout().getTypeStoreSize(retType).getFixedSize();
+        std::string bytes(size, '\0');
+        if (!run || !resultAddr || !runIsolated(run, resultAddr, &bytes[0], size)) {
+            failed.insert(callee);
+            return nullptr;
+        }
+
+        if (retType->isIntegerTy()) {
+            uint64_t value = 0;
+            std::memcpy(&value, bytes.data(), size);
+            return llvm::ConstantInt::get(retType, value);
+        } else if (retType->isFloatTy()) {
+            float value;
+            std::memcpy(&value, bytes.data(), sizeof(value));
+            return llvm::ConstantFP::get(retType, value);
+        } else if (retType->isDoubleTy()) {
+            double value;
+            std::memcpy(&value, bytes.data(), sizeof(value));
+            return llvm::ConstantFP::get(retType, value);
+        }
+        return nullptr;
+    }
+
+    /* fork() in a process with other threads running only copies this one, whatever locks they held stay taken */
+    bool otherThreads() const {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 8, "Threads:") == 0) return std::strtol(line.c_str() + 8, nullptr, 10) > 1;
+        }
+        return threaded;
+    }
+
+    static bool isScalar(const std::string &type) {
+        return type == "int" || type == "char" || type == "double" || type == "float" || type == "boolean";
+    }
+
+    bool isLocal(const std::string &name) const {
+        for (auto &scope: scopes) {
+            if (scope.names.count(name)) return true;
+        }
+        return false;
+    }
+
+    bool visitAll(ExpressionList *list) {
+        if (!list) return true;
+        for (auto item: *list) if (!visit(item)) return false;
+        return true;
+    }
+
+    bool visitBlock(NBlock *block) {
+        if (!block) return true;
+        scopes.emplace_back();
+        bool pure = true;
+        for (auto statement: block->statements) {
+            if (!(pure = visit(statement))) break;
+        }
+        scopes.pop_back();
+        return pure;
+    }
+
+    bool visit(Node *node) {
+        if (!node) return true;
+        if (auto block = dynamic_cast<NBlock *>(node)) {
+            return visitBlock(block);
+        } else if (auto statement = dynamic_cast<NExpressionStatement *>(node)) {
+            return visit(statement->expression);
+        } else if (auto ret = dynamic_cast<NReturnStatement *>(node)) {
+            return visit(ret->expression);
+        } else if (auto decl = dynamic_cast<NVariableDeclaration *>(node)) {
+            if (!visit(decl->assignmentExpr)) return false;
+            scopes.back().names.insert(decl->id.name);
+            return true;
+        } else if (auto ifStmt = dynamic_cast<NIfStatement *>(node)) {
+            return visit(ifStmt->condition) && visitBlock(ifStmt->thenBlock) && visitBlock(ifStmt->elseBlock);
+        } else if (auto forStmt = dynamic_cast<NForStatement *>(node)) {
+            return visit(forStmt->init) && visit(forStmt->condition) && visit(forStmt->inc) &&
+                   visitBlock(forStmt->block);
+        } else if (auto whileStmt = dynamic_cast<NWhileStatement *>(node)) {
+            return visit(whileStmt->condition) && visitBlock(whileStmt->block);
+        } else if (auto doWhile = dynamic_cast<NDoWhileStatement *>(node)) {
+            return visitBlock(doWhile->block) && visit(doWhile->condition);
+        } else if (auto switchStmt = dynamic_cast<NSwitchStatement *>(node)) {
+            if (!visit(switchStmt->condition)) return false;
+            for (auto item: switchStmt->cases) {
+                if (!visit(item->value) || !visitBlock(item->block)) return false;
+            }
+            return true;
+        } else if (dynamic_cast<NBreakStatement *>(node) || dynamic_cast<NContinueStatement *>(node)) {
+            return true;
+        } else if (auto element = dynamic_cast<NArrayAssignment *>(node)) {
+            return isLocal(element->lhs.name) && visitAll(&element->arrayIndices) && visit(&element->rhs);
+        } else if (auto field = dynamic_cast<NClassAssignment *>(node)) {
+            return isLocal(field->lhs.name) && visitAll(field->arrayIndices) && visit(&field->rhs);
+        } else if (auto assign = dynamic_cast<NAssignment *>(node)) {
+            return isLocal(assign->lhs.name) && visit(&assign->rhs);
+        } else if (auto binary = dynamic_cast<NBinaryOperator *>(node)) {
+            return visit(binary->lhs) && visit(binary->rhs);
+        } else if (auto unary = dynamic_cast<NUnaryOperator *>(node)) {
+            return visit(unary->rhs);
+        } else if (auto call = dynamic_cast<NFunctionCall *>(node)) {
+            return isPureCallee(call->id.name) && visitAll(&call->params);
+        } else if (auto member = dynamic_cast<NMemberAccess *>(node)) {
+            return isLocal(member->object.name) && visitAll(member->arrayIndices);
+        } else if (auto element = dynamic_cast<NArrayElement *>(node)) {
+            return isLocal(element->id.name) && visitAll(&element->arrayIndices);
+        } else if (auto arr = dynamic_cast<NArray *>(node)) {
+            return visitAll(arr->initList);
+        } else if (auto id = dynamic_cast<NIdentifier *>(node)) {
+            return isLocal(id->name);
+        } else if (dynamic_cast<NNewObject *>(node)) {
+            return true;
+        }
+        /* literals are pure, method calls are not followed */
+        return dynamic_cast<NInteger *>(node) || dynamic_cast<NDouble *>(node) || dynamic_cast<NFloat *>(node) ||
+               dynamic_cast<NChar *>(node) || dynamic_cast<NBoolean *>(node) || dynamic_cast<NString *>(node);
+    }
+
+    /* run `run` in a child process and copy `size` bytes at `resultAddr` back from it */
+    bool runIsolated(void (*run)(), const char *resultAddr, char *out, size_t size) const {
+        int fds[2];
+        if (pipe(fds) != 0) return false;
+        fflush(stdout);
+        fflush(stderr);
+        pid_t child = fork();
+        if (child < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (child == 0) {
+            close(fds[0]);
+            run();
+            bool sent = write(fds[1], resultAddr, size) == (ssize_t) size;
+            _exit(sent ? 0 : 1);
+        }
+        close(fds[1]);
+        size_t got = 0;
+        pollfd pfd{fds[0], POLLIN, 0};
+        auto timeout = (int) std::min<long long>(budgetMs, totalBudgetMs - spent.count());
+        while (got < size && poll(&pfd, 1, timeout) > 0) {
+            auto n = read(fds[0], out + got, size - got);
+            if (n <= 0) break;
+            got += n;
+        }
+        close(fds[0]);
+        if (got < size) kill(child, SIGKILL);
+        int status = 0;
+        waitpid(child, &status, 0);
+        return got == size && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+};
+
+#endif //PHEMIA_CONSTEVAL_HPP
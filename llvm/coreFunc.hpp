@@ -45,9 +45,38 @@ void createGets(ARStack& context) {
     );
     printf->setCallingConv(llvm::CallingConv::C);
 }
+/* name(...) as a small internal function calling its runtime/text.h routine, so calls to it take the usual path */
+void createTextFunction(ARStack& context, const std::string& name, const std::string& runtime,
+                        const std::vector<llvm::Type*>& argTypes) {
+    auto fType = llvm::FunctionType::get(context.typeOf("int"), argTypes, false);
+    auto callee = context.module->getOrInsertFunction(runtime, fType);
+    auto function = llvm::Function::Create(
+            fType, llvm::Function::InternalLinkage,
+            llvm::Twine(name),
+            context.module
+    );
+    function->addFnAttr(llvm::Attribute::AlwaysInline);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context.llvmContext, "entry", function));
+    std::vector<llvm::Value*> args;
+    for (auto& arg: function->args()) args.push_back(&arg);
+    builder.CreateRet(builder.CreateCall(callee, args));
+}
+
+/* strCopy and readLine also get the size of the char array they fill, see NFunctionCall::codeGen */
+void createTextFunctions(ARStack& context) {
+    auto text = context.typeOf("string");
+    auto size = context.typeOf("int");
+    createTextFunction(context, "strLength", "phemia_str_length", {text});
+    createTextFunction(context, "strCompare", "phemia_str_compare", {text, text});
+    createTextFunction(context, "strFind", "phemia_str_find", {text, text});
+    createTextFunction(context, "strCopy", "phemia_str_copy", {text, text, size});
+    createTextFunction(context, "readLine", "phemia_read_line", {text, size});
+}
+
 void createCoreFunction(ARStack& context) {
     createPrintf(context);
     createScanf(context);
     createGets(context);
+    createTextFunctions(context);
 }
 #endif //PHEMIA_COREFUNC_HPP
@@ -0,0 +1,75 @@
+#ifndef PHEMIA_DIAGNOSTICS_HPP
+#define PHEMIA_DIAGNOSTICS_HPP
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Errors of one compilation, collected instead of aborting on the first one. The lexer, the parser
+ * (through bison `error` recovery) and SemanticCheck all report here, and nothing is lowered to
+ * LLVM once an error is known. After `budget` errors reporting stops and the parser gives up, so a
+ * badly broken file cannot produce an endless cascade.
+ */
+class Diagnostics {
+    struct Diagnostic {
+        int line;
+        /* 0 when only the line is known */
+        int column;
+        std::string message;
+    };
+
+    std::vector<Diagnostic> errors;
+    bool truncated = false;
+    /* the parser and the streaming code generator report from different threads */
+    mutable std::mutex mutex;
+
+public:
+    size_t budget = 20;
+
+    void error(int line, int column, const std::string &message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (errors.size() >= budget) {
+            truncated = true;
+            return;
+        }
+        errors.push_back(Diagnostic{line, column, message});
+    }
+
+    size_t count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return errors.size();
+    }
+
+    bool empty() const { return count() == 0; }
+
+    bool exhausted() const { return count() >= budget; }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        errors.clear();
+        truncated = false;
+    }
+
+    /* `file:line:column: error: message`, in source order */
+    void report(std::ostream &out, const std::string &file) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::stable_sort(errors.begin(), errors.end(), [](const Diagnostic &a, const Diagnostic &b) {
+            return a.line < b.line;
+        });
+        for (auto &diagnostic: errors) {
+            out << file << ":" << diagnostic.line << ":";
+            if (diagnostic.column) out << diagnostic.column << ":";
+            out << " error: " << diagnostic.message << std::endl;
+        }
+        if (truncated || errors.size() >= budget) out << "too many errors, stopping after " << budget << std::endl;
+        else out << errors.size() << (errors.size() == 1 ? " error" : " errors") << std::endl;
+    }
+};
+
+/* the collector of the compilation in progress, defined in semantic/parser.y */
+extern Diagnostics diagnostics;
+
+#endif //PHEMIA_DIAGNOSTICS_HPP
@@ -0,0 +1,136 @@
+#ifndef PHEMIA_DRIVER_HPP
+#define PHEMIA_DRIVER_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "backend.hpp"
+#include "codeGen.hpp"
+#include "coreFunc.hpp"
+#include "diagnostics.hpp"
+#include "node.h"
+#include "stream.hpp"
+
+extern FILE *yyin;
+
+extern int yyparse();
+
+extern void yyrestart(FILE *file);
+
+extern NBlock *programBlock;
+
+extern StatementStream *statementStream;
+
+extern int charPos;
+
+extern int charLine;
+
+/*
+ * one compilation as given on the command line:
+ * `<file> [--jit] [--stream] [--max-errors <n>] [--obj <object file>] [--jobs <n>] [--march=<cpu>]
+ *  [--multiversion] [--reassociate] [--heap-profile[=<file>]]`
+ */
+struct CompileOptions {
+    std::string file;
+    std::string output = "test/output.ll";
+    bool jit = false;
+    bool stream = false;
+    /* errors reported before giving up on the file */
+    size_t maxErrors = 20;
+    /* also write object code here, lowered on `jobs` threads, see Backend; ignored with --jit */
+    std::string object;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    /* CPU to generate code for, `native` for this one; empty leaves llc's default */
+    std::string arch;
+    /* hot functions get x86-64-v2/v3/v4 versions picked at load time, see TargetChoice; ignored with --jit */
+    bool multiversion = false;
+    /* float and double reductions may add in any order, so they can be vectorized and split */
+    bool reassociate = false;
+    /* the compiled program writes a sampled heap profile here at exit, see runtime/profile.h */
+    std::string heapProfile;
+
+    /* the options that change the code generated for a file, what compiled runs are cached under with it */
+    std::string codeKey() const {
+        return arch + '\0' + heapProfile + '\0' + (reassociate ? "reassociate" : "");
+    }
+
+    static CompileOptions parse(const std::vector<std::string> &args) {
+        CompileOptions options;
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == "--jit") options.jit = true;
+            else if (args[i] == "--stream") options.stream = true;
+            else if (args[i] == "--max-errors" && i + 1 < args.size()) {
+                options.maxErrors = std::max(1ul, std::strtoul(args[++i].c_str(), nullptr, 10));
+            }
+            else if (args[i] == "--obj" && i + 1 < args.size()) options.object = args[++i];
+            else if (args[i] == "--jobs" && i + 1 < args.size()) {
+                options.jobs = (unsigned) std::max(1ul, std::strtoul(args[++i].c_str(), nullptr, 10));
+            }
+            else if (args[i].rfind("--march=", 0) == 0) options.arch = args[i].substr(8);
+            else if (args[i] == "--multiversion") options.multiversion = true;
+            else if (args[i] == "--reassociate") options.reassociate = true;
+            else if (args[i] == "--heap-profile") options.heapProfile = "heap.pprof";
+            else if (args[i].rfind("--heap-profile=", 0) == 0) options.heapProfile = args[i].substr(15);
+            else if (i == 0) options.file = args[i];
+        }
+        return options;
+    }
+};
+
+/*
+ * parse `fp` and lower it into `context`, writing the IR to options.output; false after reporting the
+ * syntax and semantic errors found in the whole file
+ */
+bool compileSource(FILE *fp, ARStack &context, const CompileOptions &options) {
+    yyrestart(fp);
+    charLine = 1;
+    charPos = 0;
+    diagnostics.clear();
+    diagnostics.budget = options.maxErrors;
+    programBlock = nullptr;
+    if (!options.arch.empty()) context.target.setArch(options.arch);
+    /* MCJIT cannot link ifuncs */
+    context.target.multiversion = options.multiversion && !options.jit;
+    context.reassociate = options.reassociate;
+    if (options.stream) context.constEval.threaded = true;
+    context.heapProfile = options.heapProfile;
+    context.sourceFile = options.file;
+    std::string error;
+    if (!context.target.check(error)) {
+        std::cerr << "phemia: " << error << std::endl;
+        return false;
+    }
+    createCoreFunction(context);
+    if (options.stream) {
+        /* code generation overlaps parsing, each top-level statement is lowered as soon as it is complete */
+        StatementStream queue;
+        statementStream = &queue;
+        std::thread codeGen([&context, &queue, &options] { context.generateCode(queue, options.output); });
+        yyparse();
+        queue.close();
+        codeGen.join();
+        statementStream = nullptr;
+    } else {
+        /* unless the parser gave up, recovery leaves the well-formed statements to be checked */
+        yyparse();
+        if (programBlock) context.generateCode(*programBlock, options.output);
+    }
+    if (diagnostics.empty()) return true;
+    diagnostics.report(std::cerr, options.file);
+    return false;
+}
+
+/* the object file --obj asks for, if any; false after reporting why it could not be written */
+bool emitObject(ARStack &context, const CompileOptions &options) {
+    if (options.object.empty() || options.jit) return true;
+    Backend backend;
+    backend.jobs = options.jobs;
+    if (backend.emitObject(*context.module, options.object)) return true;
+    std::cerr << "phemia: " << backend.error << std::endl;
+    return false;
+}
+
+#endif //PHEMIA_DRIVER_HPP
@@ -0,0 +1,360 @@
+#ifndef PHEMIA_ENGINE_HPP
+#define PHEMIA_ENGINE_HPP
+
+#include <atomic>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "async.h"
+#include "gc.h"
+#include "io.h"
+#include "map.h"
+#include "mapped.h"
+#include "profile.h"
+#include "reduce.h"
+#include "sort.h"
+#include "text.h"
+
+/*
+ * Two-tier JIT on top of MCJIT.
+ * Tier 0: the whole module is compiled at -O0; every user function counts its calls and is
+ *         only ever called through a `<name>.slot` function pointer.
+ * Tier 1: once a function reaches `threshold` calls, a worker thread clones it out of a
+ *         pristine copy of the module, optimizes it at -O3 and swaps it into the slot.
+ */
+class TieredEngine {
+    struct TieredFunction {
+        std::string name;
+        uint64_t slotAddr = 0;
+    };
+
+    uint64_t threshold;
+    llvm::ExecutionEngine *baseEngine = nullptr;
+    llvm::Function *entryFunction = nullptr;
+    std::vector<TieredFunction> functions;
+    /* addresses of tier 0 globals, so optimized code shares data with it */
+    std::map<std::string, uint64_t> globalAddr;
+    /* initial contents of writable program data (array literals, strings), restored by rerun */
+    std::vector<std::pair<uint64_t, std::string>> initialData;
+    llvm::SmallVector<char, 0> pristine;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<int32_t> queue;
+    bool stopping = false;
+
+    static TieredEngine *&active() {
+        static TieredEngine *engine = nullptr;
+        return engine;
+    }
+
+    static void tierUpHook(int32_t id) {
+        if (active()) active()->requestTierUp(id);
+    }
+
+    static void redirectCalls(llvm::Function *callee, llvm::GlobalVariable *slot) {
+        std::vector<llvm::CallInst *> calls;
+        for (auto user: callee->users()) {
+            auto call = llvm::dyn_cast<llvm::CallInst>(user);
+            if (call && call->getCalledOperand() == callee) calls.push_back(call);
+        }
+        for (auto call: calls) {
+            llvm::IRBuilder<> builder(call);
+            auto target = builder.CreateAlignedLoad(callee->getType(), slot, llvm::MaybeAlign(8), "target");
+            target->setAtomic(llvm::AtomicOrdering::Monotonic);
+            call->setCalledOperand(target);
+        }
+    }
+
+    void instrument(llvm::Module &module) {
+        auto &ctx = module.getContext();
+        auto hookType = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {llvm::Type::getInt32Ty(ctx)}, false);
+        auto hook = module.getOrInsertFunction("phemia_tier_up", hookType);
+        auto counterType = llvm::Type::getInt64Ty(ctx);
+
+        std::vector<llvm::Function *> userFunctions;
+        for (auto &function: module) {
+            /* a coroutine's resume/destroy parts and outlined I/O operations are only called through
+             * pointers, there is no call to redirect; they stay at tier 0 */
+            if (function.isDeclaration() || function.getName() == "main" || function.hasAddressTaken()) continue;
+            userFunctions.push_back(&function);
+        }
+        for (auto function: userFunctions) {
+            auto id = (int32_t) functions.size();
+            functions.push_back({function->getName().str()});
+
+            auto slot = new llvm::GlobalVariable(module, function->getType(), false,
+                                                 llvm::GlobalValue::ExternalLinkage, function,
+                                                 function->getName() + ".slot");
+            auto counter = new llvm::GlobalVariable(module, counterType, false, llvm::GlobalValue::InternalLinkage,
+                                                    llvm::ConstantInt::get(counterType, 0),
+                                                    function->getName() + ".calls");
+            redirectCalls(function, slot);
+
+            auto &entry = function->getEntryBlock();
+            auto insertBefore = &*entry.getFirstInsertionPt();
+            while (llvm::isa<llvm::AllocaInst>(insertBefore)) insertBefore = insertBefore->getNextNode();
+            llvm::IRBuilder<> builder(insertBefore);
+            auto calls = builder.CreateAdd(builder.CreateLoad(counterType, counter), builder.getInt64(1));
+            builder.CreateStore(calls, counter);
+            auto hot = builder.CreateICmpEQ(calls, builder.getInt64(threshold), "hot");
+            auto tierUp = llvm::SplitBlockAndInsertIfThen(hot, insertBefore, false);
+            builder.SetInsertPoint(tierUp);
+            builder.CreateCall(hook, {builder.getInt32(id)});
+        }
+    }
+
+    void requestTierUp(int32_t id) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(id);
+        }
+        cv.notify_one();
+    }
+
+    void workerLoop() {
+        llvm::LLVMContext ctx;
+        auto base = llvm::parseBitcodeFile(
+                llvm::MemoryBufferRef(llvm::StringRef(pristine.data(), pristine.size()), "pristine"), ctx);
+        if (!base) {
+            llvm::consumeError(base.takeError());
+            return;
+        }
+        std::vector<std::unique_ptr<llvm::ExecutionEngine>> engines;
+        while (true) {
+            int32_t id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) break;
+                id = queue.front();
+                queue.pop_front();
+            }
+            auto engine = compileOptimized(**base, functions[id].name);
+            if (!engine) continue;
+            auto addr = engine->getFunctionAddress(functions[id].name);
+            if (addr) {
+                reinterpret_cast<std::atomic<uint64_t> *>(functions[id].slotAddr)->store(addr);
+            }
+            engines.push_back(std::move(engine));
+        }
+    }
+
+    std::unique_ptr<llvm::ExecutionEngine> compileOptimized(llvm::Module &base, const std::string &name) {
+        llvm::ValueToValueMapTy vMap;
+        auto module = llvm::CloneModule(base, vMap, [&name](const llvm::GlobalValue *gv) {
+            return gv->getName() == name;
+        });
+        auto function = module->getFunction(name);
+        function->setLinkage(llvm::GlobalValue::ExternalLinkage);
+
+        /* other user functions are reached through their tier 0 slots */
+        for (auto &tiered: functions) {
+            auto callee = module->getFunction(tiered.name);
+            if (!callee || callee == function || callee->use_empty()) continue;
+            auto slot = new llvm::GlobalVariable(*module, callee->getType(), false,
+                                                 llvm::GlobalValue::ExternalLinkage, nullptr, tiered.name + ".slot");
+            redirectCalls(callee, slot);
+        }
+
+        llvm::legacy::FunctionPassManager fpm(module.get());
+        llvm::legacy::PassManager mpm;
+        llvm::PassManagerBuilder pmb;
+        pmb.OptLevel = 3;
+        pmb.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+        pmb.populateFunctionPassManager(fpm);
+        pmb.populateModulePassManager(mpm);
+        fpm.doInitialization();
+        for (auto &f: *module) fpm.run(f);
+        fpm.doFinalization();
+        mpm.run(*module);
+
+        std::vector<llvm::GlobalVariable *> externals;
+        for (auto &gv: module->globals()) {
+            if (gv.isDeclaration()) externals.push_back(&gv);
+        }
+        std::vector<llvm::Function *> externalFunctions;
+        for (auto &callee: *module) {
+            if (callee.isDeclaration()) externalFunctions.push_back(&callee);
+        }
+        std::string err;
+        std::unique_ptr<llvm::ExecutionEngine> engine(llvm::EngineBuilder(std::move(module))
+                                                              .setErrorStr(&err)
+                                                              .setOptLevel(llvm::CodeGenOpt::Aggressive)
+                                                              .create());
+        if (!engine) {
+            std::cerr << "Tier-up of " << name << " failed: " << err << std::endl;
+            return nullptr;
+        }
+        for (auto gv: externals) {
+            auto it = globalAddr.find(gv->getName().str());
+            if (it != globalAddr.end()) engine->addGlobalMapping(gv, (void *) it->second);
+        }
+        for (auto callee: externalFunctions) {
+            auto it = globalAddr.find(callee->getName().str());
+            if (it != globalAddr.end()) engine->addGlobalMapping(callee, (void *) it->second);
+        }
+        engine->finalizeObject();
+        return engine;
+    }
+
+public:
+    explicit TieredEngine(uint64_t threshold = 1000) : threshold(threshold) {}
+
+    /* runtime entry points generated code may call, see runtime/ */
+    static void registerRuntime() {
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_tier_up", (void *) &TieredEngine::tierUpHook);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_alloc", (void *) &phemia_gc_alloc);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_alloc_object", (void *) &phemia_gc_alloc_object);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_alloc_refs", (void *) &phemia_gc_alloc_refs);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_push", (void *) &phemia_gc_push);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_pop", (void *) &phemia_gc_pop);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_collect", (void *) &phemia_gc_collect);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_pin", (void *) &phemia_gc_pin);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_gc_unpin", (void *) &phemia_gc_unpin);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_write", (void *) &phemia_write);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_write_int", (void *) &phemia_write_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_write_char", (void *) &phemia_write_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_write_str", (void *) &phemia_write_str);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_write_double", (void *) &phemia_write_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_literal", (void *) &phemia_read_literal);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_int", (void *) &phemia_read_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_char", (void *) &phemia_read_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_float", (void *) &phemia_read_float);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_double", (void *) &phemia_read_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_scan_result", (void *) &phemia_scan_result);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_io_submit", (void *) &phemia_io_submit);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_io_done", (void *) &phemia_io_done);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_loop_ready", (void *) &phemia_loop_ready);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_loop_next", (void *) &phemia_loop_next);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_loop_pending", (void *) &phemia_loop_pending);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_new", (void *) &phemia_map_new);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_find_int", (void *) &phemia_map_find_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_find_str", (void *) &phemia_map_find_str);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_contains_int", (void *) &phemia_map_contains_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_contains_str", (void *) &phemia_map_contains_str);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_insert_int", (void *) &phemia_map_insert_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_insert_str", (void *) &phemia_map_insert_str);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_erase_int", (void *) &phemia_map_erase_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_erase_str", (void *) &phemia_map_erase_str);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_map_size", (void *) &phemia_map_size);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_sort", (void *) &phemia_sort);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_partial_sort", (void *) &phemia_partial_sort);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_search_char", (void *) &phemia_search_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_search_int", (void *) &phemia_search_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_search_float", (void *) &phemia_search_float);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_search_double", (void *) &phemia_search_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_reduce_char", (void *) &phemia_reduce_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_reduce_int", (void *) &phemia_reduce_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_reduce_float", (void *) &phemia_reduce_float);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_reduce_double", (void *) &phemia_reduce_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_dot_char", (void *) &phemia_dot_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_dot_int", (void *) &phemia_dot_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_dot_float", (void *) &phemia_dot_float);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_dot_double", (void *) &phemia_dot_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_scan_char", (void *) &phemia_scan_char);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_scan_int", (void *) &phemia_scan_int);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_scan_float", (void *) &phemia_scan_float);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_scan_double", (void *) &phemia_scan_double);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_str_length", (void *) &phemia_str_length);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_str_compare", (void *) &phemia_str_compare);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_str_find", (void *) &phemia_str_find);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_str_copy", (void *) &phemia_str_copy);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_read_line", (void *) &phemia_read_line);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_mapped_file", (void *) &phemia_mapped_file);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_profile_site", (void *) &phemia_profile_site);
+        llvm::sys::DynamicLibrary::AddSymbol("phemia_profile_start", (void *) &phemia_profile_start);
+    }
+
+    ~TieredEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        if (worker.joinable()) worker.join();
+        if (active() == this) active() = nullptr;
+        delete baseEngine;
+    }
+
+    llvm::GenericValue run(llvm::Module *module, const std::string &entry) {
+        /* globals must stay visible by name for the optimized modules to bind to them */
+        for (auto &gv: module->globals()) {
+            if (gv.hasLocalLinkage()) gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+        for (auto &function: *module) {
+            if (function.hasLocalLinkage()) function.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+        llvm::raw_svector_ostream out(pristine);
+        llvm::WriteBitcodeToFile(*module, out);
+
+        instrument(*module);
+        registerRuntime();
+        auto main = module->getFunction(entry);
+        baseEngine = llvm::EngineBuilder(std::unique_ptr<llvm::Module>(module))
+                .setOptLevel(llvm::CodeGenOpt::None)
+                .create();
+        baseEngine->finalizeObject();
+
+        for (auto &gv: main->getParent()->globals()) {
+            if (!gv.isDeclaration()) globalAddr[gv.getName().str()] = baseEngine->getGlobalValueAddress(gv.getName().str());
+        }
+        /* optimized code may take their address, e.g. a coroutine storing its resume part in its frame */
+        for (auto &function: *main->getParent()) {
+            if (!function.isDeclaration() && function.hasAddressTaken()) {
+                globalAddr[function.getName().str()] = baseEngine->getFunctionAddress(function.getName().str());
+            }
+        }
+        for (auto &tiered: functions) {
+            tiered.slotAddr = globalAddr[tiered.name + ".slot"];
+        }
+        auto &layout = main->getParent()->getDataLayout();
+        for (auto &gv: main->getParent()->globals()) {
+            auto name = gv.getName();
+            if (gv.isDeclaration() || gv.isConstant() || name.endswith(".slot") || name.endswith(".calls")) continue;
+            auto addr = globalAddr[name.str()];
+            auto size = layout.getTypeAllocSize(gv.getValueType()).getFixedSize();
+            initialData.emplace_back(addr, std::string((const char *) addr, size));
+        }
+
+        entryFunction = main;
+        worker = std::thread(&TieredEngine::workerLoop, this);
+        return rerun();
+    }
+
+    /* run the entry function again on fresh program data; tier 1 code compiled so far is kept */
+    llvm::GenericValue rerun() {
+        for (auto &data: initialData) {
+            std::memcpy((void *) data.first, data.second.data(), data.second.size());
+        }
+        active() = this;
+        std::vector<llvm::GenericValue> noArgs;
+        return baseEngine->runFunction(entryFunction, noArgs);
+    }
+};
+
+#endif //PHEMIA_ENGINE_HPP
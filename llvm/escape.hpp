@@ -0,0 +1,303 @@
+#ifndef PHEMIA_ESCAPE_HPP
+#define PHEMIA_ESCAPE_HPP
+
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "node.h"
+
+/*
+ * Escape analysis over the AST, run on each top-level statement before it is lowered.
+ *
+ * An array or string variable escapes when its value may outlive the declaring function: it is
+ * returned, copied into another variable or field, passed to a method, to an async function or to
+ * a function whose parameter escapes, or referenced from a nested function. It is written when its elements may
+ * change: element assignment, scanf/gets targets, or a function parameter that is written.
+ * Functions are summarized per parameter as they are met, so calls see the callee's facts.
+ *
+ * ARStack uses the result to keep small non-escaping `new` arrays on the stack (see
+ * NVariableDeclaration::codeGen), to emit read-only literals as shared constants and to move
+ * top-level variables that functions refer to out of main's registers into module globals.
+ */
+class EscapeAnalysis {
+    struct Facts {
+        bool escapes = false;
+        bool written = false;
+        /* assigned a whole new value after its declaration */
+        bool rebound = false;
+        /* initialized with storage of its own: `new`, or a literal */
+        bool fresh = false;
+        /* the function the variable is declared in, 0 for the top level */
+        size_t function = 0;
+        /* used from code of another function */
+        bool shared = false;
+    };
+
+    struct Scope {
+        std::map<std::string, NVariableDeclaration *> names;
+        size_t function;
+    };
+
+    std::map<NVariableDeclaration *, Facts> facts;
+    /* parameter facts per function name */
+    std::map<std::string, std::vector<Facts>> summaries;
+    std::set<NFunctionDeclaration *> analyzed;
+    /* literal initializer -> the variable it initializes */
+    std::map<Node *, NVariableDeclaration *> initOf;
+    /* literals passed straight to printf/scanf as read-only arguments */
+    std::set<Node *> readOnly;
+    std::vector<Scope> scopes{Scope{{}, 0}};
+    size_t functions = 0;
+
+public:
+    /*
+     * set while top-level statements are analyzed one at a time (streaming): later statements are
+     * not known yet, so top-level variables are assumed to escape
+     */
+    bool openTopLevel = false;
+
+    void analyze(Node *statement) { visit(statement); }
+
+    /* drop what is known about literals once their statement is lowered and may be freed */
+    void forgetLiterals() {
+        initOf.clear();
+        readOnly.clear();
+    }
+
+    /* a non-escaping variable initialized with `new [...]T()` of its own declared shape */
+    bool isLocalArray(NVariableDeclaration *decl) const {
+        auto arr = dynamic_cast<NArray *>(decl->assignmentExpr);
+        auto arrDim = decl->type.getArrayDim();
+        if (!arr || arr->initList || !arr->arrDim || !arrDim || arr->arrDim->size() != arrDim->size()) return false;
+        for (size_t k = 0; k < arrDim->size(); k++) {
+            if (*(*arr->arrDim)[k] != *(*arrDim)[k] || std::strtol((*arrDim)[k]->c_str(), nullptr, 10) <= 0) {
+                return false;
+            }
+        }
+        auto it = facts.find(decl);
+        return it != facts.end() && !it->second.escapes;
+    }
+
+    /* an array only ever reachable through this variable, so accesses via other names cannot alias it */
+    bool isUnaliased(NVariableDeclaration *decl) const {
+        auto it = facts.find(decl);
+        return it != facts.end() && it->second.fresh && !it->second.escapes && !it->second.rebound;
+    }
+
+    /* a variable some other function refers to, so it cannot live in registers of the declaring one */
+    bool isShared(NVariableDeclaration *decl) const {
+        auto it = facts.find(decl);
+        return it != facts.end() && it->second.shared;
+    }
+
+    /* a string or array literal nothing writes to or holds on to */
+    bool isConstant(Node *literal) const {
+        if (readOnly.count(literal)) return true;
+        auto decl = initOf.find(literal);
+        if (decl == initOf.end()) return false;
+        auto it = facts.find(decl->second);
+        return it != facts.end() && !it->second.escapes && !it->second.written;
+    }
+
+private:
+    NVariableDeclaration *lookup(const std::string &name) {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); it++) {
+            auto found = it->names.find(name);
+            if (found != it->names.end()) return found->second;
+        }
+        return nullptr;
+    }
+
+    void declare(NVariableDeclaration *decl) {
+        auto &f = facts[decl] = Facts();
+        f.function = scopes.back().function;
+        if (openTopLevel && f.function == 0) f.escapes = f.written = f.shared = true;
+        scopes.back().names[decl->id.name] = decl;
+    }
+
+    Facts *use(const std::string &name) {
+        auto decl = lookup(name);
+        if (!decl) return nullptr;
+        auto &f = facts[decl];
+        /* code of another function cannot address this frame */
+        if (f.function != scopes.back().function) f.escapes = f.written = f.shared = true;
+        return &f;
+    }
+
+    void escape(NExpression *expression) {
+        if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            if (auto f = use(id->name)) f->escapes = f->written = true;
+        } else visit(expression);
+    }
+
+    void write(NExpression *expression) {
+        if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            if (auto f = use(id->name)) f->written = true;
+        } else visit(expression);
+    }
+
+    void visitAll(ExpressionList *list) {
+        if (!list) return;
+        for (auto item: *list) visit(item);
+    }
+
+    void visitBlock(NBlock *block) {
+        if (!block) return;
+        scopes.push_back(Scope{{}, scopes.back().function});
+        for (auto statement: block->statements) visit(statement);
+        scopes.pop_back();
+    }
+
+    void visitFunction(NFunctionDeclaration *function, const std::string &name) {
+        if (!analyzed.insert(function).second) return;
+        auto &summary = summaries[name];
+        summary.assign(function->arguments.size(), Facts());
+        size_t index = ++functions;
+        /* recursive calls read the summary being built, so repeat until it stops growing */
+        while (true) {
+            scopes.push_back(Scope{{}, index});
+            for (auto argument: function->arguments) declare(argument);
+            visitBlock(&function->block);
+            scopes.pop_back();
+            bool changed = false;
+            for (size_t i = 0; i < function->arguments.size(); i++) {
+                auto &f = facts[function->arguments[i]];
+                changed |= f.escapes != summary[i].escapes || f.written != summary[i].written;
+                summary[i].escapes = f.escapes;
+                summary[i].written = f.written;
+            }
+            if (!changed) break;
+        }
+        /* a task may still run after its caller has returned */
+        if (function->isAsync) {
+            for (auto &f: summary) f.escapes = f.written = true;
+        }
+    }
+
+    void visitCall(NFunctionCall *call) {
+        auto &name = call->id.name;
+        auto &params = call->params;
+        /* the sort builtins and scan rewrite their array in place, the other array builtins only read */
+        bool sorts = name == "sort" || name == "stableSort" || name == "partialSort" || name == "scan";
+        bool reads = name == "binarySearch" || name == "popcount" || name == "firstSet" || name == "sum" ||
+                     name == "min" || name == "max" || name == "dot";
+        if (!summaries.count(name) && (sorts || reads)) {
+            for (size_t i = 0; i < params.size(); i++) {
+                if (sorts && i == 0) write(params[i]);
+                else visit(params[i]);
+            }
+            return;
+        }
+        bool fillsFirst = name == "strCopy" || name == "readLine";
+        if (name == "printf" || name == "scanf" || name == "gets" || fillsFirst || name == "strLength" ||
+            name == "strCompare" || name == "strFind" || name == "mapFile") {
+            for (size_t i = 0; i < params.size(); i++) {
+                bool isTarget = name == "gets" || (name == "scanf" && i > 0) || (fillsFirst && i == 0);
+                if (isTarget) {
+                    write(params[i]);
+                } else if (dynamic_cast<NString *>(params[i])) {
+                    readOnly.insert(params[i]);
+                } else visit(params[i]);
+            }
+            return;
+        }
+        auto summary = summaries.find(name);
+        for (size_t i = 0; i < params.size(); i++) {
+            auto id = dynamic_cast<NIdentifier *>(params[i]);
+            if (!id || summary == summaries.end() || i >= summary->second.size()) {
+                escape(params[i]);
+                continue;
+            }
+            auto f = use(id->name);
+            if (!f) continue;
+            f->escapes |= summary->second[i].escapes;
+            f->written |= summary->second[i].written;
+        }
+    }
+
+    void visit(Node *node) {
+        if (!node) return;
+        if (auto block = dynamic_cast<NBlock *>(node)) {
+            visitBlock(block);
+        } else if (auto statement = dynamic_cast<NExpressionStatement *>(node)) {
+            visit(statement->expression);
+        } else if (auto ret = dynamic_cast<NReturnStatement *>(node)) {
+            escape(ret->expression);
+        } else if (auto decl = dynamic_cast<NVariableDeclaration *>(node)) {
+            auto init = decl->assignmentExpr;
+            if (dynamic_cast<NString *>(init) || (dynamic_cast<NArray *>(init) && dynamic_cast<NArray *>(init)->initList)) {
+                initOf[init] = decl;
+            } else escape(init);
+            declare(decl);
+            facts[decl].fresh = dynamic_cast<NArray *>(init) || dynamic_cast<NString *>(init);
+        } else if (auto function = dynamic_cast<NFunctionDeclaration *>(node)) {
+            visitFunction(function, function->id.name);
+        } else if (auto cls = dynamic_cast<NClassDeclaration *>(node)) {
+            for (auto field: cls->fields) escape(field->assignmentExpr);
+            /* methods are only reached through NMethodCall, which lets every argument escape */
+            for (auto method: cls->methods) visitFunction(method, cls->id->name + "." + method->id.name);
+        } else if (auto ifStmt = dynamic_cast<NIfStatement *>(node)) {
+            visit(ifStmt->condition);
+            visitBlock(ifStmt->thenBlock);
+            visitBlock(ifStmt->elseBlock);
+        } else if (auto forStmt = dynamic_cast<NForStatement *>(node)) {
+            visit(forStmt->init);
+            visit(forStmt->condition);
+            visit(forStmt->inc);
+            visitBlock(forStmt->block);
+        } else if (auto whileStmt = dynamic_cast<NWhileStatement *>(node)) {
+            visit(whileStmt->condition);
+            visitBlock(whileStmt->block);
+        } else if (auto doWhile = dynamic_cast<NDoWhileStatement *>(node)) {
+            visitBlock(doWhile->block);
+            visit(doWhile->condition);
+        } else if (auto switchStmt = dynamic_cast<NSwitchStatement *>(node)) {
+            visit(switchStmt->condition);
+            for (auto item: switchStmt->cases) {
+                visit(item->value);
+                visitBlock(item->block);
+            }
+        } else if (auto element = dynamic_cast<NArrayAssignment *>(node)) {
+            if (auto f = use(element->lhs.name)) f->written = true;
+            visitAll(&element->arrayIndices);
+            escape(&element->rhs);
+        } else if (auto field = dynamic_cast<NClassAssignment *>(node)) {
+            use(field->lhs.name);
+            visitAll(field->arrayIndices);
+            escape(&field->rhs);
+        } else if (auto assign = dynamic_cast<NAssignment *>(node)) {
+            /* rebinding the variable leaves the storage it pointed to alone, but `a = 1` stores into it */
+            if (auto f = use(assign->lhs.name)) f->written = f->rebound = true;
+            escape(&assign->rhs);
+        } else if (auto binary = dynamic_cast<NBinaryOperator *>(node)) {
+            /* array operands of element-wise arithmetic are only read */
+            visit(binary->lhs);
+            visit(binary->rhs);
+        } else if (auto unary = dynamic_cast<NUnaryOperator *>(node)) {
+            visit(unary->rhs);
+        } else if (auto call = dynamic_cast<NFunctionCall *>(node)) {
+            visitCall(call);
+        } else if (auto await = dynamic_cast<NAwait *>(node)) {
+            visit(await->expression);
+        } else if (auto method = dynamic_cast<NMethodCall *>(node)) {
+            use(method->object.name);
+            visitAll(method->arrayIndices);
+            for (auto item: method->call.params) escape(item);
+        } else if (auto member = dynamic_cast<NMemberAccess *>(node)) {
+            use(member->object.name);
+            visitAll(member->arrayIndices);
+        } else if (auto element = dynamic_cast<NArrayElement *>(node)) {
+            use(element->id.name);
+            visitAll(&element->arrayIndices);
+        } else if (auto arr = dynamic_cast<NArray *>(node)) {
+            visitAll(arr->initList);
+        } else if (auto id = dynamic_cast<NIdentifier *>(node)) {
+            use(id->name);
+        }
+    }
+};
+
+#endif //PHEMIA_ESCAPE_HPP
@@ -0,0 +1,110 @@
+#ifndef PHEMIA_FORMAT_HPP
+#define PHEMIA_FORMAT_HPP
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "io.h"
+
+/*
+ * A printf/scanf format string known at compile time, split into literal text and conversions so
+ * ARStack::emitFormattedIO can call the matching runtime/io.h routine for each piece. Only what
+ * those routines implement is accepted; anything else (other conversions, `+`/`#`/` ` flags, `*`,
+ * length modifiers other than scanf's %lf) makes parse() fail and the call stays a libc call.
+ */
+class FormatString {
+public:
+    struct Piece {
+        /* 0 for literal text */
+        char conversion = 0;
+        std::string text;
+        int32_t width = 0;
+        /* -1 when not given */
+        int32_t precision = -1;
+        int32_t flags = 0;
+        /* scanf %lf */
+        bool isLong = false;
+    };
+
+    std::vector<Piece> pieces;
+
+    bool parse(const std::string &text, bool isScan) {
+        /* a format ends at its first NUL, as it does for libc */
+        auto format = text.substr(0, text.find('\0'));
+        pieces.clear();
+        for (size_t i = 0; i < format.size(); i++) {
+            if (format[i] != '%') {
+                literal(format[i]);
+                continue;
+            }
+            if (++i >= format.size()) return false;
+            if (format[i] == '%') {
+                literal('%');
+                continue;
+            }
+            Piece piece;
+            for (; i < format.size() && !isScan; i++) {
+                if (format[i] == '-') piece.flags |= PHEMIA_LEFT;
+                else if (format[i] == '0') piece.flags |= PHEMIA_ZERO;
+                else break;
+            }
+            for (; i < format.size() && isdigit((unsigned char) format[i]); i++) {
+                if (isScan) return false;
+                piece.width = piece.width * 10 + (format[i] - '0');
+                if (piece.width > 4096) return false;
+            }
+            if (i < format.size() && format[i] == '.') {
+                if (isScan) return false;
+                piece.precision = 0;
+                for (i++; i < format.size() && isdigit((unsigned char) format[i]); i++) {
+                    piece.precision = piece.precision * 10 + (format[i] - '0');
+                    if (piece.precision > 64) return false;
+                }
+            }
+            if (i < format.size() && format[i] == 'l') {
+                piece.isLong = true;
+                i++;
+            }
+            if (i >= format.size()) return false;
+            piece.conversion = format[i];
+            switch (piece.conversion) {
+                case 'd':
+                case 'i':
+                    /* scanf's %i also reads octal and hex */
+                    if (isScan && piece.conversion == 'i') return false;
+                    piece.conversion = 'd';
+                    if (piece.isLong || piece.precision >= 0) return false;
+                    break;
+                case 'c':
+                case 's':
+                    if (isScan && piece.conversion == 's') return false;
+                    if (piece.isLong || piece.precision >= 0 || (piece.flags & PHEMIA_ZERO)) return false;
+                    break;
+                case 'f':
+                    /* printf's %lf is plain %f, scanf's reads a double */
+                    if (!isScan) piece.isLong = false;
+                    break;
+                default:
+                    return false;
+            }
+            pieces.push_back(piece);
+        }
+        return true;
+    }
+
+    size_t conversions() const {
+        size_t count = 0;
+        for (auto &piece: pieces) count += piece.conversion != 0;
+        return count;
+    }
+
+private:
+    void literal(char c) {
+        if (pieces.empty() || pieces.back().conversion) pieces.emplace_back();
+        pieces.back().text += c;
+    }
+};
+
+#endif //PHEMIA_FORMAT_HPP
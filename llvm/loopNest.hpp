@@ -0,0 +1,332 @@
+#ifndef PHEMIA_LOOPNEST_HPP
+#define PHEMIA_LOOPNEST_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "node.h"
+#include "parser.hpp"
+
+/* the cache the loop nest optimizer plans for */
+struct CacheModel {
+    uint64_t lineBytes = 64;
+    uint64_t l1Bytes = 32 * 1024;
+};
+
+/*
+ * A perfect nest of counted loops, `for (i = lo; i < hi; i++)` with bounds invariant in the nest,
+ * whose innermost body only stores into array elements. Such a nest can have its loops reordered
+ * and tiled, see plan(); ARStack::emitLoopNest generates the code.
+ *
+ * Index expressions are kept in affine form: coefficient per identifier, "" for the constant.
+ */
+class LoopNest {
+public:
+    typedef std::map<std::string, int64_t> Affine;
+
+    struct Level {
+        std::string var;
+        NExpression *lower;
+        NExpression *upper;
+        /* `<=` rather than `<` */
+        bool inclusive;
+    };
+
+    struct Reference {
+        std::string array;
+        std::vector<Affine> indices;
+        /* false where an index is not affine */
+        bool affine = true;
+        bool isWrite;
+    };
+
+    /* what the code generator knows about an array the body references */
+    struct ArrayShape {
+        std::vector<uint32_t> dims;
+        uint64_t elemBytes;
+        /* no other variable can refer to the same storage */
+        bool unaliased;
+    };
+
+    struct Plan {
+        /* level indices, outermost first */
+        std::vector<size_t> order;
+        /* tile edge in iterations, 0 when not tiled */
+        uint32_t tile = 0;
+        std::vector<bool> tiled;
+    };
+
+    std::vector<Level> levels;
+    std::vector<NArrayAssignment *> body;
+    std::vector<Reference> refs;
+    /* scalars other than the loop variables the nest reads, and those of them the bounds read */
+    std::set<std::string> scalars;
+    std::set<std::string> boundScalars;
+
+    /* false unless `loop` heads a nest of at least two such loops */
+    bool match(NForStatement &loop) {
+        NForStatement *current = &loop;
+        while (true) {
+            Level level;
+            if (!matchLevel(*current, level) || isLoopVar(level.var)) return false;
+            levels.push_back(level);
+            auto &statements = current->block->statements;
+            auto inner = statements.size() == 1 ? dynamic_cast<NForStatement *>(statements[0]) : nullptr;
+            if (!inner) break;
+            current = inner;
+        }
+        if (levels.size() < 2) return false;
+
+        for (auto statement: current->block->statements) {
+            auto expression = dynamic_cast<NExpressionStatement *>(statement);
+            auto store = expression ? dynamic_cast<NArrayAssignment *>(expression->expression) : nullptr;
+            if (!store) return false;
+            body.push_back(store);
+        }
+        if (body.empty()) return false;
+
+        /* bounds are evaluated once, before the nest */
+        for (auto &level: levels) {
+            if (!isInvariant(level.lower) || !isInvariant(level.upper)) return false;
+        }
+        for (auto store: body) {
+            if (!collect(&store->rhs)) return false;
+            for (auto index: store->arrayIndices) if (!collect(index)) return false;
+            addReference(store->lhs.name, store->arrayIndices, true);
+        }
+        return true;
+    }
+
+    /*
+     * Loops are ordered by the cost of running each one innermost (Kennedy and McKinley's
+     * LoopCost): cache lines touched per reference, a stride-one reference costing one line per
+     * lineBytes of its elements. When the arrays do not fit the cache, every long loop is also
+     * strip-mined by a tile edge chosen so that a tile of each array fits in it at once.
+     * Returns false when the nest must stay as written or nothing would change.
+     */
+    bool plan(const std::map<std::string, ArrayShape> &shapes, const CacheModel &cache, Plan &result) const {
+        if (!isPermutable(shapes)) return false;
+
+        uint64_t elemBytes = 1;
+        uint64_t footprint = 0;
+        for (auto &entry: shapes) {
+            uint64_t size = entry.second.elemBytes;
+            for (auto dim: entry.second.dims) size *= dim;
+            footprint += size;
+            elemBytes = std::max(elemBytes, entry.second.elemBytes);
+        }
+        auto lineElements = std::max<uint64_t>(1, cache.lineBytes / elemBytes);
+
+        std::vector<double> trips(levels.size());
+        for (size_t l = 0; l < levels.size(); l++) trips[l] = tripCount(l, shapes);
+        std::vector<double> costs(levels.size());
+        for (size_t l = 0; l < levels.size(); l++) {
+            double others = 1;
+            for (size_t k = 0; k < levels.size(); k++) if (k != l) others *= trips[k];
+            double lines = 0;
+            for (auto &ref: refs) lines += referenceCost(ref, levels[l].var, trips[l], lineElements);
+            costs[l] = lines * others;
+        }
+        result.order.clear();
+        for (size_t l = 0; l < levels.size(); l++) result.order.push_back(l);
+        std::stable_sort(result.order.begin(), result.order.end(),
+                         [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+        result.tile = 0;
+        result.tiled.assign(levels.size(), false);
+        if (footprint > cache.l1Bytes) {
+            auto edge = (uint64_t) std::sqrt((double) cache.l1Bytes / (double) (elemBytes * shapes.size()));
+            edge = std::max(lineElements, edge / lineElements * lineElements);
+            for (size_t l = 0; l < levels.size(); l++) {
+                if (trips[l] > (double) edge) {
+                    result.tiled[l] = true;
+                    result.tile = (uint32_t) edge;
+                }
+            }
+        }
+
+        bool reordered = false;
+        for (size_t l = 0; l < levels.size(); l++) reordered |= result.order[l] != l;
+        return reordered || result.tile;
+    }
+
+private:
+    static bool isVar(NExpression *expression, const std::string &var) {
+        auto id = dynamic_cast<NIdentifier *>(expression);
+        return id && typeid(*id) == typeid(NIdentifier) && id->name == var;
+    }
+
+    static bool matchLevel(NForStatement &loop, Level &level) {
+        auto init = dynamic_cast<NExpressionStatement *>(loop.init);
+        auto assign = init ? dynamic_cast<NAssignment *>(init->expression) : nullptr;
+        if (!assign || typeid(*assign) != typeid(NAssignment) || !loop.block) return false;
+        level.var = assign->lhs.name;
+        level.lower = &assign->rhs;
+
+        auto cond = dynamic_cast<NBinaryOperator *>(loop.condition);
+        if (!cond || (cond->op != LT && cond->op != LE) || !isVar(cond->lhs, level.var)) return false;
+        level.upper = cond->rhs;
+        level.inclusive = cond->op == LE;
+
+        auto inc = dynamic_cast<NExpressionStatement *>(loop.inc);
+        if (!inc) return false;
+        if (auto op = dynamic_cast<NIncOperator *>(inc->expression)) return isVar(op->rhs, level.var);
+        auto step = dynamic_cast<NAssignment *>(inc->expression);
+        if (!step || typeid(*step) != typeid(NAssignment) || step->lhs.name != level.var) return false;
+        auto sum = dynamic_cast<NBinaryOperator *>(&step->rhs);
+        auto one = sum ? dynamic_cast<NInteger *>(sum->rhs) : nullptr;
+        return sum && sum->op == PLUS && isVar(sum->lhs, level.var) && one && one->value == 1;
+    }
+
+    bool isLoopVar(const std::string &name) const {
+        for (auto &level: levels) if (level.var == name) return true;
+        return false;
+    }
+
+    /* bounds may only read scalars the nest does not change */
+    bool isInvariant(NExpression *expression) {
+        if (dynamic_cast<NInteger *>(expression)) return true;
+        if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            if (typeid(*id) != typeid(NIdentifier) || isLoopVar(id->name)) return false;
+            scalars.insert(id->name);
+            boundScalars.insert(id->name);
+            return true;
+        }
+        auto op = dynamic_cast<NBinaryOperator *>(expression);
+        return op && (op->op == PLUS || op->op == MINUS || op->op == MUL) && isInvariant(op->lhs) &&
+               isInvariant(op->rhs);
+    }
+
+    /* the right hand side: arithmetic over scalars and array elements, nothing with side effects */
+    bool collect(NExpression *expression) {
+        if (dynamic_cast<NInteger *>(expression) || dynamic_cast<NDouble *>(expression) ||
+            dynamic_cast<NFloat *>(expression) || dynamic_cast<NChar *>(expression) ||
+            dynamic_cast<NBoolean *>(expression)) {
+            return true;
+        }
+        if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            if (typeid(*id) != typeid(NIdentifier)) return false;
+            if (!isLoopVar(id->name)) scalars.insert(id->name);
+            return true;
+        }
+        if (auto element = dynamic_cast<NArrayElement *>(expression)) {
+            for (auto index: element->arrayIndices) if (!collect(index)) return false;
+            addReference(element->id.name, element->arrayIndices, false);
+            return true;
+        }
+        if (auto op = dynamic_cast<NBinaryOperator *>(expression)) {
+            return collect(op->lhs) && collect(op->rhs);
+        }
+        auto unary = dynamic_cast<NUnaryOperator *>(expression);
+        return unary && typeid(*unary) == typeid(NUnaryOperator) && collect(unary->rhs);
+    }
+
+    void addReference(const std::string &array, ExpressionList &indices, bool isWrite) {
+        Reference ref;
+        ref.array = array;
+        ref.isWrite = isWrite;
+        for (auto index: indices) {
+            Affine form;
+            ref.affine &= toAffine(index, 1, form);
+            ref.indices.push_back(form);
+        }
+        refs.push_back(ref);
+    }
+
+    static bool toAffine(NExpression *expression, int64_t scale, Affine &form) {
+        if (auto number = dynamic_cast<NInteger *>(expression)) {
+            form[""] += scale * number->value;
+            return true;
+        }
+        if (auto id = dynamic_cast<NIdentifier *>(expression)) {
+            form[id->name] += scale;
+            return true;
+        }
+        auto op = dynamic_cast<NBinaryOperator *>(expression);
+        if (!op) return false;
+        if (op->op == PLUS) return toAffine(op->lhs, scale, form) && toAffine(op->rhs, scale, form);
+        if (op->op == MINUS) return toAffine(op->lhs, scale, form) && toAffine(op->rhs, -scale, form);
+        if (op->op != MUL) return false;
+        if (auto number = dynamic_cast<NInteger *>(op->lhs)) return toAffine(op->rhs, scale * number->value, form);
+        if (auto number = dynamic_cast<NInteger *>(op->rhs)) return toAffine(op->lhs, scale * number->value, form);
+        return false;
+    }
+
+    /* loop variables the affine form depends on */
+    std::set<std::string> loopVars(const Affine &form) const {
+        std::set<std::string> vars;
+        for (auto &term: form) {
+            if (term.second != 0 && isLoopVar(term.first)) vars.insert(term.first);
+        }
+        return vars;
+    }
+
+    /*
+     * Every reordering and tiling is legal when each dependence is carried by a single loop: then
+     * all iterations touching one element agree on every other loop variable. That holds if each
+     * written array is only ever accessed through one affine reference, has no aliases, and that
+     * reference leaves at most one loop variable out.
+     */
+    bool isPermutable(const std::map<std::string, ArrayShape> &shapes) const {
+        for (auto &write: refs) {
+            if (!write.isWrite) continue;
+            auto shape = shapes.find(write.array);
+            if (shape == shapes.end() || !shape->second.unaliased || !write.affine) return false;
+            std::set<std::string> used;
+            for (auto &index: write.indices) {
+                auto vars = loopVars(index);
+                if (vars.size() > 1) return false;
+                used.insert(vars.begin(), vars.end());
+            }
+            if (used.size() + 1 < levels.size()) return false;
+            for (auto &other: refs) {
+                if (other.array == write.array && (!other.affine || other.indices != write.indices)) return false;
+            }
+        }
+        return true;
+    }
+
+    double tripCount(size_t l, const std::map<std::string, ArrayShape> &shapes) const {
+        auto &level = levels[l];
+        auto lower = dynamic_cast<NInteger *>(level.lower);
+        auto upper = dynamic_cast<NInteger *>(level.upper);
+        if (lower && upper) return std::max(0, upper->value - lower->value + (level.inclusive ? 1 : 0));
+        /* bounded by the extent of the dimensions it indexes */
+        double trip = 0;
+        for (auto &ref: refs) {
+            auto shape = shapes.find(ref.array);
+            if (shape == shapes.end()) continue;
+            for (size_t k = 0; k < ref.indices.size() && k < shape->second.dims.size(); k++) {
+                auto vars = loopVars(ref.indices[k]);
+                if (vars.size() == 1 && *vars.begin() == level.var) {
+                    double extent = shape->second.dims[k];
+                    trip = trip == 0 ? extent : std::min(trip, extent);
+                }
+            }
+        }
+        return trip == 0 ? 100 : trip;
+    }
+
+    /* cache lines one reference touches over a full run of the loop over var */
+    double referenceCost(const Reference &ref, const std::string &var, double trip, uint64_t lineElements) const {
+        bool inLast = false, inOuter = false;
+        for (size_t k = 0; k < ref.indices.size(); k++) {
+            auto term = ref.indices[k].find(var);
+            if (term == ref.indices[k].end() || term->second == 0) continue;
+            if (k + 1 == ref.indices.size() && (term->second == 1 || term->second == -1)) {
+                inLast = true;
+            } else inOuter = true;
+        }
+        if (!ref.affine) return trip;
+        if (!inLast && !inOuter) return 1;
+        if (inLast && !inOuter) return std::ceil(trip / (double) lineElements);
+        return trip;
+    }
+};
+
+#endif //PHEMIA_LOOPNEST_HPP
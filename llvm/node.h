@@ -5,6 +5,7 @@
 #include <utility>
 #include <vector>
 #include <string>
+#include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Value.h>
 
 class ARStack;
@@ -15,13 +16,22 @@ class NExpression;
 
 class NVariableDeclaration;
 
+class NCase;
+
 typedef std::vector<NStatement *> StatementList;
 typedef std::vector<NExpression *> ExpressionList;
 typedef std::vector<NVariableDeclaration *> VariableList;
 typedef std::vector<std::string *> ArrayDimension;
+typedef std::vector<NCase *> CaseList;
+
+/* line the lexer is on, see lexical/lexer.l */
+extern int charLine;
 
 class Node {
 public:
+    /* source line the node was parsed at, for diagnostics */
+    int line = charLine;
+
     virtual ~Node() = default;
 
     virtual llvm::Value *codeGen(ARStack &context) { return nullptr; }
@@ -121,6 +131,8 @@ public:
     NArray(ArrayDimension *arrDim, NIdentifier *type, ExpressionList *initList = nullptr) :
             arrDim(arrDim), type(type), initList(initList) {}
 
+    ~NArray() override;
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -132,6 +144,11 @@ public:
 
     NBinaryOperator(NExpression *lhs, int op, NExpression *rhs) : lhs(lhs), rhs(rhs), op(op) {}
 
+    ~NBinaryOperator() override {
+        delete lhs;
+        delete rhs;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -142,6 +159,8 @@ public:
 
     NUnaryOperator(int op, NExpression *rhs) : op(op), rhs(rhs) {}
 
+    ~NUnaryOperator() override { delete rhs; }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -155,15 +174,22 @@ public:
     NAssignment(NIdentifier &lhs, NExpression &rhs, bool allowDecl = false) : lhs(lhs), rhs(rhs),
                                                                               allowDecl(allowDecl) {}
 
+    ~NAssignment() override;
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
 class NClassAssignment : public NAssignment {
 public:
     NIdentifier &attribute;
+    /* set when the object is an element of an object array, `a[i].x = v` */
+    ExpressionList *arrayIndices;
+
+    NClassAssignment(NIdentifier &lhs, NIdentifier &attribute, NExpression &rhs,
+                     ExpressionList *arrayIndices = nullptr)
+            : attribute(attribute), arrayIndices(arrayIndices), NAssignment(lhs, rhs) {}
 
-    NClassAssignment(NIdentifier &lhs, NIdentifier &attribute, NExpression &rhs)
-            : attribute(attribute), NAssignment(lhs, rhs) {}
+    ~NClassAssignment() override;
 
     llvm::Value *codeGen(ARStack &context) override;
 };
@@ -175,6 +201,10 @@ public:
     NArrayAssignment(NIdentifier &lhs, ExpressionList &arrayIndices, NExpression &rhs)
             : arrayIndices(arrayIndices), NAssignment(lhs, rhs) {}
 
+    ~NArrayAssignment() override {
+        for (auto item: arrayIndices) delete item;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -184,6 +214,8 @@ public:
 
     NBlock() = default;
 
+    ~NBlock() override;
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -193,6 +225,8 @@ public:
 
     explicit NExpressionStatement(NExpression *expression = nullptr) : expression(expression) {}
 
+    ~NExpressionStatement() override { delete expression; }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -202,6 +236,8 @@ public:
 
     explicit NReturnStatement(NExpression *expression = nullptr) : expression(expression) {}
 
+    ~NReturnStatement() override { delete expression; }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -219,6 +255,12 @@ public:
     NVariableDeclaration(const bool isConst, NIdentifier &type, NIdentifier &id, NExpression *assignmentExpr)
             : isConst(isConst), type(type), id(id), assignmentExpr(assignmentExpr) {}
 
+    ~NVariableDeclaration() override {
+        delete &type;
+        delete &id;
+        delete assignmentExpr;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -228,23 +270,109 @@ public:
     const NIdentifier &id;
     VariableList arguments;
     NBlock &block;
+    /* `async function`: a coroutine, calling it starts a task, see ARStack::beginTask */
+    bool isAsync = false;
 
     NFunctionDeclaration(const NIdentifier &type, const NIdentifier &id,
                          VariableList arguments, NBlock &block) : type(type), id(id), arguments(std::move(arguments)),
                                                                   block(block) {}
 
+    ~NFunctionDeclaration() override;
+
     llvm::Value *codeGen(ARStack &context) override;
+
+    /* any array parameter declared with a runtime dimension, e.g. `[][3]int a` */
+    bool isGeneric() const;
+
+    /* withDims: the generic signature, runtime dimensions appended as int parameters */
+    llvm::FunctionType *functionType(ARStack &context, bool withDims);
+
+    /* shapes: constant array shape per argument (nullptr for scalars), or nullptr for the generic version */
+    llvm::Function *emit(ARStack &context, const std::string &name, const std::vector<std::vector<uint32_t> *> *shapes);
 };
 
 class NFunctionCall : public NExpression {
 public:
     const NIdentifier &id;
     ExpressionList params;
+    /* the operand of `await`: scanf/gets then run on the I/O thread while the caller waits */
+    bool awaited = false;
 
     NFunctionCall(const NIdentifier &id, ExpressionList &params) : id(id), params(params) {}
 
     NFunctionCall(const NIdentifier &id) : id(id) {}
 
+    ~NFunctionCall() override {
+        delete &id;
+        for (auto item: params) delete item;
+    }
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+/* `await e`, where e calls an async function, names a task, or is a scanf/gets call */
+class NAwait : public NExpression {
+public:
+    NExpression *expression;
+
+    explicit NAwait(NExpression *expression) : expression(expression) {}
+
+    ~NAwait() override { delete expression; }
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+class NClassDeclaration : public NStatement {
+public:
+    NIdentifier *id = nullptr;
+    VariableList fields;
+    std::vector<NFunctionDeclaration *> methods;
+    /* `soa class`: arrays of it keep each field in a column of its own, see ARStack::columnPointer */
+    bool structOfArrays = false;
+
+    NClassDeclaration() = default;
+
+    ~NClassDeclaration() override;
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+class NNewObject : public NExpression {
+public:
+    const NIdentifier &type;
+
+    explicit NNewObject(const NIdentifier &type) : type(type) {}
+
+    ~NNewObject() override { delete &type; }
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+class NMemberAccess : public NExpression {
+public:
+    NIdentifier &object;
+    const NIdentifier &member;
+    ExpressionList *arrayIndices;
+
+    NMemberAccess(NIdentifier &object, const NIdentifier &member, ExpressionList *arrayIndices = nullptr) :
+            object(object), member(member), arrayIndices(arrayIndices) {}
+
+    ~NMemberAccess() override;
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+class NMethodCall : public NExpression {
+public:
+    NIdentifier &object;
+    NFunctionCall &call;
+    ExpressionList *arrayIndices;
+
+    NMethodCall(NIdentifier &object, NFunctionCall &call, ExpressionList *arrayIndices = nullptr) :
+            object(object), call(call), arrayIndices(arrayIndices) {}
+
+    ~NMethodCall() override;
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -255,6 +383,11 @@ public:
 
     NArrayElement(const NIdentifier &id, ExpressionList &arrayIndices) : id(id), arrayIndices(arrayIndices) {}
 
+    ~NArrayElement() override {
+        delete &id;
+        for (auto item: arrayIndices) delete item;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -264,6 +397,8 @@ public:
 
     NArrayType(ArrayDimension *arrDim, NIdentifier &id) : arrDim(arrDim), NIdentifier(id) {}
 
+    ~NArrayType() override;
+
     ArrayDimension *getArrayDim() override { return arrDim; }
 };
 
@@ -276,6 +411,12 @@ public:
     NIfStatement(NExpression *condition, NBlock *thenBlock, NBlock *elseBlock = nullptr) :
             condition(condition), thenBlock(thenBlock), elseBlock(elseBlock) {}
 
+    ~NIfStatement() override {
+        delete condition;
+        delete thenBlock;
+        delete elseBlock;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -289,6 +430,42 @@ public:
     NForStatement(NStatement *init, NExpression *condition, NStatement *inc, NBlock *block) :
             init(init), condition(condition), inc(inc), block(block) {}
 
+    ~NForStatement() override {
+        delete init;
+        delete condition;
+        delete inc;
+        delete block;
+    }
+
+    llvm::Value *codeGen(ARStack &context) override;
+};
+
+class NCase : public Node {
+public:
+    /* nullptr for `default` */
+    NExpression *value;
+    NBlock *block;
+
+    NCase(NExpression *value, NBlock *block) : value(value), block(block) {}
+
+    ~NCase() override {
+        delete value;
+        delete block;
+    }
+};
+
+class NSwitchStatement : public NStatement {
+public:
+    NExpression *condition;
+    CaseList cases;
+
+    NSwitchStatement(NExpression *condition, CaseList cases) : condition(condition), cases(std::move(cases)) {}
+
+    ~NSwitchStatement() override {
+        delete condition;
+        for (auto item: cases) delete item;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -327,6 +504,11 @@ public:
 
     NWhileStatement(NExpression *condition, NBlock *block) : condition(condition), block(block) {}
 
+    ~NWhileStatement() override {
+        delete condition;
+        delete block;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
@@ -337,7 +519,86 @@ public:
 
     NDoWhileStatement(NExpression *condition, NBlock *block) : condition(condition), block(block) {}
 
+    ~NDoWhileStatement() override {
+        delete condition;
+        delete block;
+    }
+
     llvm::Value *codeGen(ARStack &context) override;
 };
 
+inline void deleteArrayDim(ArrayDimension *arrDim) {
+    if (!arrDim) return;
+    for (auto dim: *arrDim) delete dim;
+    delete arrDim;
+}
+
+inline NArray::~NArray() {
+    delete type;
+    deleteArrayDim(arrDim);
+    if (initList) {
+        for (auto item: *initList) delete item;
+        delete initList;
+    }
+}
+
+inline NAssignment::~NAssignment() {
+    delete &lhs;
+    delete &rhs;
+}
+
+inline NClassAssignment::~NClassAssignment() {
+    delete &attribute;
+    if (arrayIndices) {
+        for (auto item: *arrayIndices) delete item;
+        delete arrayIndices;
+    }
+}
+
+inline NMemberAccess::~NMemberAccess() {
+    delete &object;
+    delete &member;
+    if (arrayIndices) {
+        for (auto item: *arrayIndices) delete item;
+        delete arrayIndices;
+    }
+}
+
+inline NMethodCall::~NMethodCall() {
+    delete &object;
+    delete &call;
+    if (arrayIndices) {
+        for (auto item: *arrayIndices) delete item;
+        delete arrayIndices;
+    }
+}
+
+inline NArrayType::~NArrayType() {
+    deleteArrayDim(arrDim);
+}
+
+/* functions and classes are referenced by the code generator for the whole module, see ARStack */
+inline bool isRetained(NStatement *statement) {
+    return dynamic_cast<NFunctionDeclaration *>(statement) || dynamic_cast<NClassDeclaration *>(statement);
+}
+
+inline NBlock::~NBlock() {
+    for (auto statement: statements) {
+        if (!isRetained(statement)) delete statement;
+    }
+}
+
+inline NFunctionDeclaration::~NFunctionDeclaration() {
+    delete &type;
+    delete &id;
+    for (auto item: arguments) delete item;
+    delete &block;
+}
+
+inline NClassDeclaration::~NClassDeclaration() {
+    delete id;
+    for (auto item: fields) delete item;
+    for (auto item: methods) delete item;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#ifndef PHEMIA_SERVER_HPP
+#define PHEMIA_SERVER_HPP
+
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define purgeInput(file) fpurge(file)
+#else
+#include <stdio_ext.h>
+#define purgeInput(file) __fpurge(file)
+#endif
+
+#include "driver.hpp"
+#include "engine.hpp"
+
+/*
+ * phemiad: `Phemia --daemon <socket>` keeps LLVM initialized and serves compilations over a Unix
+ * socket, see client/phemiac.c. A request carries the command line arguments of a Phemia
+ * invocation together with the client's working directory and stdio descriptors, so it behaves
+ * exactly like running Phemia in the client's shell. `--jit` runs are cached by source text and
+ * the options that change the code (CompileOptions::codeKey), and rerun on the already compiled
+ * (and possibly tiered up) code.
+ *
+ * Wire format, client to server: a uint32 payload length sent together with 4 descriptors
+ * (SCM_RIGHTS: cwd, stdin, stdout, stderr), then the arguments, each terminated by '\0'.
+ * Server to client: the int32 exit status.
+ */
+class CompileServer {
+    struct CachedRun {
+        /* the options' codeKey, then the source */
+        std::string key;
+        std::string ir;
+        /* declared before engine, which owns the module living in the context */
+        std::unique_ptr<ARStack> context;
+        std::unique_ptr<TieredEngine> engine;
+    };
+
+    std::string socketPath;
+    size_t cacheSize;
+    /* most recently used first */
+    std::list<std::unique_ptr<CachedRun>> cache;
+
+    static bool readFully(int fd, void *data, size_t size) {
+        auto p = (char *) data;
+        while (size) {
+            auto n = read(fd, p, size);
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    static bool readFile(const std::string &path, std::string &content) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        content = buffer.str();
+        return true;
+    }
+
+    int handle(const std::vector<std::string> &args) {
+        auto options = CompileOptions::parse(args);
+        std::string source;
+        if (!readFile(options.file, source)) {
+            printf("couldn't open file for reading\n");
+            return -1;
+        }
+
+        auto key = options.codeKey() + '\0' + source;
+        if (options.jit) {
+            for (auto it = cache.begin(); it != cache.end(); it++) {
+                if ((*it)->key != key) continue;
+                cache.splice(cache.begin(), cache, it);
+                std::ofstream(options.output) << cache.front()->ir;
+                return cache.front()->engine->rerun().IntVal.getSExtValue();
+            }
+        }
+
+        auto context = std::unique_ptr<ARStack>(new ARStack());
+        /* tiered engines of cached runs keep their workers */
+        context->constEval.threaded = true;
+        FILE *fp = fmemopen((void *) source.data(), source.size(), "r");
+        bool parsed = fp && compileSource(fp, *context, options);
+        if (fp) fclose(fp);
+        if (!parsed) {
+            printf("couldn't complete lex parse\n");
+            return -1;
+        }
+        if (!options.jit) return emitObject(*context, options) ? 0 : 1;
+
+        auto run = std::unique_ptr<CachedRun>(new CachedRun());
+        run->key = key;
+        readFile(options.output, run->ir);
+        run->context = std::move(context);
+        run->engine = std::unique_ptr<TieredEngine>(new TieredEngine());
+        auto result = run->engine->run(run->context->module, "main").IntVal.getSExtValue();
+        cache.push_front(std::move(run));
+        if (cache.size() > cacheSize) cache.pop_back();
+        return (int) result;
+    }
+
+    /* receive one request, run it with the client's cwd and stdio, reply with the exit status */
+    void serveClient(int conn, int home) {
+        uint32_t length = 0;
+        int fds[4];
+        char control[CMSG_SPACE(sizeof(fds))];
+        iovec iov{&length, sizeof(length)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn, &msg, MSG_WAITALL) != sizeof(length)) return;
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            std::cerr << "phemiad: request without descriptors" << std::endl;
+            return;
+        }
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        std::string payload(length, '\0');
+        std::vector<std::string> args;
+        if (readFully(conn, &payload[0], length)) {
+            size_t start = 0;
+            for (size_t i = 0; i < payload.size(); i++) {
+                if (payload[i] != '\0') continue;
+                args.push_back(payload.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+
+        int saved[3] = {dup(0), dup(1), dup(2)};
+        if (fchdir(fds[0]) == 0) {
+            for (int i = 0; i < 3; i++) dup2(fds[i + 1], i);
+            int32_t status = args.empty() ? -1 : handle(args);
+            fflush(stdout);
+            fflush(stderr);
+            std::cout.flush();
+            purgeInput(stdin);
+            clearerr(stdin);
+            for (int i = 0; i < 3; i++) dup2(saved[i], i);
+            if (fchdir(home) != 0) std::cerr << "phemiad: cannot return to working directory" << std::endl;
+            if (write(conn, &status, sizeof(status)) != sizeof(status)) {
+                std::cerr << "phemiad: client went away" << std::endl;
+            }
+        }
+        for (int fd: saved) close(fd);
+        for (int fd: fds) close(fd);
+    }
+
+public:
+    explicit CompileServer(std::string socketPath, size_t cacheSize = 16) : socketPath(std::move(socketPath)),
+                                                                            cacheSize(cacheSize) {}
+
+    int serve() {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "phemiad: socket path too long" << std::endl;
+            return 1;
+        }
+        std::strcpy(addr.sun_path, socketPath.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socketPath.c_str());
+        if (listener < 0 || bind(listener, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+            perror("phemiad");
+            return 1;
+        }
+        signal(SIGPIPE, SIG_IGN);
+        int home = open(".", O_RDONLY);
+
+        while (true) {
+            int conn = accept(listener, nullptr, nullptr);
+            if (conn < 0) continue;
+            serveClient(conn, home);
+            close(conn);
+        }
+    }
+};
+
+#endif //PHEMIA_SERVER_HPP
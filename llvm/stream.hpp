@@ -0,0 +1,51 @@
+#ifndef PHEMIA_STREAM_HPP
+#define PHEMIA_STREAM_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "node.h"
+
+/*
+ * Bounded queue of top-level statements, filled by the parser and drained by the code generator
+ * running on another thread (see ARStack::generateCode). The bound keeps the parser from running
+ * arbitrarily far ahead, so only a window of the AST is alive at any time.
+ */
+class StatementStream {
+    std::deque<NStatement *> queue;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit StatementStream(size_t capacity = 64) : capacity(capacity) {}
+
+    void push(NStatement *statement) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return queue.size() < capacity; });
+        queue.push_back(statement);
+        notEmpty.notify_one();
+    }
+
+    /* nullptr once the stream is closed and drained */
+    NStatement *pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !queue.empty(); });
+        if (queue.empty()) return nullptr;
+        auto statement = queue.front();
+        queue.pop_front();
+        notFull.notify_one();
+        return statement;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+#endif //PHEMIA_STREAM_HPP
@@ -0,0 +1,182 @@
+#ifndef PHEMIA_TARGET_HPP
+#define PHEMIA_TARGET_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Host.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
+
+/*
+ * The machine generated code is for: `--march=<cpu>` (or `native`, the host's CPU and features) and
+ * `--multiversion`. Without either the module stays target neutral and llc's defaults apply, as
+ * before. The choice is recorded as the module's triple and each function's target-cpu and
+ * target-features, so llc, `--obj` (Backend) and the JIT all honour it.
+ *
+ * Multiversioning compiles every function with a loop once more per x86-64 ISA level of the psABI
+ * (x86-64-v2: SSE4.2, v3: AVX2 and FMA, v4: AVX-512). The original name becomes an ifunc whose
+ * resolver asks phemia_cpu_level (runtime/cpu.c) once, when the program is loaded, which one this
+ * machine runs; calls then cost an indirect jump. main itself cannot be an ifunc, the C runtime
+ * calls it, so when it has loops its body moves to `phemia.main` and main calls that.
+ */
+struct TargetChoice {
+    /* empty for llc's default */
+    std::string cpu;
+    std::string features;
+    bool multiversion = false;
+
+    /* --march=<cpu>, where native means the host */
+    void setArch(const std::string &arch) {
+        if (arch != "native") {
+            cpu = arch;
+            features.clear();
+            return;
+        }
+        cpu = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> host;
+        features.clear();
+        if (!llvm::sys::getHostCPUFeatures(host)) return;
+        for (auto &feature: host) {
+            features += (features.empty() ? "" : ",") + std::string(feature.second ? "+" : "-") + feature.first().str();
+        }
+    }
+
+    /* false, with error set, when the host target or the CPU is unknown */
+    bool check(std::string &error) const {
+        return (cpu.empty() && !multiversion) || machine(error) != nullptr;
+    }
+
+    /* record the choice in module, after check() passed */
+    void apply(llvm::Module &module) const {
+        std::string error;
+        auto tm = cpu.empty() && !multiversion ? nullptr : machine(error);
+        if (!tm) return;
+        module.setTargetTriple(tm->getTargetTriple().str());
+        module.setDataLayout(tm->createDataLayout());
+        for (auto &function: module) {
+            if (function.isDeclaration()) continue;
+            if (!cpu.empty()) function.addFnAttr("target-cpu", cpu);
+            if (!features.empty()) function.addFnAttr("target-features", features);
+        }
+        if (multiversion && tm->getTargetTriple().getArch() == llvm::Triple::x86_64) multiversionAll(module);
+    }
+
+private:
+    std::unique_ptr<llvm::TargetMachine> machine(std::string &error) const {
+        auto triple = llvm::sys::getDefaultTargetTriple();
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) return nullptr;
+        /* the triple and datalayout do not depend on the CPU, and a generic one does not complain about it */
+        std::unique_ptr<llvm::TargetMachine> tm(target->createTargetMachine(
+                triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+        if (tm && !cpu.empty() && !tm->getMCSubtargetInfo()->isCPUStringValid(cpu)) {
+            error = "unknown CPU '" + cpu + "' for " + triple;
+            return nullptr;
+        }
+        return tm;
+    }
+
+    /* loops are where a wider ISA pays; coroutine parts are reached through pointers only */
+    static bool isHot(llvm::Function &function) {
+        if (function.isDeclaration() || function.hasAddressTaken() || function.isVarArg() ||
+            function.hasFnAttribute("coroutine.presplit")) {
+            return false;
+        }
+        llvm::DominatorTree dominators(function);
+        llvm::LoopInfo loops(dominators);
+        return !loops.empty();
+    }
+
+    static void multiversionAll(llvm::Module &module) {
+        std::vector<llvm::Function *> hot;
+        for (auto &function: module) {
+            if (isHot(function)) hot.push_back(&function);
+        }
+        if (hot.empty()) return;
+        auto &context = module.getContext();
+        auto levelType = llvm::FunctionType::get(llvm::Type::getInt32Ty(context), false);
+        auto cpuLevel = module.getOrInsertFunction("phemia_cpu_level", levelType);
+        for (auto function: hot) {
+            if (function->getName() == "main") function = moveMainBody(module, function);
+            addVersions(module, function, cpuLevel);
+        }
+    }
+
+    static llvm::Function *moveMainBody(llvm::Module &module, llvm::Function *main) {
+        main->setName("phemia.main");
+        auto stub = llvm::Function::Create(main->getFunctionType(), llvm::GlobalValue::ExternalLinkage, "main",
+                                           &module);
+        stub->copyAttributesFrom(main);
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(module.getContext(), "entry", stub));
+        std::vector<llvm::Value *> args;
+        for (auto &arg: stub->args()) args.push_back(&arg);
+        auto result = builder.CreateCall(main, args);
+        if (result->getType()->isVoidTy()) builder.CreateRetVoid();
+        else builder.CreateRet(result);
+        return main;
+    }
+
+    static void addVersions(llvm::Module &module, llvm::Function *function, llvm::FunctionCallee cpuLevel) {
+        static const char *const levels[] = {"x86-64-v2", "x86-64-v3", "x86-64-v4"};
+        auto name = function->getName().str();
+        std::vector<llvm::Function *> versions{function};
+        for (auto level: levels) {
+            llvm::ValueToValueMapTy map;
+            auto clone = llvm::CloneFunction(function, map);
+            clone->setName(name + "." + level);
+            clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+            clone->addFnAttr("target-cpu", level);
+            /* the level implies its features, --march's would contradict it */
+            clone->removeFnAttr("target-features");
+            versions.push_back(clone);
+        }
+        /* a recursive call stays in the version it is made from */
+        for (auto version: versions) {
+            for (auto use = function->use_begin(); use != function->use_end();) {
+                auto &current = *use++;
+                auto inst = llvm::dyn_cast<llvm::Instruction>(current.getUser());
+                if (inst && inst->getFunction() == version) current.set(version);
+            }
+        }
+
+        auto pointerType = function->getType();
+        auto resolver = llvm::Function::Create(llvm::FunctionType::get(pointerType, false),
+                                               llvm::GlobalValue::InternalLinkage, name + ".resolver", &module);
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(module.getContext(), "entry", resolver));
+        auto level = builder.CreateCall(cpuLevel, {}, "level");
+        llvm::Value *chosen = versions[0];
+        for (unsigned i = 1; i < versions.size(); i++) {
+            chosen = builder.CreateSelect(builder.CreateICmpUGE(level, builder.getInt32(i)), versions[i], chosen);
+        }
+        builder.CreateRet(chosen);
+
+        auto linkage = function->getLinkage();
+        auto ifunc = llvm::GlobalIFunc::create(function->getFunctionType(), pointerType->getAddressSpace(), linkage,
+                                               name + ".ifunc", resolver, &module);
+        function->replaceUsesWithIf(ifunc, [function, resolver](llvm::Use &use) {
+            auto inst = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+            return !inst || (inst->getFunction() != function && inst->getFunction() != resolver);
+        });
+        function->setName(name + ".default");
+        function->setLinkage(llvm::GlobalValue::InternalLinkage);
+        ifunc->setName(name);
+    }
+};
+
+#endif //PHEMIA_TARGET_HPP
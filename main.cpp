@@ -1,37 +1,38 @@
 #include <iostream>
 #include "codeGen.hpp"
-#include "coreFunc.hpp"
+#include "driver.hpp"
 #include "node.h"
-
-extern FILE *yyin;
-
-extern int yyparse();
-
-extern NBlock *programBlock;
+#include "server.hpp"
 
 int main(int argc, char **argv) {
-    if (argc == 0) {
+    if (argc < 2) {
         std::cerr << "Invalid Param!\n";
         std::exit(1);
     }
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    if (std::string(argv[1]) == "--daemon") {
+        CompileServer server(argc > 2 ? argv[2] : "/tmp/phemiad.sock");
+        return server.serve();
+    }
 
-    FILE *fp = fopen(argv[1], "r");
+    auto options = CompileOptions::parse(std::vector<std::string>(argv + 1, argv + argc));
+    FILE *fp = fopen(options.file.c_str(), "r");
     if (!fp) {
         printf("couldn't open file for reading\n");
         exit(-1);
     }
-    yyin = fp;
-    int parseErr = yyparse();
-    if (parseErr != 0) {
+    ARStack context;
+    if (!compileSource(fp, context, options)) {
         printf("couldn't complete lex parse\n");
         exit(-1);
     }
     fclose(fp);
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
-    ARStack context;
-    createCoreFunction(context);
-    context.generateCode(*programBlock, "test/output.ll");
+    if (!emitObject(context, options)) return 1;
+    if (options.jit) {
+        return context.runCode().IntVal.getSExtValue();
+    }
     return 0;
 }
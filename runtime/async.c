@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include "async.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+ * One I/O thread works through the submitted operations in order; everything else (ready tasks,
+ * resuming them) happens on the thread running the program. Regular files cannot be watched with
+ * epoll, so reads are blocking calls on the I/O thread and epoll only waits for it to finish one.
+ */
+
+typedef struct Request {
+    struct Request *next;
+    PhemiaOperation op;
+    void **args;
+    int32_t *result;
+    void *task;
+} Request;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t submitted = PTHREAD_COND_INITIALIZER;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+static Request *head = NULL;
+static Request *tail = NULL;
+/* tickets handed out and operations finished, which happens in ticket order */
+static int64_t issued = 0;
+static int64_t finished = 0;
+/* finished operations phemia_loop_next has told about, touched by the program's thread only */
+static int64_t reported = 0;
+/* set while the program's thread waits in epoll, only then is the eventfd written */
+static int sleeping = 0;
+
+/* ring of ready tasks */
+static void **ready = NULL;
+static size_t readyHead = 0;
+static size_t readyCount = 0;
+static size_t readyCap = 0;
+
+static int wake = -1;
+static int poller = -1;
+
+static void fail(const char *what) {
+    perror(what);
+    abort();
+}
+
+/* with lock held */
+static void pushReady(void *task) {
+    if (readyCount == readyCap) {
+        size_t cap = readyCap ? readyCap * 2 : 16;
+        void **grown = malloc(cap * sizeof(void *));
+        if (!grown) abort();
+        for (size_t i = 0; i < readyCount; i++) grown[i] = ready[(readyHead + i) % readyCap];
+        free(ready);
+        ready = grown;
+        readyHead = 0;
+        readyCap = cap;
+    }
+    ready[(readyHead + readyCount++) % readyCap] = task;
+}
+
+static void *serve(void *unused) {
+    (void) unused;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!head) pthread_cond_wait(&submitted, &lock);
+        Request *request = head;
+        head = request->next;
+        if (!head) tail = NULL;
+        pthread_mutex_unlock(&lock);
+
+        int32_t result = request->op(request->args);
+
+        pthread_mutex_lock(&lock);
+        *request->result = result;
+        if (request->task) pushReady(request->task);
+        finished++;
+        int notify = sleeping;
+        sleeping = 0;
+        pthread_mutex_unlock(&lock);
+        free(request);
+        uint64_t one = 1;
+        if (notify && write(wake, &one, sizeof(one)) != sizeof(one)) fail("phemia: event loop");
+    }
+    return NULL;
+}
+
+static void start(void) {
+    wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    poller = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = wake};
+    if (wake < 0 || poller < 0 || epoll_ctl(poller, EPOLL_CTL_ADD, wake, &event) != 0) fail("phemia: event loop");
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve, NULL) != 0) fail("phemia: I/O thread");
+    pthread_detach(thread);
+}
+
+int64_t phemia_io_submit(PhemiaOperation op, void **args, int32_t *result, void *task) {
+    pthread_once(&started, start);
+    Request *request = malloc(sizeof(Request));
+    if (!request) abort();
+    *request = (Request) {NULL, op, args, result, task};
+    pthread_mutex_lock(&lock);
+    if (tail) tail->next = request;
+    else head = request;
+    tail = request;
+    int64_t ticket = ++issued;
+    pthread_cond_signal(&submitted);
+    pthread_mutex_unlock(&lock);
+    return ticket;
+}
+
+int32_t phemia_io_done(int64_t ticket) {
+    pthread_mutex_lock(&lock);
+    int32_t done = finished >= ticket;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+void phemia_loop_ready(void *task) {
+    pthread_mutex_lock(&lock);
+    pushReady(task);
+    pthread_mutex_unlock(&lock);
+}
+
+void *phemia_loop_next(void) {
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        if (readyCount) {
+            void *task = ready[readyHead];
+            readyHead = (readyHead + 1) % readyCap;
+            readyCount--;
+            pthread_mutex_unlock(&lock);
+            return task;
+        }
+        int64_t done = finished;
+        int64_t outstanding = issued - finished;
+        pthread_mutex_unlock(&lock);
+        if (done != reported) {
+            reported = done;
+            return NULL;
+        }
+        if (!outstanding) {
+            /* only a task awaited twice, or never started, can wait on nothing */
+            fputs("phemia: await can never finish\n", stderr);
+            abort();
+        }
+        pthread_mutex_lock(&lock);
+        sleeping = finished == done;
+        int wait = sleeping;
+        pthread_mutex_unlock(&lock);
+        if (!wait) continue;
+        struct epoll_event event;
+        if (epoll_wait(poller, &event, 1, -1) < 0 && errno != EINTR) fail("phemia: event loop");
+        uint64_t count;
+        if (read(wake, &count, sizeof(count)) < 0 && errno != EAGAIN) fail("phemia: event loop");
+    }
+}
+
+int32_t phemia_loop_pending(void) {
+    pthread_mutex_lock(&lock);
+    int32_t pending = readyCount || issued != finished;
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
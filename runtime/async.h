@@ -0,0 +1,45 @@
+#ifndef PHEMIA_ASYNC_H
+#define PHEMIA_ASYNC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event loop behind `async` functions and `await`. Tasks are LLVM coroutines, opaque handles here:
+ * the runtime only queues them, generated code resumes or destroys what phemia_loop_next hands
+ * back. An awaited scanf/gets is outlined into a PhemiaOperation and run by a single I/O thread,
+ * in submission order, so reading and parsing the next input overlaps whatever the program computes
+ * meanwhile. Completions wake the loop through an eventfd watched with epoll.
+ */
+
+/* an outlined scanf/gets call, its arguments stored in args */
+typedef int32_t (*PhemiaOperation)(void **args);
+
+/*
+ * Run op(args) on the I/O thread. Once done its result is stored to *result and task, unless NULL,
+ * becomes ready. Returns a ticket for phemia_io_done.
+ */
+int64_t phemia_io_submit(PhemiaOperation op, void **args, int32_t *result, void *task);
+
+int32_t phemia_io_done(int64_t ticket);
+
+/* make a suspended task runnable; with the low bit set it is a finished task to destroy instead */
+void phemia_loop_ready(void *task);
+
+/*
+ * The next task to resume (or destroy, low bit set), waiting for the I/O thread when none is ready.
+ * NULL when an operation without a task finished, so the caller can check what it waits for.
+ */
+void *phemia_loop_next(void);
+
+/* whether any task is ready or any operation still outstanding */
+int32_t phemia_loop_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_ASYNC_H
@@ -0,0 +1,25 @@
+#include "cpu.h"
+
+/* -1 until first asked; resolvers run one after another while the program is loaded */
+static int32_t level = -1;
+
+int32_t phemia_cpu_level(void) {
+    if (level >= 0) return level;
+    int32_t found = 0;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    /* resolvers may run before the constructor that would otherwise do this */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2")) {
+        found = 1;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2")) {
+            found = 2;
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq")) {
+                found = 3;
+            }
+        }
+    }
+#endif
+    level = found;
+    return level;
+}
@@ -0,0 +1,22 @@
+#ifndef PHEMIA_CPU_H
+#define PHEMIA_CPU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The x86-64 ISA level of the running machine, as the psABI defines them: 0 for the baseline, 1 for
+ * x86-64-v2 (SSE4.2, POPCNT), 2 for x86-64-v3 (AVX2, FMA, BMI2) and 3 for x86-64-v4 (AVX-512).
+ * Always 0 elsewhere. The ifunc resolvers `--multiversion` generates call it while the program is
+ * loaded, before anything else of the runtime ran, so it only relies on the compiler's CPU model.
+ */
+int32_t phemia_cpu_level(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_CPU_H
@@ -0,0 +1,368 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "gc.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/*
+ * Mark-region heap (Immix style) for values generated code allocates at runtime.
+ * Small objects are bump-allocated by each thread into runs of free 128 byte lines inside
+ * 32 KiB blocks; objects above LARGE_OBJECT bytes get their own malloc'd chunk.
+ * Objects never move, so generated code may keep raw pointers in registers. Marking starts
+ * from the shadow stack of the collecting thread and from the pinned frames of async tasks, so
+ * generated programs are expected to run a single mutator. Class objects keep their reference
+ * fields first, so an object is traced by visiting the `refs` leading words recorded in its header;
+ * arrays of references of any length (e.g. the keys of a string keyed map) set ALL_REFS instead.
+ */
+
+#define BLOCK_SIZE (32 * 1024)
+#define LINE_SIZE 128
+#define LINES (BLOCK_SIZE / LINE_SIZE)
+#define LARGE_OBJECT (8 * 1024)
+#define MIN_THRESHOLD (4 * 1024 * 1024)
+
+typedef struct Header {
+    uint32_t size;
+    uint8_t mark;
+    uint8_t flags;
+    uint16_t refs;
+} Header;
+
+/* Header.flags */
+#define LARGE 1
+#define ALL_REFS 2
+
+typedef struct Block {
+    struct Block *next;
+    uint8_t lineMark[LINES];
+} Block;
+
+#define FIRST_LINE ((sizeof(Block) + LINE_SIZE - 1) / LINE_SIZE)
+
+typedef struct LargeObject {
+    struct LargeObject *next;
+    uint64_t pad;
+    Header header;
+} LargeObject;
+
+/* open addressing set of block bases and (tagged) large object payloads */
+typedef struct AddrSet {
+    uintptr_t *keys;
+    size_t cap;
+    size_t used;
+} AddrSet;
+
+#define TOMBSTONE ((uintptr_t) 1)
+
+static pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+static Block *blocks = NULL;
+static Block *lastBlock = NULL;
+static Block *scanBlock = NULL;
+static size_t scanLine = FIRST_LINE;
+static LargeObject *largeObjects = NULL;
+static AddrSet heapAddrs = {NULL, 0, 0};
+/* lines handed out or found live since the last collection carry the current epoch */
+static uint8_t epoch = 1;
+static size_t allocated = 0;
+static size_t threshold = MIN_THRESHOLD;
+static void **markStack = NULL;
+static size_t markTop = 0;
+static size_t markCap = 0;
+
+static _Thread_local char *cursor = NULL;
+static _Thread_local char *limit = NULL;
+static _Thread_local PhemiaFrame *top = NULL;
+/* bytes this thread allocates before its next heap profile sample, see runtime/profile.h */
+static _Thread_local int64_t untilSample = 0;
+static _Thread_local int sampling = 0;
+static PhemiaFrame **pinned = NULL;
+static size_t pinnedCount = 0;
+static size_t pinnedCap = 0;
+
+/*
+ * Fibonacci hashing: the top bits of the product depend on every bit of the key. The low bits depend
+ * only on the key's low bits, and those are all zero for 32 KiB aligned block bases.
+ */
+static size_t hashAddr(uintptr_t key, size_t cap) {
+    return (size_t) (((uint64_t) key * 0x9E3779B97F4A7C15ull) >> (64 - __builtin_ctzll(cap)));
+}
+
+static void addrSetInsert(AddrSet *set, uintptr_t key);
+
+static void addrSetGrow(AddrSet *set) {
+    AddrSet old = *set;
+    set->cap = old.cap ? old.cap * 2 : 64;
+    set->keys = calloc(set->cap, sizeof(uintptr_t));
+    set->used = 0;
+    for (size_t i = 0; i < old.cap; i++) {
+        if (old.keys[i] && old.keys[i] != TOMBSTONE) addrSetInsert(set, old.keys[i]);
+    }
+    free(old.keys);
+}
+
+static void addrSetInsert(AddrSet *set, uintptr_t key) {
+    if ((set->used + 1) * 2 > set->cap) addrSetGrow(set);
+    size_t i = hashAddr(key, set->cap);
+    while (set->keys[i] && set->keys[i] != TOMBSTONE) i = (i + 1) & (set->cap - 1);
+    set->keys[i] = key;
+    set->used++;
+}
+
+static size_t addrSetFind(const AddrSet *set, uintptr_t key) {
+    if (!set->cap) return (size_t) -1;
+    size_t i = hashAddr(key, set->cap);
+    while (set->keys[i]) {
+        if (set->keys[i] == key) return i;
+        i = (i + 1) & (set->cap - 1);
+    }
+    return (size_t) -1;
+}
+
+static void addrSetErase(AddrSet *set, uintptr_t key) {
+    size_t i = addrSetFind(set, key);
+    if (i != (size_t) -1) set->keys[i] = TOMBSTONE;
+}
+
+static Block *newBlock(void) {
+    Block *block = NULL;
+    if (posix_memalign((void **) &block, BLOCK_SIZE, BLOCK_SIZE) != 0) abort();
+    memset(block, 0, sizeof(Block));
+    if (lastBlock) lastBlock->next = block;
+    else blocks = block;
+    lastBlock = block;
+    addrSetInsert(&heapAddrs, (uintptr_t) block);
+    return block;
+}
+
+/* claim the next run of free lines able to hold `bytes` as this thread's bump region */
+static void nextHole(size_t bytes) {
+    size_t need = (bytes + LINE_SIZE - 1) / LINE_SIZE;
+    while (1) {
+        if (!scanBlock) {
+            scanBlock = newBlock();
+            scanLine = FIRST_LINE;
+        }
+        while (scanLine < LINES) {
+            size_t start = scanLine;
+            while (start < LINES && scanBlock->lineMark[start] == epoch) start++;
+            size_t end = start;
+            while (end < LINES && scanBlock->lineMark[end] != epoch) end++;
+            scanLine = end;
+            if (end - start >= need) {
+                memset(scanBlock->lineMark + start, epoch, end - start);
+                allocated += (end - start) * LINE_SIZE;
+                cursor = (char *) scanBlock + start * LINE_SIZE;
+                limit = (char *) scanBlock + end * LINE_SIZE;
+                return;
+            }
+        }
+        scanBlock = scanBlock->next;
+        scanLine = FIRST_LINE;
+    }
+}
+
+static void pushMark(void *payload) {
+    if (markTop == markCap) {
+        markCap = markCap ? markCap * 2 : 256;
+        markStack = realloc(markStack, markCap * sizeof(void *));
+        if (!markStack) abort();
+    }
+    markStack[markTop++] = payload;
+}
+
+/* values outside the heap (literals, constant globals) are ignored */
+static void markObject(void *payload) {
+    uintptr_t addr = (uintptr_t) payload;
+    Header *header = (Header *) payload - 1;
+    if (addrSetFind(&heapAddrs, addr | 1) == (size_t) -1) {
+        Block *block = (Block *) (addr & ~(uintptr_t) (BLOCK_SIZE - 1));
+        if (addrSetFind(&heapAddrs, (uintptr_t) block) == (size_t) -1) return;
+        if (header->mark == epoch) return;
+        size_t first = ((uintptr_t) header - (uintptr_t) block) / LINE_SIZE;
+        size_t last = ((uintptr_t) payload + header->size - 1 - (uintptr_t) block) / LINE_SIZE;
+        memset(block->lineMark + first, epoch, last - first + 1);
+    } else if (header->mark == epoch) {
+        return;
+    }
+    header->mark = epoch;
+    if (header->refs || (header->flags & ALL_REFS)) pushMark(payload);
+}
+
+static void markAll(void) {
+    while (markTop) {
+        void **fields = markStack[--markTop];
+        Header *header = (Header *) fields - 1;
+        size_t refs = header->flags & ALL_REFS ? header->size / sizeof(void *) : header->refs;
+        for (size_t i = 0; i < refs; i++) {
+            if (fields[i]) markObject(fields[i]);
+        }
+    }
+}
+
+static int isMarked(void *payload) {
+    return ((Header *) payload - 1)->mark == epoch;
+}
+
+static void collectLocked(void) {
+    epoch = epoch == UINT8_MAX ? 1 : epoch + 1;
+    if (epoch == 1) {
+        /* epochs wrapped, stale marks could look current */
+        for (Block *block = blocks; block; block = block->next) memset(block->lineMark, 0, LINES);
+        for (LargeObject *obj = largeObjects; obj; obj = obj->next) obj->header.mark = 0;
+    }
+
+    size_t live = 0;
+    for (PhemiaFrame *frame = top; frame; frame = frame->prev) {
+        for (int64_t i = 0; i < frame->count; i++) {
+            void *payload = *frame->slots[i];
+            if (payload) markObject(payload);
+        }
+    }
+    for (size_t k = 0; k < pinnedCount; k++) {
+        for (int64_t i = 0; i < pinned[k]->count; i++) {
+            void *payload = *pinned[k]->slots[i];
+            if (payload) markObject(payload);
+        }
+    }
+    markAll();
+    /* before dead large objects, and the headers of sampled ones, are freed */
+    if (phemia_profile_rate) phemia_profile_sweep(isMarked);
+
+    LargeObject **link = &largeObjects;
+    while (*link) {
+        LargeObject *obj = *link;
+        if (obj->header.mark != epoch) {
+            *link = obj->next;
+            addrSetErase(&heapAddrs, (uintptr_t) (&obj->header + 1) | 1);
+            free(obj);
+        } else {
+            live += obj->header.size;
+            link = &obj->next;
+        }
+    }
+    for (Block *block = blocks; block; block = block->next) {
+        for (size_t i = FIRST_LINE; i < LINES; i++) {
+            if (block->lineMark[i] == epoch) live += LINE_SIZE;
+        }
+    }
+
+    scanBlock = blocks;
+    scanLine = FIRST_LINE;
+    cursor = limit = NULL;
+    allocated = 0;
+    threshold = live * 2 > MIN_THRESHOLD ? live * 2 : MIN_THRESHOLD;
+}
+
+static void *allocLarge(size_t size) {
+    LargeObject *obj = calloc(1, sizeof(LargeObject) + size);
+    if (!obj) abort();
+    obj->header.size = (uint32_t) size;
+    obj->header.flags = LARGE;
+    obj->next = largeObjects;
+    largeObjects = obj;
+    addrSetInsert(&heapAddrs, (uintptr_t) (&obj->header + 1) | 1);
+    return &obj->header + 1;
+}
+
+static void *place(size_t size, uint16_t refs, uint8_t flags) {
+    size_t total = sizeof(Header) + size;
+    if (cursor && cursor + total <= limit) {
+        Header *header = (Header *) cursor;
+        cursor += total;
+        header->size = (uint32_t) size;
+        header->mark = 0;
+        header->flags = flags;
+        header->refs = refs;
+        memset(header + 1, 0, size);
+        return header + 1;
+    }
+
+    pthread_mutex_lock(&heapLock);
+    if (allocated > threshold) collectLocked();
+    void *payload;
+    if (total > LARGE_OBJECT) {
+        allocated += total;
+        payload = allocLarge(size);
+        ((Header *) payload - 1)->flags |= flags;
+        ((Header *) payload - 1)->refs = refs;
+    } else {
+        nextHole(total);
+        Header *header = (Header *) cursor;
+        cursor += total;
+        header->size = (uint32_t) size;
+        header->mark = 0;
+        header->flags = flags;
+        header->refs = refs;
+        memset(header + 1, 0, size);
+        payload = header + 1;
+    }
+    pthread_mutex_unlock(&heapLock);
+    return payload;
+}
+
+static void *allocate(int64_t bytes, uint16_t refs, uint8_t flags) {
+    size_t size = ((size_t) bytes + 7) & ~(size_t) 7;
+    void *payload = place(size, refs, flags);
+    if (phemia_profile_rate && !sampling) {
+        /* a thread's first gap is drawn at its first allocation */
+        untilSample = phemia_profile_record(NULL, 0);
+        sampling = 1;
+    }
+    if (phemia_profile_rate && (untilSample -= (int64_t) size) < 0) {
+        untilSample = phemia_profile_record(payload, (int64_t) size);
+    }
+    return payload;
+}
+
+void *phemia_gc_alloc(int64_t bytes) {
+    return allocate(bytes, 0, 0);
+}
+
+void *phemia_gc_alloc_object(int64_t bytes, int64_t refs) {
+    return allocate(bytes, (uint16_t) refs, 0);
+}
+
+void *phemia_gc_alloc_refs(int64_t count) {
+    return allocate(count * (int64_t) sizeof(void *), 0, ALL_REFS);
+}
+
+void phemia_gc_push(PhemiaFrame *frame) {
+    frame->prev = top;
+    top = frame;
+}
+
+void phemia_gc_pop(PhemiaFrame *frame) {
+    top = frame->prev;
+}
+
+void phemia_gc_pin(PhemiaFrame *frame) {
+    pthread_mutex_lock(&heapLock);
+    if (pinnedCount == pinnedCap) {
+        pinnedCap = pinnedCap ? pinnedCap * 2 : 16;
+        pinned = realloc(pinned, pinnedCap * sizeof(PhemiaFrame *));
+        if (!pinned) abort();
+    }
+    pinned[pinnedCount++] = frame;
+    pthread_mutex_unlock(&heapLock);
+}
+
+void phemia_gc_unpin(PhemiaFrame *frame) {
+    pthread_mutex_lock(&heapLock);
+    for (size_t k = 0; k < pinnedCount; k++) {
+        if (pinned[k] == frame) {
+            pinned[k] = pinned[--pinnedCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heapLock);
+}
+
+void phemia_gc_collect(void) {
+    pthread_mutex_lock(&heapLock);
+    collectLocked();
+    pthread_mutex_unlock(&heapLock);
+}
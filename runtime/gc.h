@@ -0,0 +1,44 @@
+#ifndef PHEMIA_GC_H
+#define PHEMIA_GC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shadow stack frame pushed by every generated function that holds heap references.
+ * Layout must match ARStack::emitGCFrame: { i8*, i64, [count x i8**] }.
+ */
+typedef struct PhemiaFrame {
+    struct PhemiaFrame *prev;
+    int64_t count;
+    void **slots[];
+} PhemiaFrame;
+
+/* zeroed, 8-byte aligned storage for arrays, strings and objects */
+void *phemia_gc_alloc(int64_t bytes);
+
+/* like phemia_gc_alloc, the first `refs` words of the object are traced as references */
+void *phemia_gc_alloc_object(int64_t bytes, int64_t refs);
+
+/* an array of count references, all of them traced */
+void *phemia_gc_alloc_refs(int64_t count);
+
+void phemia_gc_push(PhemiaFrame *frame);
+
+void phemia_gc_pop(PhemiaFrame *frame);
+
+/* frames of async functions, scanned from pin until unpin whether the task is running or suspended */
+void phemia_gc_pin(PhemiaFrame *frame);
+
+void phemia_gc_unpin(PhemiaFrame *frame);
+
+void phemia_gc_collect(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_GC_H
@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "io.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Numbers are converted by hand: integers two digits at a time from a table, fixed point values
+ * by scaling to an integer where that is provably exact after rounding, and everything else (huge
+ * values, ties, infinities) falls back to stdio so the output always matches printf. No libm.
+ */
+
+static const char digitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+/* scaled values below this have an error under 2^-13, so their rounding is decided well clear of a tie */
+#define EXACT_LIMIT 1099511627776.0
+#define TIE_MARGIN (1.0 / 1024)
+
+/* the decimal digits of value, ending right before end; returns where they start */
+static char *formatUnsigned(uint64_t value, char *end) {
+    while (value >= 100) {
+        const char *pair = digitPairs + (value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        end[0] = pair[0];
+        end[1] = pair[1];
+    }
+    if (value >= 10) {
+        end -= 2;
+        end[0] = digitPairs[value * 2];
+        end[1] = digitPairs[value * 2 + 1];
+    } else {
+        *--end = (char) ('0' + value);
+    }
+    return end;
+}
+
+static void pad(char c, size_t count) {
+    while (count--) putc(c, stdout);
+}
+
+/* sign and body padded to width the way printf does it, with a single write where it fits */
+static int32_t emit(const char *sign, size_t signLength, const char *body, size_t length, int32_t width,
+                    int32_t flags) {
+    size_t total = signLength + length;
+    size_t fill = width > 0 && (size_t) width > total ? (size_t) width - total : 0;
+    size_t leading = (flags & (PHEMIA_LEFT | PHEMIA_ZERO)) ? 0 : fill;
+    size_t zeros = (flags & PHEMIA_ZERO) && !(flags & PHEMIA_LEFT) ? fill : 0;
+    size_t trailing = (flags & PHEMIA_LEFT) ? fill : 0;
+    char buffer[128];
+    if (total + fill <= sizeof(buffer)) {
+        char *out = buffer;
+        memset(out, ' ', leading);
+        out += leading;
+        memcpy(out, sign, signLength);
+        out += signLength;
+        memset(out, '0', zeros);
+        out += zeros;
+        memcpy(out, body, length);
+        out += length;
+        memset(out, ' ', trailing);
+        out += trailing;
+        fwrite(buffer, 1, (size_t) (out - buffer), stdout);
+    } else {
+        pad(' ', leading);
+        fwrite(sign, 1, signLength, stdout);
+        pad('0', zeros);
+        fwrite(body, 1, length, stdout);
+        pad(' ', trailing);
+    }
+    return (int32_t) (total + fill);
+}
+
+int32_t phemia_write(const char *text, int64_t length) {
+    fwrite(text, 1, (size_t) length, stdout);
+    return (int32_t) length;
+}
+
+int32_t phemia_write_int(int32_t value, int32_t width, int32_t flags) {
+    char buffer[16];
+    char *end = buffer + sizeof(buffer);
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+    char *start = formatUnsigned(magnitude, end);
+    return emit("-", value < 0, start, (size_t) (end - start), width, flags);
+}
+
+int32_t phemia_write_char(int32_t value, int32_t width, int32_t flags) {
+    char c = (char) value;
+    return emit("", 0, &c, 1, width, flags & PHEMIA_LEFT);
+}
+
+int32_t phemia_write_str(const char *value, int32_t width, int32_t flags) {
+    if (!value) value = "(null)";
+    return emit("", 0, value, strlen(value), width, flags & PHEMIA_LEFT);
+}
+
+int32_t phemia_write_double(double value, int32_t precision, int32_t width, int32_t flags) {
+    if (precision < 0) precision = 6;
+    if (precision < (int32_t) (sizeof(powersOf10) / sizeof(powersOf10[0])) && isfinite(value)) {
+        int negative = signbit(value) != 0;
+        double magnitude = (negative ? -value : value) * powersOf10[precision];
+        if (magnitude < EXACT_LIMIT) {
+            uint64_t whole = (uint64_t) magnitude;
+            double fraction = magnitude - (double) whole;
+            if (fraction < 0.5 - TIE_MARGIN || fraction > 0.5 + TIE_MARGIN) {
+                uint64_t digits = whole + (fraction > 0.5);
+                uint64_t unit = (uint64_t) powersOf10[precision];
+                char buffer[48];
+                char *end = buffer + sizeof(buffer);
+                char *start = end;
+                if (precision) {
+                    start = formatUnsigned(digits % unit, end);
+                    while (end - start < precision) *--start = '0';
+                    *--start = '.';
+                    digits /= unit;
+                }
+                start = formatUnsigned(digits, start);
+                return emit("-", (size_t) negative, start, (size_t) (end - start), width, flags);
+            }
+        }
+    }
+    char spec[16];
+    snprintf(spec, sizeof(spec), "%%%s%s*.*f", (flags & PHEMIA_LEFT) ? "-" : "", (flags & PHEMIA_ZERO) ? "0" : "");
+    return printf(spec, width, precision, value);
+}
+
+#define ACTIVE(state) ((state) >= 0 && !((state) & PHEMIA_SCAN_STOPPED))
+
+/* end of input before anything was assigned is scanf's EOF, any other failure stops the call */
+static int32_t failed(int32_t state, int atEnd) {
+    return atEnd && state == 0 ? -1 : state | PHEMIA_SCAN_STOPPED;
+}
+
+static int isSpace(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int isDigit(int c) {
+    return (unsigned) (c - '0') < 10;
+}
+
+static int skipSpace(void) {
+    int c;
+    do {
+        c = getc_unlocked(stdin);
+    } while (isSpace(c));
+    return c;
+}
+
+int32_t phemia_read_literal(const char *text, int32_t state) {
+    if (!ACTIVE(state)) return state;
+    flockfile(stdin);
+    for (; *text; text++) {
+        int c;
+        if (isSpace((unsigned char) *text)) {
+            c = skipSpace();
+            if (c != EOF) ungetc(c, stdin);
+            continue;
+        }
+        c = getc_unlocked(stdin);
+        if (c != (unsigned char) *text) {
+            if (c != EOF) ungetc(c, stdin);
+            state = failed(state, c == EOF);
+            break;
+        }
+    }
+    funlockfile(stdin);
+    return state;
+}
+
+int32_t phemia_read_int(int32_t *target, int32_t state) {
+    if (!ACTIVE(state)) return state;
+    flockfile(stdin);
+    int c = skipSpace();
+    int negative = c == '-';
+    if (c == '-' || c == '+') c = getc_unlocked(stdin);
+    uint32_t value = 0;
+    int digits = 0;
+    for (unsigned d; (d = (unsigned) (c - '0')) < 10; c = getc_unlocked(stdin)) {
+        value = value * 10 + d;
+        digits++;
+    }
+    if (c != EOF) ungetc(c, stdin);
+    funlockfile(stdin);
+    if (!digits) return failed(state, c == EOF);
+    *target = (int32_t) (negative ? 0u - value : value);
+    return state + 1;
+}
+
+int32_t phemia_read_char(char *target, int32_t state) {
+    if (!ACTIVE(state)) return state;
+    int c = getc(stdin);
+    if (c == EOF) return failed(state, 1);
+    *target = (char) c;
+    return state + 1;
+}
+
+/* the longest prefix of the input that reads as a decimal floating point number, NUL terminated */
+static int scanDecimal(char *buffer, size_t size, int *atEnd) {
+    size_t n = 0;
+    int digits = 0;
+    flockfile(stdin);
+    int c = skipSpace();
+#define TAKE() do { if (n + 1 < size) buffer[n++] = (char) c; c = getc_unlocked(stdin); } while (0)
+    if (c == '-' || c == '+') TAKE();
+    for (; isDigit(c); digits++) TAKE();
+    if (c == '.') {
+        TAKE();
+        for (; isDigit(c); digits++) TAKE();
+    }
+    if (digits && (c == 'e' || c == 'E')) {
+        TAKE();
+        if (c == '-' || c == '+') TAKE();
+        while (isDigit(c)) TAKE();
+    }
+#undef TAKE
+    if (c != EOF) ungetc(c, stdin);
+    funlockfile(stdin);
+    buffer[n] = '\0';
+    *atEnd = c == EOF;
+    return digits;
+}
+
+int32_t phemia_read_float(float *target, int32_t state) {
+    if (!ACTIVE(state)) return state;
+    char buffer[128];
+    int atEnd;
+    if (!scanDecimal(buffer, sizeof(buffer), &atEnd)) return failed(state, atEnd);
+    *target = strtof(buffer, NULL);
+    return state + 1;
+}
+
+int32_t phemia_read_double(double *target, int32_t state) {
+    if (!ACTIVE(state)) return state;
+    char buffer[128];
+    int atEnd;
+    if (!scanDecimal(buffer, sizeof(buffer), &atEnd)) return failed(state, atEnd);
+    *target = strtod(buffer, NULL);
+    return state + 1;
+}
+
+int32_t phemia_scan_result(int32_t state) {
+    return state < 0 ? -1 : state & (PHEMIA_SCAN_STOPPED - 1);
+}
@@ -0,0 +1,64 @@
+#ifndef PHEMIA_IO_H
+#define PHEMIA_IO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Formatted I/O for printf/scanf calls whose format string is a literal. The compiler splits the
+ * format at compile time (see FormatString) and calls one of these per piece, so nothing parses a
+ * format or consults the locale at runtime. All of them go through stdio's buffers, so they
+ * interleave correctly with plain printf/scanf calls.
+ */
+
+/* printf flags */
+#define PHEMIA_LEFT 1
+#define PHEMIA_ZERO 2
+
+/* each returns the number of characters written */
+int32_t phemia_write(const char *text, int64_t length);
+
+/* %d */
+int32_t phemia_write_int(int32_t value, int32_t width, int32_t flags);
+
+/* %c */
+int32_t phemia_write_char(int32_t value, int32_t width, int32_t flags);
+
+/* %s */
+int32_t phemia_write_str(const char *value, int32_t width, int32_t flags);
+
+/* %f, precision < 0 for the default of 6 */
+int32_t phemia_write_double(double value, int32_t precision, int32_t width, int32_t flags);
+
+/*
+ * The readers pass a state along the pieces of one scanf call: the number of items assigned so
+ * far, PHEMIA_SCAN_STOPPED set once a piece failed to match (the rest then do nothing), or -1 on
+ * end of input before anything was assigned. phemia_scan_result turns it into scanf's result.
+ */
+#define PHEMIA_SCAN_STOPPED 0x10000
+
+/* literal text of the format, white space in it matches any amount of white space */
+int32_t phemia_read_literal(const char *text, int32_t state);
+
+/* %d */
+int32_t phemia_read_int(int32_t *target, int32_t state);
+
+/* %c */
+int32_t phemia_read_char(char *target, int32_t state);
+
+/* %f */
+int32_t phemia_read_float(float *target, int32_t state);
+
+/* %lf */
+int32_t phemia_read_double(double *target, int32_t state);
+
+int32_t phemia_scan_result(int32_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_IO_H
@@ -0,0 +1,245 @@
+#include "map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Control bytes: EMPTY and DELETED have the high bit set, a full slot holds the low 7 bits of its
+ * key's hash (h2). The rest of the hash (h1) picks the first group to probe; further groups follow
+ * triangular steps, which visit every group once since their number is a power of two. At most 7/8
+ * of the slots are ever used (deleted ones included), so every probe meets an empty slot.
+ */
+
+#define GROUP 16
+#define EMPTY ((uint8_t) 0x80)
+#define DELETED ((uint8_t) 0xFE)
+
+struct PhemiaMap {
+    /* traced by the collector */
+    uint8_t *ctrl;
+    /* int64_t keys, or pointers to copied strings */
+    void *keys;
+    uint64_t *values;
+    /* a power of two, at least GROUP; 0 until the first insertion */
+    int64_t capacity;
+    int64_t size;
+    /* insertions into empty slots left before the table is rebuilt */
+    int64_t growthLeft;
+    int64_t stringKeys;
+};
+
+#define MAP_REFS 3
+
+/* what a missing key reads as */
+static const uint64_t missing = 0;
+
+/* a shadow stack frame with room for three roots, laid out as PhemiaFrame */
+typedef struct Roots {
+    PhemiaFrame *prev;
+    int64_t count;
+    void **slots[3];
+} Roots;
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t hashString(const char *key) {
+    size_t length = strlen(key);
+    uint64_t hash = length;
+    for (; length >= 8; length -= 8, key += 8) {
+        uint64_t word;
+        memcpy(&word, key, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, key, length);
+    return mix(hash ^ tail);
+}
+
+static uint64_t hashKey(const PhemiaMap *map, int64_t intKey, const char *strKey) {
+    return map->stringKeys ? hashString(strKey) : mix((uint64_t) intKey);
+}
+
+/* bit i set where group[i] == byte */
+static uint32_t matchByte(const uint8_t *group, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP; i++) mask |= (uint32_t) (group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+/* bit i set where group[i] is empty or deleted */
+static uint32_t matchFree(const uint8_t *group) {
+#ifdef __SSE2__
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP; i++) mask |= (uint32_t) (group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static int keyEquals(const PhemiaMap *map, int64_t slot, int64_t intKey, const char *strKey) {
+    if (map->stringKeys) return strcmp(((char **) map->keys)[slot], strKey) == 0;
+    return ((int64_t *) map->keys)[slot] == intKey;
+}
+
+static int64_t findSlot(const PhemiaMap *map, uint64_t hash, int64_t intKey, const char *strKey) {
+    if (!map || !map->capacity) return -1;
+    size_t mask = (size_t) map->capacity / GROUP - 1;
+    size_t group = (size_t) (hash >> 7) & mask;
+    for (size_t step = 1;; step++) {
+        const uint8_t *ctrl = map->ctrl + group * GROUP;
+        for (uint32_t match = matchByte(ctrl, (uint8_t) (hash & 0x7F)); match; match &= match - 1) {
+            int64_t slot = (int64_t) (group * GROUP) + __builtin_ctz(match);
+            if (keyEquals(map, slot, intKey, strKey)) return slot;
+        }
+        if (matchByte(ctrl, EMPTY)) return -1;
+        group = (group + step) & mask;
+    }
+}
+
+/* the first empty or deleted slot on hash's probe sequence */
+static int64_t freeSlot(const uint8_t *ctrl, int64_t capacity, uint64_t hash) {
+    size_t mask = (size_t) capacity / GROUP - 1;
+    size_t group = (size_t) (hash >> 7) & mask;
+    for (size_t step = 1;; step++) {
+        uint32_t match = matchFree(ctrl + group * GROUP);
+        if (match) return (int64_t) (group * GROUP) + __builtin_ctz(match);
+        group = (group + step) & mask;
+    }
+}
+
+/* move every entry into fresh tables of capacity slots, dropping deleted ones */
+static void rehash(PhemiaMap *map, int64_t capacity) {
+    uint8_t *ctrl = NULL;
+    void *keys = NULL;
+    uint64_t *values = NULL;
+    /* the new tables are only reachable from here until they replace the old ones */
+    Roots roots = {NULL, 3, {(void **) &ctrl, &keys, (void **) &values}};
+    phemia_gc_push((PhemiaFrame *) &roots);
+    ctrl = phemia_gc_alloc(capacity);
+    keys = map->stringKeys ? phemia_gc_alloc_refs(capacity) : phemia_gc_alloc(capacity * 8);
+    values = phemia_gc_alloc(capacity * 8);
+    phemia_gc_pop((PhemiaFrame *) &roots);
+
+    memset(ctrl, EMPTY, (size_t) capacity);
+    for (int64_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] & 0x80) continue;
+        int64_t intKey = map->stringKeys ? 0 : ((int64_t *) map->keys)[i];
+        char *strKey = map->stringKeys ? ((char **) map->keys)[i] : NULL;
+        uint64_t hash = hashKey(map, intKey, strKey);
+        int64_t slot = freeSlot(ctrl, capacity, hash);
+        ctrl[slot] = (uint8_t) (hash & 0x7F);
+        if (map->stringKeys) ((char **) keys)[slot] = strKey;
+        else ((int64_t *) keys)[slot] = intKey;
+        values[slot] = map->values[i];
+    }
+    map->ctrl = ctrl;
+    map->keys = keys;
+    map->values = values;
+    map->capacity = capacity;
+    map->growthLeft = capacity / 8 * 7 - map->size;
+}
+
+static void *insert(PhemiaMap *map, int64_t intKey, const char *strKey) {
+    if (!map) {
+        fputs("phemia: store into a map that was never created with new\n", stderr);
+        abort();
+    }
+    uint64_t hash = hashKey(map, intKey, strKey);
+    int64_t slot = findSlot(map, hash, intKey, strKey);
+    if (slot >= 0) return &map->values[slot];
+    if (!map->growthLeft) {
+        /* grow, unless it is deleted slots that used the room up */
+        int64_t capacity = map->capacity ? map->capacity : GROUP;
+        if (map->size * 16 >= capacity * 7) capacity *= 2;
+        rehash(map, capacity);
+    }
+    slot = freeSlot(map->ctrl, map->capacity, hash);
+    if (map->ctrl[slot] == EMPTY) map->growthLeft--;
+    map->ctrl[slot] = (uint8_t) (hash & 0x7F);
+    map->values[slot] = 0;
+    map->size++;
+    if (map->stringKeys) {
+        size_t length = strlen(strKey);
+        char *copy = phemia_gc_alloc((int64_t) length + 1);
+        memcpy(copy, strKey, length + 1);
+        ((char **) map->keys)[slot] = copy;
+    } else {
+        ((int64_t *) map->keys)[slot] = intKey;
+    }
+    return &map->values[slot];
+}
+
+static int32_t erase(PhemiaMap *map, int64_t intKey, const char *strKey) {
+    int64_t slot = findSlot(map, map ? hashKey(map, intKey, strKey) : 0, intKey, strKey);
+    if (slot < 0) return 0;
+    /* probes for other keys may have passed this slot, it cannot become empty again */
+    map->ctrl[slot] = DELETED;
+    if (map->stringKeys) ((char **) map->keys)[slot] = NULL;
+    map->size--;
+    return 1;
+}
+
+PhemiaMap *phemia_map_new(int32_t stringKeys) {
+    PhemiaMap *map = phemia_gc_alloc_object(sizeof(PhemiaMap), MAP_REFS);
+    map->stringKeys = stringKeys != 0;
+    return map;
+}
+
+const void *phemia_map_find_int(PhemiaMap *map, int64_t key) {
+    int64_t slot = findSlot(map, map ? hashKey(map, key, NULL) : 0, key, NULL);
+    return slot < 0 ? &missing : &map->values[slot];
+}
+
+const void *phemia_map_find_str(PhemiaMap *map, const char *key) {
+    int64_t slot = findSlot(map, map ? hashKey(map, 0, key) : 0, 0, key);
+    return slot < 0 ? &missing : &map->values[slot];
+}
+
+int32_t phemia_map_contains_int(PhemiaMap *map, int64_t key) {
+    return findSlot(map, map ? hashKey(map, key, NULL) : 0, key, NULL) >= 0;
+}
+
+int32_t phemia_map_contains_str(PhemiaMap *map, const char *key) {
+    return findSlot(map, map ? hashKey(map, 0, key) : 0, 0, key) >= 0;
+}
+
+void *phemia_map_insert_int(PhemiaMap *map, int64_t key) {
+    return insert(map, key, NULL);
+}
+
+void *phemia_map_insert_str(PhemiaMap *map, const char *key) {
+    return insert(map, 0, key);
+}
+
+int32_t phemia_map_erase_int(PhemiaMap *map, int64_t key) {
+    return erase(map, key, NULL);
+}
+
+int32_t phemia_map_erase_str(PhemiaMap *map, const char *key) {
+    return erase(map, 0, key);
+}
+
+int32_t phemia_map_size(PhemiaMap *map) {
+    return map ? (int32_t) map->size : 0;
+}
@@ -0,0 +1,49 @@
+#ifndef PHEMIA_MAP_H
+#define PHEMIA_MAP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hash maps behind `map[K]V`, keyed by int or by string. Open addressing in the style of Swiss
+ * tables: slots come in groups of 16, each with a control byte holding 7 bits of its key's hash, so
+ * a probe compares a whole group at once (one SSE2 compare where available) and only looks at keys
+ * whose bits match. Values are 8 byte slots generated code loads and stores in place.
+ *
+ * Maps live on the collected heap (runtime/gc.h) like arrays do. String keys are copied in, so
+ * later writes to the char array a key came from do not change the map. A map variable never
+ * assigned `new map[K]V()` reads as empty; storing into it aborts.
+ */
+typedef struct PhemiaMap PhemiaMap;
+
+PhemiaMap *phemia_map_new(int32_t stringKeys);
+
+/* the value slot of key to read from; a missing key reads as 0 */
+const void *phemia_map_find_int(PhemiaMap *map, int64_t key);
+
+const void *phemia_map_find_str(PhemiaMap *map, const char *key);
+
+int32_t phemia_map_contains_int(PhemiaMap *map, int64_t key);
+
+int32_t phemia_map_contains_str(PhemiaMap *map, const char *key);
+
+/* the value slot of key, added zeroed when missing; valid until the next insertion */
+void *phemia_map_insert_int(PhemiaMap *map, int64_t key);
+
+void *phemia_map_insert_str(PhemiaMap *map, const char *key);
+
+/* 1 when key was in the map */
+int32_t phemia_map_erase_int(PhemiaMap *map, int64_t key);
+
+int32_t phemia_map_erase_str(PhemiaMap *map, const char *key);
+
+int32_t phemia_map_size(PhemiaMap *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_MAP_H
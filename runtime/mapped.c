@@ -0,0 +1,34 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapped.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void fail(const char *path, const char *why) {
+    fprintf(stderr, "phemia: cannot map %s: %s\n", path, why);
+    abort();
+}
+
+void *phemia_mapped_file(const char *path, int64_t bytes, int32_t copyOnWrite) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) fail(path, strerror(errno));
+    struct stat info;
+    if (fstat(fd, &info) != 0) fail(path, strerror(errno));
+    if ((int64_t) info.st_size != bytes) {
+        fprintf(stderr, "phemia: cannot map %s: it holds %lld bytes, the array needs %lld\n", path,
+                (long long) info.st_size, (long long) bytes);
+        abort();
+    }
+    void *data = mmap(NULL, (size_t) bytes, PROT_READ | (copyOnWrite ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) fail(path, strerror(errno));
+    /* the mapping keeps the file open */
+    close(fd);
+    return data;
+}
@@ -0,0 +1,27 @@
+#ifndef PHEMIA_MAPPED_H
+#define PHEMIA_MAPPED_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Storage of an array declared `[N][M]T a = mapFile(path)`: the file itself, mapped with mmap. Its
+ * bytes are the elements in row-major order as the machine stores them (T's size each; booleans are
+ * bits, 64 to a 64 bit word, first element lowest), and it must be exactly as long as the declared
+ * shape needs. Pages are read in on first
+ * touch and shared with every other process mapping the file through the page cache.
+ *
+ * Without copyOnWrite the mapping is read-only and storing into the array faults; with it, stores
+ * go to private copies of the pages touched and never reach the file. A mapping lives until the
+ * program exits, the collector does not know about it. Aborts when the file cannot be mapped.
+ */
+void *phemia_mapped_file(const char *path, int64_t bytes, int32_t copyOnWrite);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_MAPPED_H
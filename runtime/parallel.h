@@ -0,0 +1,38 @@
+#ifndef PHEMIA_PARALLEL_H
+#define PHEMIA_PARALLEL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/*
+ * Fork-join helpers shared by the runtime's data parallel routines (sort.c, reduce.c). Threads are
+ * started for each call rather than pooled: only arrays large enough to amortize that are split.
+ */
+
+#define PHEMIA_MAX_THREADS 8
+
+/* threads worth splitting work over: the online cores, at most PHEMIA_MAX_THREADS */
+static inline size_t phemia_threads(void) {
+    static size_t count = 0;
+    if (!count) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online < 1 ? 1 : online > PHEMIA_MAX_THREADS ? PHEMIA_MAX_THREADS : (size_t) online;
+    }
+    return count;
+}
+
+/* work(jobs[i]) for each of the count jobs of size bytes each, the first on this thread */
+static inline void phemia_parallel(void *(*work)(void *), void *jobs, size_t size, size_t count) {
+    pthread_t helpers[PHEMIA_MAX_THREADS];
+    size_t started = 1;
+    for (; started < count; started++) {
+        if (pthread_create(&helpers[started], NULL, work, (char *) jobs + started * size) != 0) break;
+    }
+    /* jobs no thread could be started for run here */
+    for (size_t i = started; i < count; i++) work((char *) jobs + i * size);
+    work(jobs);
+    for (size_t i = 1; i < started; i++) pthread_join(helpers[i], NULL);
+}
+
+#endif //PHEMIA_PARALLEL_H
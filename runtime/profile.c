@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "profile.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Samples are kept in one growing array; those not yet found dead are also listed in `live` so a
+ * collection only looks at them. The profile is encoded by hand, field numbers as in pprof's
+ * profile.proto, since generated programs link nothing beyond the runtime, libc and pthreads.
+ */
+
+typedef struct Sample {
+    /* NULL once dead */
+    void *payload;
+    int64_t bytes;
+    int32_t site;
+    int64_t born;
+    int64_t died;
+} Sample;
+
+typedef struct Buffer {
+    uint8_t *data;
+    size_t size;
+    size_t cap;
+} Buffer;
+
+int32_t phemia_profile_site = 0;
+int64_t phemia_profile_rate = 0;
+
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static Sample *samples = NULL;
+static size_t sampleCount = 0;
+static size_t sampleCap = 0;
+static size_t *live = NULL;
+static size_t liveCount = 0;
+static size_t liveCap = 0;
+static uint64_t randomState = 0;
+static int64_t startedAt = 0;
+static int64_t startedWall = 0;
+
+/* copies: under --jit the program's constants are gone by the time the profile is written */
+static char *profilePath = NULL;
+static char *sourceFile = NULL;
+static char **siteFunctions = NULL;
+static int32_t *siteLines = NULL;
+static int32_t siteCount = 0;
+
+static int64_t nanos(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static char *copy(const char *text) {
+    size_t size = strlen(text) + 1;
+    char *copied = malloc(size);
+    if (!copied) abort();
+    return memcpy(copied, text, size);
+}
+
+static void *grow(void *array, size_t *cap, size_t item) {
+    *cap = *cap ? *cap * 2 : 256;
+    array = realloc(array, *cap * item);
+    if (!array) abort();
+    return array;
+}
+
+/* log2(x) for x in (0, 1] to about 0.01, plenty for drawing sample gaps */
+static double log2Approx(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int) ((bits >> 52) & 0x7FF) - 1023;
+    bits = (bits & ((1ull << 52) - 1)) | (1023ull << 52);
+    double mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+    double f = mantissa - 1;
+    return exponent + f * (1.3465553 - 0.3465553 * f);
+}
+
+/* 1 - e^-x for x >= 0: the chance an allocation x sampling periods long is sampled */
+static double sampledChance(double x) {
+    if (x > 40) return 1;
+    /* e^-x as (e^-y)^(2^k) with y < 1, where its series converges quickly */
+    int halvings = 0;
+    double y = x;
+    while (y >= 1) {
+        y /= 2;
+        halvings++;
+    }
+    double sum = 0, term = y;
+    for (int k = 1; k < 24; k++) {
+        sum += term;
+        term *= -y / (k + 1);
+    }
+    /* sum is 1 - e^-y, kept that way while x is small so nothing cancels */
+    if (!halvings) return sum;
+    double e = 1 - sum;
+    while (halvings--) e *= e;
+    return 1 - e;
+}
+
+/* bytes until the next sample, exponentially distributed around the rate; with profileLock held */
+static int64_t nextGap(void) {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    double u = (double) ((randomState * 0x2545F4914F6CDD1Dull) >> 11) / (double) (1ull << 53);
+    double gap = -log2Approx(1 - u) * 0.6931471805599453 * (double) phemia_profile_rate;
+    return (int64_t) gap + 1;
+}
+
+int64_t phemia_profile_record(void *payload, int64_t bytes) {
+    pthread_mutex_lock(&profileLock);
+    if (!payload) {
+        int64_t gap = nextGap();
+        pthread_mutex_unlock(&profileLock);
+        return gap;
+    }
+    if (sampleCount == sampleCap) samples = grow(samples, &sampleCap, sizeof(Sample));
+    if (liveCount == liveCap) live = grow(live, &liveCap, sizeof(size_t));
+    int32_t site = phemia_profile_site >= 0 && phemia_profile_site < siteCount ? phemia_profile_site : 0;
+    samples[sampleCount] = (Sample) {payload, bytes, site, nanos(CLOCK_MONOTONIC), 0};
+    live[liveCount++] = sampleCount++;
+    int64_t gap = nextGap();
+    pthread_mutex_unlock(&profileLock);
+    return gap;
+}
+
+void phemia_profile_sweep(int (*isLive)(void *payload)) {
+    pthread_mutex_lock(&profileLock);
+    int64_t now = nanos(CLOCK_MONOTONIC);
+    size_t kept = 0;
+    for (size_t i = 0; i < liveCount; i++) {
+        Sample *sample = &samples[live[i]];
+        if (isLive(sample->payload)) {
+            live[kept++] = live[i];
+        } else {
+            sample->payload = NULL;
+            sample->died = now;
+        }
+    }
+    liveCount = kept;
+    pthread_mutex_unlock(&profileLock);
+}
+
+static void put(Buffer *buf, const void *data, size_t size) {
+    while (buf->size + size > buf->cap) buf->data = grow(buf->data, &buf->cap, 1);
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void putVarint(Buffer *buf, uint64_t value) {
+    uint8_t bytes[10];
+    size_t size = 0;
+    do {
+        bytes[size++] = (uint8_t) ((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+    put(buf, bytes, size);
+}
+
+static void putInt(Buffer *buf, int field, int64_t value) {
+    putVarint(buf, (uint64_t) field << 3);
+    putVarint(buf, (uint64_t) value);
+}
+
+static void putBytes(Buffer *buf, int field, const void *data, size_t size) {
+    putVarint(buf, (uint64_t) field << 3 | 2);
+    putVarint(buf, size);
+    put(buf, data, size);
+}
+
+/* sub as field of buf, leaving sub empty for the next message */
+static void putMessage(Buffer *buf, int field, Buffer *sub) {
+    putBytes(buf, field, sub->data, sub->size);
+    sub->size = 0;
+}
+
+/* index of text in the string table, added when new */
+static int64_t intern(const char ***strings, size_t *count, size_t *cap, const char *text) {
+    for (size_t i = 0; i < *count; i++) {
+        if (strcmp((*strings)[i], text) == 0) return (int64_t) i;
+    }
+    if (*count == *cap) *strings = grow(*strings, cap, sizeof(char *));
+    (*strings)[*count] = text;
+    return (int64_t) (*count)++;
+}
+
+static void writeProfile(void) {
+    pthread_mutex_lock(&profileLock);
+    const char **strings = NULL;
+    size_t stringCount = 0, stringCap = 0;
+#define STRING(text) intern(&strings, &stringCount, &stringCap, text)
+    STRING("");
+    Buffer out = {NULL, 0, 0}, msg = {NULL, 0, 0}, inner = {NULL, 0, 0};
+
+    const char *types[][2] = {{"alloc_objects", "count"}, {"alloc_space", "bytes"},
+                              {"inuse_objects", "count"}, {"inuse_space", "bytes"}};
+    for (size_t i = 0; i < 4; i++) {
+        putInt(&msg, 1, STRING(types[i][0]));
+        putInt(&msg, 2, STRING(types[i][1]));
+        putMessage(&out, 1, &msg);
+    }
+
+    int64_t now = nanos(CLOCK_MONOTONIC);
+    int64_t bytesKey = STRING("bytes"), lifetimeKey = STRING("lifetime"), nanosUnit = STRING("nanoseconds");
+    for (size_t i = 0; i < sampleCount; i++) {
+        Sample *sample = &samples[i];
+        /* each sample stands for the allocations of its size that were likely skipped around it */
+        double weight = 1 / sampledChance((double) sample->bytes / (double) phemia_profile_rate);
+        int64_t objects = (int64_t) (weight + 0.5), space = (int64_t) (weight * (double) sample->bytes + 0.5);
+        int inUse = sample->payload != NULL;
+        putVarint(&inner, (uint64_t) sample->site + 1);
+        putMessage(&msg, 1, &inner);
+        putVarint(&inner, (uint64_t) objects);
+        putVarint(&inner, (uint64_t) space);
+        putVarint(&inner, inUse ? (uint64_t) objects : 0);
+        putVarint(&inner, inUse ? (uint64_t) space : 0);
+        putMessage(&msg, 2, &inner);
+        putInt(&inner, 1, bytesKey);
+        putInt(&inner, 3, sample->bytes);
+        putInt(&inner, 4, bytesKey);
+        putMessage(&msg, 3, &inner);
+        putInt(&inner, 1, lifetimeKey);
+        putInt(&inner, 3, (inUse ? now : sample->died) - sample->born);
+        putInt(&inner, 4, nanosUnit);
+        putMessage(&msg, 3, &inner);
+        putMessage(&out, 2, &msg);
+    }
+
+    /* a location per site, a function per distinct name */
+    int64_t fileName = STRING(sourceFile);
+    int64_t *functionIds = calloc((size_t) siteCount + 1, sizeof(int64_t));
+    if (!functionIds) abort();
+    int64_t functions = 0;
+    for (int32_t i = 0; i < siteCount; i++) {
+        for (int32_t j = 0; j < i && !functionIds[i]; j++) {
+            if (strcmp(siteFunctions[i], siteFunctions[j]) == 0) functionIds[i] = functionIds[j];
+        }
+        if (!functionIds[i]) {
+            functionIds[i] = ++functions;
+            putInt(&msg, 1, functions);
+            putInt(&msg, 2, STRING(siteFunctions[i]));
+            putInt(&msg, 3, STRING(siteFunctions[i]));
+            putInt(&msg, 4, fileName);
+            putMessage(&out, 5, &msg);
+        }
+        putInt(&inner, 1, functionIds[i]);
+        putInt(&inner, 2, siteLines[i]);
+        putInt(&msg, 1, i + 1);
+        putMessage(&msg, 4, &inner);
+        putMessage(&out, 4, &msg);
+    }
+    free(functionIds);
+
+    putInt(&msg, 1, STRING("space"));
+    putInt(&msg, 2, bytesKey);
+    putMessage(&out, 11, &msg);
+    putInt(&out, 12, phemia_profile_rate);
+    putInt(&out, 9, startedWall);
+    putInt(&out, 10, now - startedAt);
+    for (size_t i = 0; i < stringCount; i++) putBytes(&out, 6, strings[i], strlen(strings[i]));
+#undef STRING
+
+    FILE *file = fopen(profilePath, "wb");
+    if (!file || fwrite(out.data, 1, out.size, file) != out.size || fclose(file) != 0) {
+        perror("phemia: heap profile");
+    }
+    free(strings);
+    free(out.data);
+    free(msg.data);
+    free(inner.data);
+    pthread_mutex_unlock(&profileLock);
+}
+
+void phemia_profile_start(const char *path, const char *source, const char *const *functions,
+                          const int32_t *lines, int32_t count) {
+    pthread_mutex_lock(&profileLock);
+    profilePath = copy(path);
+    sourceFile = copy(source);
+    siteFunctions = malloc((size_t) count * sizeof(char *));
+    siteLines = malloc((size_t) count * sizeof(int32_t));
+    if (!siteFunctions || !siteLines) abort();
+    for (int32_t i = 0; i < count; i++) {
+        siteFunctions[i] = copy(functions[i]);
+        siteLines[i] = lines[i];
+    }
+    siteCount = count;
+    startedAt = nanos(CLOCK_MONOTONIC);
+    startedWall = nanos(CLOCK_REALTIME);
+    randomState = (uint64_t) startedWall | 1;
+    const char *rate = getenv("PHEMIA_HEAP_PROFILE_RATE");
+    phemia_profile_rate = rate && atoll(rate) > 0 ? atoll(rate) : PHEMIA_PROFILE_RATE;
+    pthread_mutex_unlock(&profileLock);
+    atexit(writeProfile);
+}
@@ -0,0 +1,52 @@
+#ifndef PHEMIA_PROFILE_H
+#define PHEMIA_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sampled heap profile of programs compiled with --heap-profile. Generated code stores the site it
+ * is at into phemia_profile_site before each call that may allocate; the collector then picks on
+ * average one allocation per PHEMIA_PROFILE_RATE bytes (tcmalloc's scheme: exponentially
+ * distributed gaps, so large allocations are more likely taken) and records its site, size and
+ * when it was made. An object's lifetime ends at the first collection that finds it unreachable.
+ *
+ * At exit the samples are written to the path given to phemia_profile_start as an uncompressed
+ * pprof protobuf (`go tool pprof <program> <file>` reads it): alloc_objects, alloc_space,
+ * inuse_objects and inuse_space scaled up by the sampling rate, one location per site, with numeric
+ * labels bytes and lifetime (nanoseconds, up to exit for what is still live) on every sample.
+ */
+
+#define PHEMIA_PROFILE_RATE (512 * 1024)
+
+/* index into the tables given to phemia_profile_start, 0 for an unknown site */
+extern int32_t phemia_profile_site;
+
+/* nonzero once profiling started; until then the collector takes no samples */
+extern int64_t phemia_profile_rate;
+
+/*
+ * Start profiling, writing the profile to path at exit. Site i is line lines[i] of source, inside
+ * the program's function functions[i]; the PHEMIA_HEAP_PROFILE_RATE environment variable overrides
+ * the sampling rate in bytes.
+ */
+void phemia_profile_start(const char *path, const char *source, const char *const *functions,
+                          const int32_t *lines, int32_t count);
+
+/*
+ * for the collector: record payload, an allocation of bytes, and return the bytes until the next
+ * sample. A NULL payload records nothing, it only draws a thread's first gap.
+ */
+int64_t phemia_profile_record(void *payload, int64_t bytes);
+
+/* for the collector once marking is done: samples whose payload isLive rejects have died */
+void phemia_profile_sweep(int (*isLive)(void *payload));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_PROFILE_H
@@ -0,0 +1,111 @@
+#include "reduce.h"
+
+#include <stddef.h>
+
+#include "parallel.h"
+
+/* arrays this long are split over several threads */
+#define PARALLEL ((size_t) 1 << 20)
+/* Job.op beyond the PHEMIA_ ones */
+#define DOT 3
+#define SCAN 4
+/* LANES elements from p, widened to S */
+#define LOAD(p) __builtin_convertvector(*(const FN(Raw) *) (p), FN(Vec))
+
+#define T int8_t
+#define S uint32_t
+#define LANES 8
+#define EXACT 1
+#define FN(name) name##Char
+#include "reduce.inc"
+#undef T
+#undef S
+#undef LANES
+#undef EXACT
+#undef FN
+
+#define T int32_t
+#define S uint32_t
+#define LANES 8
+#define EXACT 1
+#define FN(name) name##Int
+#include "reduce.inc"
+#undef T
+#undef S
+#undef LANES
+#undef EXACT
+#undef FN
+
+#define T float
+#define S float
+#define LANES 8
+#define EXACT 0
+#define FN(name) name##Float
+#include "reduce.inc"
+#undef T
+#undef S
+#undef LANES
+#undef EXACT
+#undef FN
+
+#define T double
+#define S double
+#define LANES 4
+#define EXACT 0
+#define FN(name) name##Double
+#include "reduce.inc"
+#undef T
+#undef S
+#undef LANES
+#undef EXACT
+#undef FN
+
+int32_t phemia_reduce_char(const int8_t *data, int64_t count, int32_t op, int32_t reassociate) {
+    uint32_t result = reduceChar(data, count, op, reassociate);
+    /* a minimum or maximum is a char, sign extended */
+    return op == PHEMIA_SUM ? (int32_t) result : (int32_t) (int8_t) result;
+}
+
+int32_t phemia_reduce_int(const int32_t *data, int64_t count, int32_t op, int32_t reassociate) {
+    return (int32_t) reduceInt(data, count, op, reassociate);
+}
+
+float phemia_reduce_float(const float *data, int64_t count, int32_t op, int32_t reassociate) {
+    return reduceFloat(data, count, op, reassociate);
+}
+
+double phemia_reduce_double(const double *data, int64_t count, int32_t op, int32_t reassociate) {
+    return reduceDouble(data, count, op, reassociate);
+}
+
+int32_t phemia_dot_char(const int8_t *a, const int8_t *b, int64_t count, int32_t reassociate) {
+    return (int32_t) dotProductChar(a, b, count, reassociate);
+}
+
+int32_t phemia_dot_int(const int32_t *a, const int32_t *b, int64_t count, int32_t reassociate) {
+    return (int32_t) dotProductInt(a, b, count, reassociate);
+}
+
+float phemia_dot_float(const float *a, const float *b, int64_t count, int32_t reassociate) {
+    return dotProductFloat(a, b, count, reassociate);
+}
+
+double phemia_dot_double(const double *a, const double *b, int64_t count, int32_t reassociate) {
+    return dotProductDouble(a, b, count, reassociate);
+}
+
+void phemia_scan_char(int8_t *data, int64_t count, int32_t reassociate) {
+    scanChar(data, count, reassociate);
+}
+
+void phemia_scan_int(int32_t *data, int64_t count, int32_t reassociate) {
+    scanInt(data, count, reassociate);
+}
+
+void phemia_scan_float(float *data, int64_t count, int32_t reassociate) {
+    scanFloat(data, count, reassociate);
+}
+
+void phemia_scan_double(double *data, int64_t count, int32_t reassociate) {
+    scanDouble(data, count, reassociate);
+}
@@ -0,0 +1,56 @@
+#ifndef PHEMIA_REDUCE_H
+#define PHEMIA_REDUCE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * sum, min, max, dot and scan over arrays of numbers. Sums and dot products keep four independent
+ * vector accumulators of 256 bits each, so consecutive additions do not wait on one another, and
+ * arrays of at least 2^20 elements are split into one part per core whose partial results are then
+ * combined pairwise.
+ *
+ * Integer arithmetic wraps like the program's own and is associative, so it always takes that path.
+ * Floating point results depend on the order of the additions: unless reassociate is set (the
+ * compiler's --reassociate), float and double arrays are combined strictly left to right, exactly
+ * like the loop a program would write. chars sum to an int; a scan of chars wraps like char stores.
+ * An empty range sums, and has a minimum and maximum, of 0.
+ */
+
+#define PHEMIA_SUM 0
+#define PHEMIA_MIN 1
+#define PHEMIA_MAX 2
+
+int32_t phemia_reduce_char(const int8_t *data, int64_t count, int32_t op, int32_t reassociate);
+
+int32_t phemia_reduce_int(const int32_t *data, int64_t count, int32_t op, int32_t reassociate);
+
+float phemia_reduce_float(const float *data, int64_t count, int32_t op, int32_t reassociate);
+
+double phemia_reduce_double(const double *data, int64_t count, int32_t op, int32_t reassociate);
+
+int32_t phemia_dot_char(const int8_t *a, const int8_t *b, int64_t count, int32_t reassociate);
+
+int32_t phemia_dot_int(const int32_t *a, const int32_t *b, int64_t count, int32_t reassociate);
+
+float phemia_dot_float(const float *a, const float *b, int64_t count, int32_t reassociate);
+
+double phemia_dot_double(const double *a, const double *b, int64_t count, int32_t reassociate);
+
+/* inclusive prefix sums in place: data[i] becomes data[0] + ... + data[i] */
+void phemia_scan_char(int8_t *data, int64_t count, int32_t reassociate);
+
+void phemia_scan_int(int32_t *data, int64_t count, int32_t reassociate);
+
+void phemia_scan_float(float *data, int64_t count, int32_t reassociate);
+
+void phemia_scan_double(double *data, int64_t count, int32_t reassociate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_REDUCE_H
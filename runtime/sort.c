@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "sort.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "parallel.h"
+
+/* runs this short are insertion sorted */
+#define SMALL 32
+/* arrays this long are sorted on several threads */
+#define PARALLEL ((size_t) 1 << 18)
+
+#define KEY uint32_t
+#define FN(name) name##32
+#include "sort.inc"
+#undef KEY
+#undef FN
+
+#define KEY uint64_t
+#define FN(name) name##64
+#include "sort.inc"
+#undef KEY
+#undef FN
+
+/* keys ordered like the elements: x ^ flip(x) maps them, unflip undoes it */
+static uint32_t flip32(uint32_t bits, int32_t kind) {
+    return kind == PHEMIA_SORT_FLOAT && (bits >> 31) ? 0xFFFFFFFFu : 0x80000000u;
+}
+
+static uint32_t unflip32(uint32_t key, int32_t kind) {
+    return kind == PHEMIA_SORT_FLOAT && !(key >> 31) ? 0xFFFFFFFFu : 0x80000000u;
+}
+
+static void toKeys(void *data, size_t n, int32_t kind) {
+    if (kind == PHEMIA_SORT_DOUBLE) {
+        uint64_t *keys = data;
+        for (size_t i = 0; i < n; i++) keys[i] ^= (keys[i] >> 63) ? ~(uint64_t) 0 : (uint64_t) 1 << 63;
+    } else {
+        uint32_t *keys = data;
+        for (size_t i = 0; i < n; i++) keys[i] ^= flip32(keys[i], kind);
+    }
+}
+
+static void fromKeys(void *data, size_t n, int32_t kind) {
+    if (kind == PHEMIA_SORT_DOUBLE) {
+        uint64_t *keys = data;
+        for (size_t i = 0; i < n; i++) keys[i] ^= (keys[i] >> 63) ? (uint64_t) 1 << 63 : ~(uint64_t) 0;
+    } else {
+        uint32_t *keys = data;
+        for (size_t i = 0; i < n; i++) keys[i] ^= unflip32(keys[i], kind);
+    }
+}
+
+/* chars take one counting pass */
+static void countingSort(int8_t *data, size_t n) {
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < n; i++) counts[(uint8_t) (data[i] + 128)]++;
+    size_t at = 0;
+    for (int v = 0; v < 256; v++) {
+        memset(data + at, v - 128, counts[v]);
+        at += counts[v];
+    }
+}
+
+void phemia_sort(void *data, int64_t count, int32_t kind) {
+    phemia_partial_sort(data, count, count, kind);
+}
+
+void phemia_partial_sort(void *data, int64_t count, int64_t k, int32_t kind) {
+    if (count <= 1 || k <= 0) return;
+    size_t n = (size_t) count;
+    size_t front = k < count ? (size_t) k : n;
+    if (kind == PHEMIA_SORT_CHAR) {
+        /* a counting pass sorts all of them anyway */
+        countingSort(data, n);
+        return;
+    }
+    toKeys(data, n, kind);
+    if (kind == PHEMIA_SORT_DOUBLE) {
+        if (front < n) select64(data, n, front);
+        sortKeys64(data, front);
+    } else {
+        if (front < n) select32(data, n, front);
+        sortKeys32(data, front);
+    }
+    fromKeys(data, n, kind);
+}
+
+/*
+ * Lower bound without branches on the data: the range halves every step whatever the comparison
+ * says, so the loop runs log2(count) times and the compiler turns the choice into a cmov. Both
+ * places the next step may look at are prefetched.
+ */
+#define SEARCH(name, T)                                                              \
+    int32_t name(const T *data, int64_t count, T key) {                              \
+        if (count <= 0) return -1;                                                   \
+        const T *base = data;                                                        \
+        int64_t n = count;                                                           \
+        while (n > 1) {                                                              \
+            int64_t half = n / 2;                                                    \
+            __builtin_prefetch(base + half / 2);                                     \
+            __builtin_prefetch(base + half + half / 2);                              \
+            base = base[half] < key ? base + half : base;                            \
+            n -= half;                                                               \
+        }                                                                            \
+        base += *base < key;                                                         \
+        return base < data + count && *base == key ? (int32_t) (base - data) : -1;   \
+    }
+
+SEARCH(phemia_search_char, int8_t)
+
+SEARCH(phemia_search_int, int32_t)
+
+SEARCH(phemia_search_float, float)
+
+SEARCH(phemia_search_double, double)
@@ -0,0 +1,45 @@
+#ifndef PHEMIA_SORT_H
+#define PHEMIA_SORT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * sort, stableSort, partialSort and binarySearch on arrays of numbers. Elements are mapped in place
+ * to unsigned keys with the same order (sign bits flipped, every bit of a negative float flipped),
+ * radix sorted a byte at a time and mapped back. Large arrays are cut into one run per core, each
+ * sorted on its own thread, and the runs merged in rounds where every thread writes an equal share
+ * of the output, its bounds found by a binary search along the merge path.
+ *
+ * Floating point values sort in IEEE total order: -0.0 before 0.0, NaNs at the ends by their sign.
+ * Equal numbers cannot be told apart, so every sort here is also a stable one.
+ */
+
+/* element kinds, also the size class the runtime works with */
+#define PHEMIA_SORT_CHAR 0
+#define PHEMIA_SORT_INT 1
+#define PHEMIA_SORT_FLOAT 2
+#define PHEMIA_SORT_DOUBLE 3
+
+void phemia_sort(void *data, int64_t count, int32_t kind);
+
+/* the smallest k elements in order at the front, the others after them in no particular order */
+void phemia_partial_sort(void *data, int64_t count, int64_t k, int32_t kind);
+
+/* lowest index of key in sorted data, -1 when it is not there */
+int32_t phemia_search_char(const int8_t *data, int64_t count, int8_t key);
+
+int32_t phemia_search_int(const int32_t *data, int64_t count, int32_t key);
+
+int32_t phemia_search_float(const float *data, int64_t count, float key);
+
+int32_t phemia_search_double(const double *data, int64_t count, double key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_SORT_H
@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "text.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define PAGE 4096
+
+/* 16 bytes from p stay within p's page, so loading them cannot fault when p itself is readable */
+static int loadable(const char *p) {
+    return ((uintptr_t) p & (PAGE - 1)) <= PAGE - 16;
+}
+
+static uint32_t matchZero(__m128i bytes) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+}
+#endif
+
+int32_t phemia_str_length(const char *s) {
+#ifdef __SSE2__
+    /* aligned blocks never cross a page; the bytes of the first one before s are shifted out */
+    const char *block = (const char *) ((uintptr_t) s & ~(uintptr_t) 15);
+    uint32_t zeros = matchZero(_mm_load_si128((const __m128i *) block)) >> (s - block);
+    if (zeros) return __builtin_ctz(zeros);
+    for (;;) {
+        block += 16;
+        zeros = matchZero(_mm_load_si128((const __m128i *) block));
+        if (zeros) return (int32_t) (block - s) + __builtin_ctz(zeros);
+    }
+#else
+    return (int32_t) strlen(s);
+#endif
+}
+
+int32_t phemia_str_compare(const char *a, const char *b) {
+    for (size_t i = 0;;) {
+#ifdef __SSE2__
+        if (loadable(a + i) && loadable(b + i)) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+            /* the first byte where they differ or a ends decides */
+            uint32_t stop = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+            stop |= matchZero(x);
+            if (!stop) {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(stop);
+        }
+#endif
+        unsigned char x = (unsigned char) a[i], y = (unsigned char) b[i];
+        if (x != y) return x < y ? -1 : 1;
+        if (!x) return 0;
+        i++;
+    }
+}
+
+int32_t phemia_str_find(const char *s, const char *t) {
+    size_t n = (size_t) phemia_str_length(s), m = (size_t) phemia_str_length(t);
+    if (!m) return 0;
+    if (m > n) return -1;
+    size_t i = 0;
+#ifdef __SSE2__
+    /* only positions where both the first and the last byte of t match are compared in full */
+    __m128i first = _mm_set1_epi8(t[0]);
+    __m128i last = _mm_set1_epi8(t[m - 1]);
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i tail = _mm_loadu_si128((const __m128i *) (s + i + m - 1));
+        uint32_t match = (uint32_t) _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        for (; match; match &= match - 1) {
+            size_t at = i + __builtin_ctz(match);
+            if (memcmp(s + at, t, m) == 0) return (int32_t) at;
+        }
+    }
+#endif
+    for (; i + m <= n; i++) {
+        if (s[i] == t[0] && memcmp(s + i, t, m) == 0) return (int32_t) i;
+    }
+    return -1;
+}
+
+int32_t phemia_str_copy(char *dst, const char *src, int32_t capacity) {
+    if (capacity <= 0) return 0;
+    size_t length = (size_t) phemia_str_length(src);
+    if (length > (size_t) capacity - 1) length = (size_t) capacity - 1;
+    /* strCopy(a, a) is allowed */
+    memmove(dst, src, length);
+    dst[length] = '\0';
+    return (int32_t) length;
+}
+
+int32_t phemia_read_line(char *buffer, int32_t capacity) {
+    if (capacity <= 0) return -1;
+    flockfile(stdin);
+    if (!fgets(buffer, capacity, stdin)) {
+        funlockfile(stdin);
+        buffer[0] = '\0';
+        return -1;
+    }
+    size_t length = (size_t) phemia_str_length(buffer);
+    if (length && buffer[length - 1] == '\n') {
+        buffer[--length] = '\0';
+    } else if (length == (size_t) capacity - 1) {
+        int c;
+        do {
+            c = getc_unlocked(stdin);
+        } while (c != EOF && c != '\n');
+    }
+    funlockfile(stdin);
+    return (int32_t) length;
+}
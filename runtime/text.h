@@ -0,0 +1,38 @@
+#ifndef PHEMIA_TEXT_H
+#define PHEMIA_TEXT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Text builtins on NUL terminated strings and char arrays: strLength, strCompare, strFind, strCopy
+ * and readLine, see createCoreFunction. Scanning works on 16 bytes at a time with SSE2 where
+ * available; loads never cross into a page the string does not reach.
+ */
+
+int32_t phemia_str_length(const char *s);
+
+/* -1, 0 or 1 as a sorts before, equal to or after b, comparing unsigned bytes */
+int32_t phemia_str_compare(const char *a, const char *b);
+
+/* index of the first occurrence of t in s, -1 when there is none */
+int32_t phemia_str_find(const char *s, const char *t);
+
+/* src into dst, cut to capacity - 1 characters; returns the number copied */
+int32_t phemia_str_copy(char *dst, const char *src, int32_t capacity);
+
+/*
+ * The next line of stdin without its newline, cut to capacity - 1 characters (the rest of a longer
+ * line is skipped). Returns its length, -1 at end of input. Reads through stdio's buffer, so it
+ * interleaves with scanf and gets.
+ */
+int32_t phemia_read_line(char *buffer, int32_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PHEMIA_TEXT_H
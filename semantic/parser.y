@@ -2,17 +2,31 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include "diagnostics.hpp"
 #include "node.h"
+#include "stream.hpp"
 
 extern int yylex();
 void yyerror(const char *s);
 
 NBlock *programBlock;
+/* when set, top-level statements go here as soon as they are parsed instead of into programBlock */
+StatementStream *statementStream = nullptr;
+Diagnostics diagnostics;
+
+static void topLevel(NBlock *block, NStatement *statement) {
+    /* a statement dropped by error recovery */
+    if (!statement) return;
+    if (statementStream) statementStream->push(statement);
+    else block->statements.push_back(statement);
+}
 extern int charPos;
 extern int charLine;
 extern std::string curToken;
 %}
 
+%define parse.error verbose
+
 %union {
     std::string* val;
     std::string* type;
@@ -25,32 +39,41 @@ extern std::string curToken;
     VariableList *varVec;
     ExpressionList *expVec;
     ArrayDimension *arrDim;
+    NClassDeclaration *classDecl;
+    NCase *caseClause;
+    CaseList *caseVec;
     int32_t token;
 }
 
-%token <token> LSB RSB LMB RMB LLB RLB DOT COLON SEMI
-%token <token> PLUS MINUS MUL DIV MOD XOR AND OR QUOTE
-%token <token> GT GE LT LE NE EQ ASSIGN NOT COMMA INC DEC
+/* the quoted aliases name the tokens in syntax error messages */
+%token <token> LSB "(" RSB ")" LMB "[" RMB "]" LLB "{" RLB "}" DOT "." COLON ":" SEMI ";"
+%token <token> PLUS "+" MINUS "-" MUL "*" DIV "/" MOD "%" XOR "^" AND "&&" OR "||" QUOTE
+%token <token> GT ">" GE ">=" LT "<" LE "<=" NE "!=" EQ "==" ASSIGN "=" NOT "!" COMMA "," INC "++" DEC "--"
 
-%token <token> IF ELSE WHILE FOR DO BREAK CONTINUE
-%token <token> SWITCH CASE DEFAULT FUNCTION
-%token <token> INT CHAR DOUBLE FLOAT BOOLEAN CONST
-%token <token> VOID ENUM STRING NEW CLASS THIS
-%token <token> TRY CATCH THROW PUBLIC PRIVATE PROTECTED
-%token <token> SIZEOF RETURN
-%token <val> ID
+%token <token> IF "if" ELSE "else" WHILE "while" FOR "for" DO "do" BREAK "break" CONTINUE "continue"
+%token <token> SWITCH "switch" CASE "case" DEFAULT "default" FUNCTION "function"
+%token <token> ASYNC "async" AWAIT "await"
+%token <token> INT "int" CHAR "char" DOUBLE "double" FLOAT "float" BOOLEAN "boolean" CONST "const"
+%token <token> VOID "void" ENUM "enum" STRING "string" NEW "new" CLASS "class" THIS "this"
+%token <token> TRY "try" CATCH "catch" THROW "throw" PUBLIC "public" PRIVATE "private" PROTECTED "protected"
+%token <token> SIZEOF "sizeof" RETURN "return"
+%token <val> ID "identifier"
 
-%token <val> INTEGER BOOL DNUMBER FNUMBER CHARACTER STR
+%token <val> INTEGER "integer" BOOL "boolean literal" DNUMBER "double literal" FNUMBER "float literal"
+%token <val> CHARACTER "character literal" STR "string literal"
 
-%type <block> program blockedStmt stmts
+%type <block> program topStmts blockedStmt stmts
 %type <stmt> stmt funcDecl decl ifStmt forStmt nullableStmt
-%type <stmt> whileStmt doWhileStmt
-%type <id> type id basicType
-%type <expr> exp expr term factor literal call assign
+%type <stmt> whileStmt doWhileStmt classDecl switchStmt
+%type <caseClause> caseClause
+%type <caseVec> caseList
+%type <classDecl> classMembers
+%type <id> type declType id basicType mapType
+%type <expr> exp andExp cmpExp expr term factor literal call assign
 %type <varVec> declParamList
 %type <expVec> paramList arrayIndices literalList literalArray
 %type <varDecl> idDecl constIdDecl
-%type <arrDim> arrayDimensions
+%type <arrDim> arrayDimensions unsizedDimensions
 
 %left PLUS MINUS MUL DIV MOD XOR AND OR NOT
 %left GT GE LT LE NE EQ
@@ -58,22 +81,30 @@ extern std::string curToken;
 
 %%
 
-program : stmts { programBlock = $1; }
+program : topStmts { programBlock = $1; }
     ;
 
-stmts : stmts stmt { $1->statements.push_back($2); }
-    | stmt { $$ = new NBlock(); $$->statements.push_back($1); }
+topStmts : topStmts stmt { topLevel($1, $2); }
+    | stmt { $$ = new NBlock(); topLevel($$, $1); }
+    ;
+
+stmts : stmts stmt { if ($2) $1->statements.push_back($2); }
+    | stmt { $$ = new NBlock(); if ($1) $$->statements.push_back($1); }
     ;
 
 stmt : decl SEMI { $$ = $1; }
+    | classDecl SEMI { $$ = $1; }
     | ifStmt { $$ = $1; }
     | forStmt { $$ = $1; }
     | whileStmt { $$ = $1; }
     | doWhileStmt SEMI{ $$ = $1; }
+    | switchStmt { $$ = $1; }
     | assign SEMI { $$ = new NExpressionStatement($1); }
     | exp SEMI { $$ = new NExpressionStatement($1); }
     | BREAK SEMI { $$ = new NBreakStatement(); }
     | CONTINUE SEMI { $$ = new NContinueStatement(); }
+    /* skip to the end of a broken statement and go on with the next one */
+    | error SEMI { $$ = nullptr; yyerrok; if (diagnostics.exhausted()) YYABORT; }
     ;
 
 whileStmt : WHILE LSB exp RSB blockedStmt { $$ = new NWhileStatement($3, $5); }
@@ -97,20 +128,35 @@ ifStmt : IF LSB exp RSB blockedStmt { $$ = new NIfStatement($3, $5); }
     }
     ;
 
+switchStmt : SWITCH LSB exp RSB LLB caseList RLB { $$ = new NSwitchStatement($3, *$6); }
+    ;
+
+caseList : caseList caseClause { $1->push_back($2); }
+    | { $$ = new CaseList(); }
+    ;
+
+caseClause : CASE exp COLON stmts { $$ = new NCase($2, $4); }
+    | CASE exp COLON { $$ = new NCase($2, new NBlock()); }
+    | DEFAULT COLON stmts { $$ = new NCase(nullptr, $3); }
+    | DEFAULT COLON { $$ = new NCase(nullptr, new NBlock()); }
+    ;
+
 forStmt : FOR LSB nullableStmt SEMI exp SEMI nullableStmt RSB blockedStmt { $$ = new NForStatement($3, $5, $7, $9); }
 blockedStmt : LLB stmts RLB { $$ = $2; }
     | LLB RLB { $$ = new NBlock(); }
+    | LLB error RLB { $$ = new NBlock(); yyerrok; if (diagnostics.exhausted()) YYABORT; }
     ;
 
 decl : idDecl { $$ = $1; }
     | constIdDecl { $$ = $1; }
     | funcDecl { $$ = $1; }
+    | ASYNC funcDecl { dynamic_cast<NFunctionDeclaration *>($2)->isAsync = true; $$ = $2; }
     | RETURN exp { $$ = new NReturnStatement($2); }
     | RETURN { $$ = new NReturnStatement(); }
     ;
 
-idDecl : type id { $$ = new NVariableDeclaration(false, *$1, *$2); }
-    | type id ASSIGN exp { $$ = new NVariableDeclaration(false, *$1, *$2, $4); }
+idDecl : declType id { $$ = new NVariableDeclaration(false, *$1, *$2); }
+    | declType id ASSIGN exp { $$ = new NVariableDeclaration(false, *$1, *$2, $4); }
     ;
 
 literalArray : LLB literalList RLB { $$ = $2; }
@@ -119,11 +165,29 @@ literalList : literalList COMMA literal { $$->push_back($3); }
     | literal { $$ = new ExpressionList(); $$->push_back($1); }
     ;
 
-constIdDecl : CONST type id { $$ = new NVariableDeclaration(true, *$2, *$3); }
-    | CONST type id ASSIGN exp { $$ = new NVariableDeclaration(true, *$2, *$3, $5); }
+constIdDecl : CONST declType id { $$ = new NVariableDeclaration(true, *$2, *$3); }
+    | CONST declType id ASSIGN exp { $$ = new NVariableDeclaration(true, *$2, *$3, $5); }
+    ;
+
+classDecl : CLASS id LLB classMembers RLB { $4->id = $2; $$ = $4; }
+    | id CLASS id LLB classMembers RLB {
+        if ($1->name != "soa") {
+            yyerror(("unknown class layout " + $1->name).c_str());
+            YYERROR;
+        }
+        $5->id = $3;
+        $5->structOfArrays = true;
+        $$ = $5;
+    }
+    ;
+
+classMembers : classMembers idDecl SEMI { $1->fields.push_back($2); }
+    | classMembers funcDecl SEMI { $1->methods.push_back(dynamic_cast<NFunctionDeclaration *>($2)); }
+    | classMembers error SEMI { yyerrok; if (diagnostics.exhausted()) YYABORT; }
+    | { $$ = new NClassDeclaration(); }
     ;
 
-funcDecl : FUNCTION id LSB declParamList RSB COLON type blockedStmt {
+funcDecl : FUNCTION id LSB declParamList RSB COLON declType blockedStmt {
     $$ = new NFunctionDeclaration(*$7, *$2, *$4, *$8); }
     ;
 
@@ -134,22 +198,26 @@ declParamList : idDecl { $$ = new VariableList(); $$->push_back($1); }
     | { $$ = new VariableList(); }
     ;
 
-exp : expr
-    | exp GE expr { $$ = new NBinaryOperator($1, $2, $3); }
-    | exp GT expr { $$ = new NBinaryOperator($1, $2, $3); }
-    | exp LE expr { $$ = new NBinaryOperator($1, $2, $3); }
-    | exp LT expr { $$ = new NBinaryOperator($1, $2, $3); }
-    | exp NE expr { $$ = new NBinaryOperator($1, $2, $3); }
-    | exp EQ expr { $$ = new NBinaryOperator($1, $2, $3); }
+exp : andExp
+    | exp OR andExp { $$ = new NBinaryOperator($1, $2, $3); }
+    ;
+andExp : cmpExp
+    | andExp AND cmpExp { $$ = new NBinaryOperator($1, $2, $3); }
+    ;
+cmpExp : expr
+    | cmpExp GE expr { $$ = new NBinaryOperator($1, $2, $3); }
+    | cmpExp GT expr { $$ = new NBinaryOperator($1, $2, $3); }
+    | cmpExp LE expr { $$ = new NBinaryOperator($1, $2, $3); }
+    | cmpExp LT expr { $$ = new NBinaryOperator($1, $2, $3); }
+    | cmpExp NE expr { $$ = new NBinaryOperator($1, $2, $3); }
+    | cmpExp EQ expr { $$ = new NBinaryOperator($1, $2, $3); }
     ;
 expr : expr PLUS term { $$ = new NBinaryOperator($1, $2, $3); }
     | expr MINUS term { $$ = new NBinaryOperator($1, $2, $3); }
-    | expr OR term { $$ = new NBinaryOperator($1, $2, $3); }
     | term { $$ = $1; }
     ;
 term : term MUL factor { $$ = new NBinaryOperator($1, $2, $3); }
     | term DIV factor { $$ = new NBinaryOperator($1, $2, $3); }
-    | term AND factor { $$ = new NBinaryOperator($1, $2, $3); }
     | term MOD factor { $$ = new NBinaryOperator($1, $2, $3); }
     | term XOR factor { $$ = new NBinaryOperator($1, $2, $3); }
     | factor { $$ = $1; }
@@ -164,16 +232,27 @@ factor : literal { $$ = $1; }
     | DEC id { $$ = new NDecOperator($1, $2, true); }
     | id INC { $$ = new NIncOperator($2, $1, false); }
     | id DEC { $$ = new NDecOperator($2, $1, false); }
-    | id DOT id {}
-    | id DOT call {}
+    | id DOT id { $$ = new NMemberAccess(*$1, *$3); }
+    | id DOT call { $$ = new NMethodCall(*$1, *dynamic_cast<NFunctionCall *>($3)); }
+    | id arrayIndices DOT id { $$ = new NMemberAccess(*$1, *$4, $2); }
+    | id arrayIndices DOT call { $$ = new NMethodCall(*$1, *dynamic_cast<NFunctionCall *>($4), $2); }
+    | NEW id LSB RSB { $$ = new NNewObject(*$2); }
     | id arrayIndices { $$ = new NArrayElement(*$1, *$2); }
     | arrayDimensions type literalArray { $$ = new NArray($1, $2, $3); }
     | NEW arrayDimensions type LSB RSB { $$ = new NArray($2, $3); }
+    | NEW mapType LSB RSB { $$ = new NNewObject(*$2); }
     | SIZEOF LSB type RSB {}
+    | AWAIT factor { $$ = new NAwait($2); }
     ;
 arrayDimensions : arrayDimensions LMB INTEGER RMB { $$->push_back($3); }
     | LMB INTEGER RMB { $$ = new ArrayDimension(); $$->push_back($2); }
     ;
+/* dimensions with at least one `[]`, taken from the value at run time; only declared types have them */
+unsizedDimensions : LMB RMB { $$ = new ArrayDimension(); $$->push_back(new std::string("0")); }
+    | arrayDimensions LMB RMB { $$->push_back(new std::string("0")); }
+    | unsizedDimensions LMB RMB { $$->push_back(new std::string("0")); }
+    | unsizedDimensions LMB INTEGER RMB { $$->push_back($3); }
+    ;
 arrayIndices : arrayIndices LMB exp RMB { $1->push_back($3); }
     | LMB exp RMB { $$ = new ExpressionList(); $$->push_back($2); }
     ;
@@ -182,7 +261,8 @@ call : id LSB RSB { $$ = new NFunctionCall(*$1, *(new ExpressionList())); }
     ;
 assign : id ASSIGN exp { $$ = new NAssignment(*$1, *$3); }
     | id arrayIndices ASSIGN exp { $$ = new NArrayAssignment(*$1, *$2, *$4); }
-    | id DOT id RMB ASSIGN exp {}
+    | id DOT id ASSIGN exp { $$ = new NClassAssignment(*$1, *$3, *$5); }
+    | id arrayIndices DOT id ASSIGN exp { $$ = new NClassAssignment(*$1, *$4, *$6, $2); }
     ;
 paramList : exp { $$ = new ExpressionList(); $$->push_back($1); }
     | paramList COMMA exp { $$->push_back($3); }
@@ -198,6 +278,23 @@ literal : INTEGER { $$ = new NInteger(*$1); }
 type : id { $$ = $1; }
     | basicType { $$ = $1; }
     | arrayDimensions basicType { $$ = new NArrayType($1, *$2); }
+    | mapType { $$ = $1; }
+    ;
+/* the type of a variable, parameter, field or result */
+declType : type { $$ = $1; }
+    | arrayDimensions id { $$ = new NArrayType($1, *$2); }
+    | unsizedDimensions basicType { $$ = new NArrayType($1, *$2); }
+    | unsizedDimensions id { $$ = new NArrayType($1, *$2); }
+    ;
+
+/* map[string]int: named by its spelling, see ARStack::typeOf; `map` stays an ordinary identifier elsewhere */
+mapType : id LMB basicType RMB basicType {
+        if ($1->name != "map") {
+            yyerror(("unknown type " + $1->name + "[...]").c_str());
+            YYERROR;
+        }
+        $$ = new NIdentifier("map[" + $3->name + "]" + $5->name);
+    }
     ;
 
 basicType : INT { $$ = new NIdentifier("int"); }
@@ -209,11 +306,11 @@ basicType : INT { $$ = new NIdentifier("int"); }
     | STRING { $$ = new NIdentifier("string"); }
     ;
 
-id : ID { $$ = new NIdentifier(*$1); };
+id : ID { $$ = new NIdentifier(*$1); }
+    | THIS { $$ = new NIdentifier("this"); }
+    ;
 %%
 
 void yyerror(const char *s) {
-    std::cout << "Token: " << curToken << std::endl
-        << "Error: " << s << " at " << charLine << ":" << charPos << std::endl;
-    std::exit(1);
+    diagnostics.error(charLine, charPos, s);
 }
\ No newline at end of file
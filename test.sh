@@ -4,17 +4,155 @@ make &&
 echo "---------QuickSort---------"
 ./Phemia test/QuickSort/ans.txt &&
 llc -filetype=obj test/output.ll &&
-gcc test/output.o -o test/QuickSort/QuickSort
+gcc test/output.o libphemia_rt.a -lpthread -o test/QuickSort/QuickSort
 ./test/QuickSort/darwin-amd64 ./test/QuickSort/QuickSort
 
 echo "---------MatrixMul---------"
 ./Phemia test/MatrixMul/ans.txt &&
 llc -filetype=obj test/output.ll &&
-gcc test/output.o -o test/MatrixMul/MatrixMul
+gcc test/output.o libphemia_rt.a -lpthread -o test/MatrixMul/MatrixMul
 ./test/MatrixMul/darwin-amd64 ./test/MatrixMul/MatrixMul
 
 echo "---------Course---------"
 ./Phemia test/Course/ans.txt &&
 llc -filetype=obj test/output.ll &&
-gcc test/output.o -o test/Course/Course
-./test/Course/darwin-amd64 ./test/Course/Course
\ No newline at end of file
+gcc test/output.o libphemia_rt.a -lpthread -o test/Course/Course
+./test/Course/darwin-amd64 ./test/Course/Course
+
+echo "---------Globals---------"
+./Phemia test/22.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/22.out
+
+echo "---------Global arrays---------"
+./Phemia test/23.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/23.out
+
+echo "---------Rebinding---------"
+./Phemia test/24.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/24.out
+
+echo "---------Object layout---------"
+./Phemia test/25.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/25.out
+
+echo "---------map as a name---------"
+./Phemia test/26.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/26.out
+
+echo "---------Compile-time calls---------"
+./Phemia test/27.txt &&
+! grep -q "call i32 @square\|call i32 @collatz" test/output.ll &&
+grep -q "call i32 @spin" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/27.out
+
+echo "---------Loop nests---------"
+./Phemia test/28.txt &&
+grep -q "tileEnd" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/28.out
+
+echo "---------Daemon---------"
+export PHEMIAD_SOCKET=/tmp/phemiad-test.sock
+./Phemia --daemon $PHEMIAD_SOCKET &
+daemon=$!
+sleep 1
+./phemiac test/29.txt --jit | diff - test/29.out &&
+./phemiac test/29.txt --jit | diff - test/29.out &&
+./phemiac test/29.txt --jit --heap-profile=test/heap.pprof | diff - test/29.out &&
+grep -q phemia_profile_start test/output.ll &&
+./phemiac test/29.txt --jit | diff - test/29.out &&
+! grep -q phemia_profile_start test/output.ll
+kill $daemon
+
+echo "---------Tiered JIT---------"
+./Phemia test/30.txt --jit | diff - test/30.out
+./Phemia --daemon $PHEMIAD_SOCKET &
+daemon=$!
+sleep 1
+./phemiac test/30.txt --jit | diff - test/30.out &&
+./phemiac test/30.txt --jit | diff - test/30.out
+kill $daemon
+
+echo "---------Streaming---------"
+./Phemia test/31.txt --stream &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/31.out &&
+./Phemia test/31.txt --stream --jit | diff - test/31.out
+
+echo "---------Stack arrays---------"
+./Phemia test/32.txt &&
+grep -q "%digits = alloca \[12 x i32\]" test/output.ll &&
+grep -q "%sq = alloca \[8 x i32\]" test/output.ll &&
+grep -q "constant \[5 x i32\] \[i32 3, i32 1, i32 4, i32 1, i32 5\]" test/output.ll &&
+grep -q "constant \[7 x i8\] c\"digits\\\\00\"" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/32.out
+
+echo "---------Error recovery---------"
+! ./Phemia test/33.txt 2> test/errors.txt > /dev/null &&
+diff test/errors.txt test/33.err &&
+! ./Phemia test/33.txt --max-errors 3 2> test/errors.txt > /dev/null &&
+tail -1 test/errors.txt | grep -q "too many errors, stopping after 3"
+
+echo "---------Formatted IO---------"
+./Phemia test/34.txt &&
+grep -q "call i32 @phemia_read_int" test/output.ll &&
+grep -q "call i32 @phemia_write_int" test/output.ll &&
+grep -q "call i32 @phemia_write_double" test/output.ll &&
+[ "$(grep -c "call i32 (i8\*, ...) @printf" test/output.ll)" = 1 ] &&
+! grep -q "call i32 (i8\*, ...) @scanf" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample < test/34.in | diff - test/34.out
+
+echo "---------Parallel objects---------"
+./Phemia test/35.txt --obj test/parallel.o --jobs 4 &&
+gcc test/parallel.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/35.out &&
+./Phemia test/35.txt --obj test/parallel.o --jobs 1 &&
+gcc test/parallel.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/35.out &&
+./Phemia test/35.txt --obj test/parallel.o --jobs 4 --multiversion &&
+gcc test/parallel.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/35.out
+
+echo "---------Shape clones---------"
+./Phemia test/36.txt &&
+! grep -q "undef" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/36.out
+
+echo "---------Switch labels---------"
+./Phemia test/37.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/37.out
+
+echo "---------Element conversions---------"
+./Phemia test/38.txt &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/38.out
+
+echo "---------Struct of arrays---------"
+./Phemia test/39.txt &&
+grep -q "%column" test/output.ll &&
+llc -filetype=obj test/output.ll &&
+gcc test/output.o libphemia_rt.a -lpthread -o test/sample &&
+./test/sample | diff - test/39.out